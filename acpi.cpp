@@ -0,0 +1,276 @@
+#include "acpi.h"
+#include "paging.h"
+
+// =============================================================================
+// Table layouts
+// =============================================================================
+
+struct AcpiRsdp {
+    char     signature[8];      // "RSD PTR "
+    uint8_t  checksum;          // Over the first 20 bytes
+    char     oem_id[6];
+    uint8_t  revision;
+    uint32_t rsdt_addr;
+} __attribute__((packed));
+
+struct AcpiHeader {
+    char     signature[4];
+    uint32_t length;            // Whole table, header included
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct AcpiMadt {
+    AcpiHeader header;          // "APIC"
+    uint32_t   lapic_addr;
+    uint32_t   flags;
+    // Variable-length entries follow: type, length, data
+} __attribute__((packed));
+
+#define MADT_LOCAL_APIC     0
+#define MADT_IOAPIC         1
+#define MADT_OVERRIDE       2       // Interrupt source override
+#define MADT_LAPIC_ENABLED  0x1
+
+struct MpFloating {
+    char     signature[4];      // "_MP_"
+    uint32_t config_addr;
+    uint8_t  length;            // In 16-byte units
+    uint8_t  spec_rev;
+    uint8_t  checksum;
+    uint8_t  features[5];
+} __attribute__((packed));
+
+struct MpConfig {
+    char     signature[4];      // "PCMP"
+    uint16_t length;
+    uint8_t  spec_rev;
+    uint8_t  checksum;
+    char     oem_id[8];
+    char     product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_addr;
+    uint16_t ext_length;
+    uint8_t  ext_checksum;
+    uint8_t  reserved;
+} __attribute__((packed));
+
+#define MP_ENTRY_PROCESSOR  0       // 20 bytes, every other entry is 8
+#define MP_ENTRY_BUS        1
+#define MP_ENTRY_IOAPIC     2
+#define MP_ENTRY_IO_INT     3
+#define MP_CPU_ENABLED      0x1
+#define MP_IOAPIC_ENABLED   0x1
+#define MP_INT_VECTORED     0       // Plain INT (not NMI/SMI/ExtINT)
+
+// The MP tables do not say which GSI an IOAPIC starts at; number the pins
+// in table order assuming the usual 24 per IOAPIC
+#define MP_IOAPIC_PINS      24
+
+static PlatformInfo platform;
+
+// =============================================================================
+// Helpers
+// =============================================================================
+
+static bool sig_eq(const char* a, const char* b, int n) {
+    for (int i = 0; i < n; i++) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+static bool checksum_ok(const void* data, uint32_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) sum += p[i];
+    return sum == 0;
+}
+
+// Tables can live anywhere in physical memory; anything above the 4MB
+// identity map (QEMU puts ACPI at the top of RAM) gets mapped on demand.
+// 4MB-60MB holds the kernel heap and task stacks (virtual), so a table there
+// (only on machines with under 60MB of RAM) cannot be identity mapped - skip it.
+
+static bool map_table(uint32_t addr, uint32_t len) {
+    if (addr + len <= IDENTITY_MAPPED_END) return true;
+    if (addr < KERNEL_VIRTUAL_END) return false;
+    map_identity(addr, len, PTE_PRESENT | PTE_WRITABLE);
+    return true;
+}
+
+static void add_cpu(uint8_t apic_id) {
+    if (platform.cpu_count < SMP_MAX_CPUS) {
+        platform.cpu_apic_ids[platform.cpu_count++] = apic_id;
+    }
+}
+
+static void add_ioapic(uint8_t id, uint32_t addr, uint32_t gsi_base) {
+    if (platform.ioapic_count < ACPI_MAX_IOAPICS) {
+        IoApicInfo* io = &platform.ioapics[platform.ioapic_count++];
+        io->id       = id;
+        io->addr     = addr;
+        io->gsi_base = gsi_base;
+    }
+}
+
+static void set_isa_route(uint8_t irq, uint32_t gsi, uint16_t flags) {
+    if (irq < ISA_IRQ_COUNT) {
+        platform.isa_gsi[irq]   = gsi;
+        platform.isa_flags[irq] = flags;
+    }
+}
+
+// Forget whatever a failed scan found
+static void reset_platform() {
+    platform.cpu_count    = 0;
+    platform.ioapic_count = 0;
+    for (int i = 0; i < ISA_IRQ_COUNT; i++) {
+        platform.isa_gsi[i]   = i;
+        platform.isa_flags[i] = 0;
+    }
+}
+
+// Look for a 16-byte aligned signature in [start, start + len)
+static void* scan(uint32_t start, uint32_t len, const char* sig, int sig_len) {
+    for (uint32_t addr = start; addr + 16 <= start + len; addr += 16) {
+        if (sig_eq((const char*)addr, sig, sig_len)) return (void*)addr;
+    }
+    return 0;
+}
+
+// EBDA (first KB), then the BIOS ROM area - where both specs say to look
+static void* scan_bios_areas(const char* sig, int sig_len, uint32_t rom_start) {
+    uint32_t ebda = (uint32_t)(*(uint16_t*)0x40E) << 4;
+    void* found = 0;
+    if (ebda) found = scan(ebda, 1024, sig, sig_len);
+    if (!found) found = scan(0x9FC00, 1024, sig, sig_len);
+    if (!found) found = scan(rom_start, 0x100000 - rom_start, sig, sig_len);
+    return found;
+}
+
+// =============================================================================
+// ACPI
+// =============================================================================
+
+static bool parse_madt(AcpiMadt* madt) {
+    platform.lapic_base = madt->lapic_addr;
+
+    uint8_t* p   = (uint8_t*)madt + sizeof(AcpiMadt);
+    uint8_t* end = (uint8_t*)madt + madt->header.length;
+    while (p + 2 <= end && p[1] >= 2) {
+        if (p[0] == MADT_LOCAL_APIC && (*(uint32_t*)(p + 4) & MADT_LAPIC_ENABLED)) {
+            add_cpu(p[3]);
+        } else if (p[0] == MADT_IOAPIC) {
+            add_ioapic(p[2], *(uint32_t*)(p + 4), *(uint32_t*)(p + 8));
+        } else if (p[0] == MADT_OVERRIDE && p[2] == 0) {   // Bus 0 = ISA
+            set_isa_route(p[3], *(uint32_t*)(p + 4), *(uint16_t*)(p + 8));
+        }
+        p += p[1];
+    }
+    return platform.cpu_count > 0;
+}
+
+static bool acpi_scan() {
+    AcpiRsdp* rsdp = (AcpiRsdp*)scan_bios_areas("RSD PTR ", 8, 0xE0000);
+    if (!rsdp || !checksum_ok(rsdp, 20)) return false;
+
+    if (!map_table(rsdp->rsdt_addr, sizeof(AcpiHeader))) return false;
+    AcpiHeader* rsdt = (AcpiHeader*)rsdp->rsdt_addr;
+    if (!map_table(rsdp->rsdt_addr, rsdt->length)) return false;
+    if (!sig_eq(rsdt->signature, "RSDT", 4) || !checksum_ok(rsdt, rsdt->length)) return false;
+
+    uint32_t count = (rsdt->length - sizeof(AcpiHeader)) / 4;
+    uint32_t* entries = (uint32_t*)((uint8_t*)rsdt + sizeof(AcpiHeader));
+    for (uint32_t i = 0; i < count; i++) {
+        if (!map_table(entries[i], sizeof(AcpiHeader))) continue;
+        AcpiHeader* h = (AcpiHeader*)entries[i];
+        if (!sig_eq(h->signature, "APIC", 4)) continue;
+
+        if (!map_table(entries[i], h->length)) continue;
+        if (!checksum_ok(h, h->length)) continue;
+        return parse_madt((AcpiMadt*)h);
+    }
+    return false;
+}
+
+// =============================================================================
+// Intel MP tables
+// =============================================================================
+
+static bool mp_scan() {
+    MpFloating* mpf = (MpFloating*)scan_bios_areas("_MP_", 4, 0xF0000);
+    if (!mpf || !checksum_ok(mpf, mpf->length * 16) || !mpf->config_addr) return false;
+
+    if (!map_table(mpf->config_addr, sizeof(MpConfig))) return false;
+    MpConfig* cfg = (MpConfig*)mpf->config_addr;
+    if (!map_table(mpf->config_addr, cfg->length)) return false;
+    if (!sig_eq(cfg->signature, "PCMP", 4) || !checksum_ok(cfg, cfg->length)) return false;
+
+    platform.lapic_base = cfg->lapic_addr;
+
+    // Entries come sorted by type, so buses and IOAPICs are known by the
+    // time the interrupt assignments referring to them show up
+    uint32_t isa_buses = 0;     // Bitmap of bus ids 0-31 that are ISA
+    uint8_t* p = (uint8_t*)cfg + sizeof(MpConfig);
+    for (uint16_t i = 0; i < cfg->entry_count; i++) {
+        if (p[0] == MP_ENTRY_PROCESSOR) {
+            if (p[3] & MP_CPU_ENABLED) add_cpu(p[1]);
+            p += 20;
+            continue;
+        }
+
+        if (p[0] == MP_ENTRY_BUS) {
+            if (p[1] < 32 && sig_eq((const char*)p + 2, "ISA", 3)) isa_buses |= 1u << p[1];
+        } else if (p[0] == MP_ENTRY_IOAPIC) {
+            if (p[3] & MP_IOAPIC_ENABLED) {
+                add_ioapic(p[1], *(uint32_t*)(p + 4), platform.ioapic_count * MP_IOAPIC_PINS);
+            }
+        } else if (p[0] == MP_ENTRY_IO_INT && p[1] == MP_INT_VECTORED) {
+            uint8_t bus = p[4];
+            if (bus < 32 && (isa_buses & (1u << bus))) {
+                for (int j = 0; j < platform.ioapic_count; j++) {
+                    if (platform.ioapics[j].id == p[6]) {
+                        set_isa_route(p[5], platform.ioapics[j].gsi_base + p[7], *(uint16_t*)(p + 2));
+                    }
+                }
+            }
+        }
+        p += 8;
+    }
+    return platform.cpu_count > 0;
+}
+
+// =============================================================================
+// Public API
+// =============================================================================
+
+bool acpi_init() {
+    platform.source = 0;
+    reset_platform();
+
+    if (acpi_scan()) {
+        platform.source = "ACPI";
+        return true;
+    }
+
+    reset_platform();
+    if (mp_scan()) {
+        platform.source = "MP";
+        return true;
+    }
+
+    reset_platform();
+    return false;
+}
+
+const PlatformInfo* acpi_get_platform() {
+    return &platform;
+}
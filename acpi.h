@@ -0,0 +1,51 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include "percpu.h"
+
+// =============================================================================
+// Platform discovery from firmware tables
+//
+// Finds the CPUs, the local APIC address, the IOAPICs and where the ISA IRQs
+// are wired to from the ACPI MADT, falling back to the older Intel
+// MultiProcessor tables when there is no ACPI.
+// =============================================================================
+
+#define ACPI_MAX_IOAPICS 4
+#define ISA_IRQ_COUNT    16
+
+// ISA IRQ polarity/trigger flags - the MADT override and MP interrupt
+// entries share this encoding. 0 means "bus default" (ISA: high, edge).
+#define IRQ_POLARITY_MASK 0x3
+#define IRQ_ACTIVE_LOW    0x3
+#define IRQ_TRIGGER_MASK  0xC
+#define IRQ_LEVEL         0xC
+
+struct IoApicInfo {
+    uint8_t  id;
+    uint32_t addr;
+    uint32_t gsi_base;                    // First global system interrupt it serves
+};
+
+struct PlatformInfo {
+    const char* source;                   // "ACPI", "MP" or 0 if nothing found
+    uint32_t    lapic_base;
+    int         cpu_count;                // Enabled CPUs, bootstrap CPU included
+    uint8_t     cpu_apic_ids[SMP_MAX_CPUS];
+
+    int         ioapic_count;
+    IoApicInfo  ioapics[ACPI_MAX_IOAPICS];
+
+    // ISA IRQ n arrives on GSI isa_gsi[n] (identity unless overridden)
+    uint32_t    isa_gsi[ISA_IRQ_COUNT];
+    uint16_t    isa_flags[ISA_IRQ_COUNT];
+};
+
+// Scan for the tables. Returns false if neither ACPI nor MP tables exist.
+// Needs paging (tables above the identity-mapped area are mapped on demand).
+bool acpi_init();
+
+const PlatformInfo* acpi_get_platform();
+
+#endif
@@ -0,0 +1,79 @@
+; Application processor trampoline
+;
+; Copied to AP_TRAMPOLINE_ADDR (0x7000) by smp.cpp; a STARTUP IPI with
+; vector 0x07 makes the AP start executing here in real mode at 0700:0000.
+; The code only ever runs from the copy, so every address is computed
+; relative to that location. The parameter block at the end is filled in by
+; the bootstrap CPU before each AP is started.
+
+[bits 16]
+
+AP_TRAMPOLINE_ADDR equ 0x7000
+%define REL(x) (AP_TRAMPOLINE_ADDR + (x) - ap_trampoline_start)
+
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_param_cr3
+global ap_param_stack
+global ap_param_entry
+
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    lgdt [REL(ap_gdt_descriptor)]
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:REL(ap_protected_mode)
+
+[bits 32]
+ap_protected_mode:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; Same page directory as the bootstrap CPU
+    mov eax, [REL(ap_param_cr3)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80000000
+    mov cr0, eax
+
+    mov esp, [REL(ap_param_stack)]
+    xor ebp, ebp
+    mov eax, [REL(ap_param_entry)]
+    call eax
+
+.halt:                          ; ap_main never returns
+    cli
+    hlt
+    jmp .halt
+
+; Flat code + data, identical to the bootloader's - just enough to reach
+; ap_main, which then loads the kernel GDT
+align 8
+ap_gdt:
+    dq 0
+    dw 0xffff, 0x0000
+    db 0x00, 0b10011010, 0b11001111, 0x00
+    dw 0xffff, 0x0000
+    db 0x00, 0b10010010, 0b11001111, 0x00
+ap_gdt_end:
+
+ap_gdt_descriptor:
+    dw ap_gdt_end - ap_gdt - 1
+    dd REL(ap_gdt)
+
+; Parameters, written by smp.cpp into the copy before each STARTUP IPI
+align 4
+ap_param_cr3:   dd 0
+ap_param_stack: dd 0
+ap_param_entry: dd 0
+
+ap_trampoline_end:
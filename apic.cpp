@@ -0,0 +1,177 @@
+#include "apic.h"
+#include "cpu.h"
+#include "paging.h"
+#include "timer.h"
+
+// Register offsets
+#define LAPIC_ID          0x020
+#define LAPIC_TPR         0x080
+#define LAPIC_EOI         0x0B0
+#define LAPIC_SVR         0x0F0
+#define LAPIC_ESR         0x280
+#define LAPIC_ICR_LOW     0x300
+#define LAPIC_ICR_HIGH    0x310
+#define LAPIC_LVT_TIMER   0x320
+#define LAPIC_LVT_ERROR   0x370
+#define LAPIC_TIMER_INIT  0x380
+#define LAPIC_TIMER_CUR   0x390
+#define LAPIC_TIMER_DIV   0x3E0
+
+#define LAPIC_SVR_ENABLE      0x100
+#define LAPIC_LVT_MASKED      0x10000
+#define LAPIC_TIMER_PERIODIC  0x20000
+#define LAPIC_TIMER_TSC_DEADLINE 0x40000
+#define LAPIC_TIMER_DIV_16    0x3
+
+// ICR fields
+#define ICR_INIT          0x500
+#define ICR_STARTUP       0x600
+#define ICR_LEVEL_ASSERT  0x4000
+#define ICR_DELIVERY_BUSY 0x1000
+
+#define MSR_APIC_BASE     0x1B
+#define MSR_TSC_DEADLINE  0x6E0
+#define APIC_BASE_ENABLE  0x800
+
+static volatile uint32_t* lapic = 0;
+extern "C" { volatile uint32_t* lapic_eoi_reg = 0; }
+static uint32_t ticks_per_pit = 0;
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val) {
+    lapic[reg / 4] = val;
+    (void)lapic[LAPIC_ID / 4];  // Read back to post the write
+}
+
+static void lapic_wait_icr() {
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_DELIVERY_BUSY) {
+        __asm__ volatile("pause");
+    }
+}
+
+static void lapic_send_icr(uint32_t apic_id, uint32_t low) {
+    lapic_wait_icr();
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, low);
+    lapic_wait_icr();
+}
+
+bool lapic_present() {
+    return lapic != 0;
+}
+
+bool lapic_init(uint32_t phys_base) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_APIC)) return false;
+
+    if (!phys_base) phys_base = LAPIC_DEFAULT_BASE;
+    map_identity(phys_base, PAGE_SIZE, PTE_PRESENT | PTE_WRITABLE | PTE_NOCACHE);
+    lapic = (volatile uint32_t*)phys_base;
+    lapic_eoi_reg = &lapic[LAPIC_EOI / 4];
+
+    lapic_init_cpu();
+    return true;
+}
+
+void lapic_init_cpu() {
+    // Make sure the global enable bit in the MSR is set (some BIOSes clear it)
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (edx & CPUID_EDX_MSR) {
+        uint64_t base = rdmsr(MSR_APIC_BASE);
+        if (!(base & APIC_BASE_ENABLE)) wrmsr(MSR_APIC_BASE, base | APIC_BASE_ENABLE);
+    }
+
+    // Mask everything we do not drive ourselves, accept all priorities
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TPR, 0);
+
+    // Clear any stale error state (ESR needs a write before the read)
+    lapic_write(LAPIC_ESR, 0);
+    (void)lapic_read(LAPIC_ESR);
+
+    // Software-enable the LAPIC
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_EOI, 0);
+}
+
+uint32_t lapic_get_id() {
+    return lapic ? lapic_read(LAPIC_ID) >> 24 : 0;
+}
+
+void lapic_eoi() {
+    lapic[LAPIC_EOI / 4] = 0;
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    lapic_send_icr(apic_id, vector);
+}
+
+void lapic_send_init(uint32_t apic_id) {
+    lapic_send_icr(apic_id, ICR_INIT | ICR_LEVEL_ASSERT);
+}
+
+void lapic_send_startup(uint32_t apic_id, uint8_t page) {
+    lapic_send_icr(apic_id, ICR_STARTUP | page);
+}
+
+// =============================================================================
+// Timer
+// =============================================================================
+
+void lapic_timer_calibrate_begin() {
+    if (!lapic) return;
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+}
+
+void lapic_timer_calibrate_end(uint32_t pit_ticks) {
+    if (!lapic || !pit_ticks) return;
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    ticks_per_pit = elapsed / pit_ticks;
+}
+
+void lapic_timer_start_periodic(uint8_t vector) {
+    if (!lapic || !ticks_per_pit) return;
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | vector);
+    lapic_write(LAPIC_TIMER_INIT, ticks_per_pit);
+}
+
+uint32_t lapic_timer_get_ticks_per_pit() {
+    return ticks_per_pit;
+}
+
+bool lapic_tsc_deadline_supported() {
+    if (!lapic) return false;
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return (ecx & CPUID_ECX_TSC_DEADLINE) != 0;
+}
+
+void lapic_timer_oneshot(uint8_t vector, uint32_t ns) {
+    if (!lapic || !ticks_per_pit) return;
+
+    // ticks_per_pit counts per PIT tick -> counts for 'ns'
+    uint32_t count = (uint32_t)div64_32((uint64_t)ns * ticks_per_pit, timer_get_tick_ns(), 0);
+    if (count == 0) count = 1;
+
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, vector);
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+void lapic_timer_deadline(uint8_t vector, uint64_t tsc) {
+    if (!lapic) return;
+
+    // The MSR write is ignored unless the LVT is already in deadline mode
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_TSC_DEADLINE | vector);
+    wrmsr(MSR_TSC_DEADLINE, tsc);
+}
@@ -0,0 +1,59 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+
+// =============================================================================
+// Local APIC
+//
+// Every CPU has one at the same physical address (normally 0xFEE00000); each
+// CPU only ever sees its own. Used for inter-processor interrupts, the
+// per-CPU timer, and EOI for interrupts it delivered.
+// =============================================================================
+
+#define LAPIC_DEFAULT_BASE    0xFEE00000
+
+// Vectors above the legacy IRQ range
+#define LAPIC_ONESHOT_VECTOR  0xEE
+#define LAPIC_TIMER_VECTOR    0xEF
+#define IPI_RESCHED_VECTOR    0xF0
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+// CPUID says there is one and we have mapped it
+bool     lapic_present();
+
+// Map the LAPIC registers (bootstrap CPU, once; 0 = default address) and
+// enable it on this CPU
+bool     lapic_init(uint32_t phys_base);
+
+// Enable the LAPIC on the calling CPU (application processors)
+void     lapic_init_cpu();
+
+uint32_t lapic_get_id();
+void     lapic_eoi();
+
+// The EOI register once mapped, 0 before - the fast IRQ stubs in isr.asm
+// write it directly
+extern "C" volatile uint32_t* lapic_eoi_reg;
+
+// Inter-processor interrupts
+void     lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+void     lapic_send_init(uint32_t apic_id);
+void     lapic_send_startup(uint32_t apic_id, uint8_t page);
+
+// Timer calibration: start the count on a PIT tick edge, stop it
+// 'pit_ticks' ticks later (see timer_calibrate)
+void     lapic_timer_calibrate_begin();
+void     lapic_timer_calibrate_end(uint32_t pit_ticks);
+
+// Periodic at the PIT rate on the calling CPU (application processors)
+void     lapic_timer_start_periodic(uint8_t vector);
+uint32_t lapic_timer_get_ticks_per_pit();
+
+// One-shot on the calling CPU: after 'ns', or when the TSC reaches 'tsc'
+// (TSC-deadline mode, if the CPU has it)
+bool     lapic_tsc_deadline_supported();
+void     lapic_timer_oneshot(uint8_t vector, uint32_t ns);
+void     lapic_timer_deadline(uint8_t vector, uint64_t tsc);
+
+#endif
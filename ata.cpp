@@ -1,5 +1,12 @@
 #include "ata.h"
 #include "ports.h"
+#include "sync.h"
+#include "isr.h"
+#include "hrtimer.h"
+#include "cpu.h"
+#include "pmm.h"
+#include "pci.h"
+#include "sleep.h"
 
 // =============================================================================
 // ATA PIO Driver - Talks directly to the IDE disk controller via I/O ports
@@ -11,6 +18,11 @@
 // Reference: OSDev Wiki "ATA PIO Mode"
 // Very unfmailiar with this sort of thing, so this wiki page was a God-send.
 // One of the few things I didn't have a tiny bit of knowledge about.
+//
+// Until ata_enable_irq the driver polls the status register, which is all
+// early boot can do. After it the drive raises IRQ14 whenever it finishes a
+// step (a sector read, a sector written, a flush) and the caller sleeps on
+// a semaphore in between, so other tasks get the CPU during disk I/O.
 // =============================================================================
 
 // -- Primary ATA bus I/O ports --
@@ -42,11 +54,41 @@
 #define ATA_CMD_WRITE_PIO   0x30    // Write sectors using PIO
 #define ATA_CMD_IDENTIFY    0xEC    // Identify drive - returns 512 bytes of info
 #define ATA_CMD_FLUSH       0xE7    // Flush write cache
+#define ATA_CMD_READ_DMA    0xC8    // Read sectors using bus-master DMA
+#define ATA_CMD_WRITE_DMA   0xCA    // Write sectors using bus-master DMA
+
+// -- Device control bits --
+#define ATA_CTRL_NIEN   0x02    // Drive interrupts off
+#define ATA_CTRL_SRST   0x04    // Software reset of the whole channel
 
 // -- Drive selection --
 // Bit 6 = 1 for LBA mode, Bit 4 = 0 for master / 1 for slave
 #define ATA_MASTER_LBA  0xE0   // 1110 0000 - master drive, LBA mode
 
+// Error codes when the drive never gets there / the DMA engine failed
+#define ATA_ERR_TIMEOUT 4
+#define ATA_ERR_DMA     5
+
+// Longest one step may take - a drive spinning up needs seconds
+#define ATA_TIMEOUT_NS  5000000000ULL
+
+// Status reads before a polled wait gives up (about 1us each)
+#define ATA_POLL_LIMIT  5000000
+
+// One command at a time on the bus - the register file is shared state
+static Mutex ata_lock = MUTEX_INIT;
+
+// IRQ14 completion: a step that wants the interrupt arms it before it is
+// started; the handler - or the watchdog, if the drive never answers -
+// disarms it and posts ata_done with the status it saw
+static bool ata_irq_mode = false;
+static volatile uint32_t ata_armed = 0;
+static volatile uint8_t ata_irq_status = 0;
+static Semaphore ata_done = SEMAPHORE_INIT(0);
+static HrTimer ata_watchdog = HRTIMER_INIT;
+static uint32_t ata_irqs = 0;
+static uint32_t ata_timeouts = 0;
+
 // =============================================================================
 // Internal helpers
 // =============================================================================
@@ -61,32 +103,135 @@ static void ata_delay() {
     inb(ATA_ALT_STATUS);
 }
 
+// Spin while the drive is busy. Returns 0, or ATA_ERR_TIMEOUT if it never
+// stops being busy.
+static int ata_wait_busy() {
+    for (uint32_t i = 0; i < ATA_POLL_LIMIT; i++) {
+        if (!(inb(ATA_STATUS) & ATA_SR_BSY)) return 0;
+    }
+    return ATA_ERR_TIMEOUT;
+}
+
+// Error code for a status with BSY clear. want_drq: the drive should now
+// be ready to transfer a sector.
+static int ata_check(uint8_t status, bool want_drq) {
+    if (status & ATA_SR_ERR) return 1;  // Drive reported error
+    if (status & ATA_SR_DF)  return 2;  // Drive fault
+    if (want_drq && !(status & ATA_SR_DRQ)) return 3; // DRQ not set (no data ready)
+    return 0;
+}
+
 // Poll the status register until BSY clears and DRQ sets (or error)
 // Returns 0 on success, non-zero on error
 static int ata_poll() {
     // Wait for BSY to clear
     ata_delay();
+    if (ata_wait_busy()) return ATA_ERR_TIMEOUT;
+
+    // Now check status
+    return ata_check(inb(ATA_STATUS), true);
+}
 
-    // Spin while busy
-    while (inb(ATA_STATUS) & ATA_SR_BSY) {
-        // Intentionally empty - the drive is still processing
+// =============================================================================
+// IRQ14 completion
+// =============================================================================
+
+static void ata_irq_handler(registers_t* regs) {
+    (void)regs;
+    uint8_t status = inb(ATA_STATUS);   // Reading it acknowledges the drive
+    ata_irqs++;
+    if (atomic_xchg(&ata_armed, 0)) {
+        ata_irq_status = status;
+        sem_post(&ata_done);
     }
+}
 
-    // Now check status
-    uint8_t status = inb(ATA_STATUS);
+static void ata_watchdog_fired(HrTimer* timer) {
+    (void)timer;
+    if (atomic_xchg(&ata_armed, 0)) {
+        ata_irq_status = ATA_SR_BSY;    // Never answered
+        ata_timeouts++;
+        sem_post(&ata_done);
+    }
+}
 
-    if (status & ATA_SR_ERR) return 1;  // Drive reported error
-    if (status & ATA_SR_DF)  return 2;  // Drive fault
-    if (!(status & ATA_SR_DRQ)) return 3; // DRQ not set (no data ready)
+// Blocking needs IRQ mode and a caller that can sleep - otherwise poll
+static bool ata_can_block() {
+    return ata_irq_mode && task_can_block();
+}
 
-    return 0;
+// Expect an interrupt for the step about to start. Arming first means one
+// that comes in straight away is not missed.
+static void ata_arm() {
+    ata_armed = 1;
+    hrtimer_start(&ata_watchdog, ATA_TIMEOUT_NS, ata_watchdog_fired);
+}
+
+// Sleep until it comes; then the same as ata_check on the status the
+// handler read
+static int ata_wait_irq(bool want_drq) {
+    sem_wait(&ata_done);
+    hrtimer_cancel(&ata_watchdog);
+    uint8_t status = ata_irq_status;
+    if (status & ATA_SR_BSY) return ATA_ERR_TIMEOUT;
+    return ata_check(status, want_drq);
+}
+
+// After a timeout the drive may still be busy with the abandoned command,
+// and its late interrupt must not complete whatever is armed next. Reset
+// the channel with interrupts masked at the drive, wait until it is idle,
+// acknowledge what is left and only then let it interrupt again.
+static void ata_reset() {
+    ata_armed = 0;
+    hrtimer_cancel(&ata_watchdog);
+
+    outb(ATA_DEV_CTRL, ATA_CTRL_NIEN | ATA_CTRL_SRST);
+    sleep_us(5);                            // SRST held at least 5us
+    outb(ATA_DEV_CTRL, ATA_CTRL_NIEN);
+    sleep_ms(2);                            // Before BSY means anything
+    ata_wait_busy();
+    inb(ATA_STATUS);
+    outb(ATA_DEV_CTRL, ata_irq_mode ? 0 : ATA_CTRL_NIEN);
+}
+
+// Any attempt that timed out leaves the channel reset for the next one
+static int ata_recover(int err) {
+    if (err == ATA_ERR_TIMEOUT) ata_reset();
+    return err;
 }
 
 // =============================================================================
-// Public API
+// Operations - all run with ata_lock held
 // =============================================================================
 
-int ata_init() {
+// Select the drive and load the sector count and 28-bit LBA for the next
+// read or write command
+static void ata_set_lba(uint32_t lba, uint8_t count) {
+    // Select drive and set top 4 bits of LBA
+    outb(ATA_DRIVE_HEAD, ATA_MASTER_LBA | ((lba >> 24) & 0x0F));
+
+    // Set sector count
+    outb(ATA_SECT_COUNT, count);
+
+    // Set LBA address (low 24 bits)
+    outb(ATA_LBA_LO,  (uint8_t)(lba & 0xFF));
+    outb(ATA_LBA_MID, (uint8_t)((lba >> 8) & 0xFF));
+    outb(ATA_LBA_HI,  (uint8_t)((lba >> 16) & 0xFF));
+}
+
+// Flush the write cache so data actually hits the disk
+static int ata_flush(bool irq) {
+    if (irq) ata_arm();
+    outb(ATA_COMMAND, ATA_CMD_FLUSH);
+
+    // Wait for flush to complete
+    if (irq) return ata_wait_irq(false);
+    ata_delay();
+    if (ata_wait_busy()) return ATA_ERR_TIMEOUT;
+    return ata_check(inb(ATA_STATUS), false);
+}
+
+static int ata_init_locked() {
     // Select master drive
     outb(ATA_DRIVE_HEAD, ATA_MASTER_LBA);
     ata_delay();
@@ -109,7 +254,7 @@ int ata_init() {
     }
 
     // Wait for BSY to clear
-    while (inb(ATA_STATUS) & ATA_SR_BSY) {}
+    if (ata_wait_busy()) return ATA_ERR_TIMEOUT;
 
     // Check if this is actually an ATA drive (not ATAPI/SATA/etc)
     // If LBA_MID or LBA_HI become non-zero, it's not ATA
@@ -118,10 +263,12 @@ int ata_init() {
     }
 
     // Wait for DRQ or ERR
+    uint32_t spins = 0;
     while (1) {
         status = inb(ATA_STATUS);
         if (status & ATA_SR_ERR) return 3;
         if (status & ATA_SR_DRQ) break;
+        if (++spins == ATA_POLL_LIMIT) return ATA_ERR_TIMEOUT;
     }
 
     // Read and discard the 256 words (512 bytes) of identify data
@@ -133,31 +280,28 @@ int ata_init() {
     return 0;  // Drive found and ready
 }
 
-int ata_read_sectors(uint32_t lba, uint8_t count, void* buffer) {
+static int ata_read_sectors_locked(uint32_t lba, uint8_t count, void* buffer) {
     if (count == 0) return 1;
 
     uint16_t* buf = (uint16_t*)buffer;
+    bool irq = ata_can_block();
 
-    // Select drive and set top 4 bits of LBA
-    outb(ATA_DRIVE_HEAD, ATA_MASTER_LBA | ((lba >> 24) & 0x0F));
+    ata_set_lba(lba, count);
 
-    // Set sector count
-    outb(ATA_SECT_COUNT, count);
-
-    // Set LBA address (low 24 bits)
-    outb(ATA_LBA_LO,  (uint8_t)(lba & 0xFF));
-    outb(ATA_LBA_MID, (uint8_t)((lba >> 8) & 0xFF));
-    outb(ATA_LBA_HI,  (uint8_t)((lba >> 16) & 0xFF));
-
-    // Send read command
+    // Send read command. The drive interrupts once per sector, as soon as
+    // it has the data.
+    if (irq) ata_arm();
     outb(ATA_COMMAND, ATA_CMD_READ_PIO);
 
     // Read each sector
     for (int s = 0; s < count; s++) {
         // Wait until data is ready
-        int err = ata_poll();
+        int err = irq ? ata_wait_irq(true) : ata_poll();
         if (err) return err;
 
+        // The next sector's interrupt can come as soon as this one is read
+        if (irq && s + 1 < count) ata_arm();
+
         // Read 256 words (512 bytes = 1 sector)
         // Each inw() reads 2 bytes from the data port
         for (int i = 0; i < 256; i++) {
@@ -171,31 +315,26 @@ int ata_read_sectors(uint32_t lba, uint8_t count, void* buffer) {
     return 0;
 }
 
-int ata_write_sectors(uint32_t lba, const void* buffer, uint8_t count) {
+static int ata_write_sectors_locked(uint32_t lba, const void* buffer, uint8_t count) {
     if (count == 0) return 1;
 
     const uint16_t* buf = (const uint16_t*)buffer;
+    bool irq = ata_can_block();
 
-    // Select drive and set top 4 bits of LBA
-    outb(ATA_DRIVE_HEAD, ATA_MASTER_LBA | ((lba >> 24) & 0x0F));
-
-    // Set sector count
-    outb(ATA_SECT_COUNT, count);
-
-    // Set LBA address
-    outb(ATA_LBA_LO,  (uint8_t)(lba & 0xFF));
-    outb(ATA_LBA_MID, (uint8_t)((lba >> 8) & 0xFF));
-    outb(ATA_LBA_HI,  (uint8_t)((lba >> 16) & 0xFF));
+    ata_set_lba(lba, count);
 
     // Send write command
     outb(ATA_COMMAND, ATA_CMD_WRITE_PIO);
 
-    // Write each sector
+    // Write each sector. The drive asks for the first one without an
+    // interrupt; after that, each sector it takes raises one.
     for (int s = 0; s < count; s++) {
         // Wait until drive is ready for data
-        int err = ata_poll();
+        int err = (irq && s > 0) ? ata_wait_irq(true) : ata_poll();
         if (err) return err;
 
+        if (irq) ata_arm();
+
         // Write 256 words (512 bytes = 1 sector)
         for (int i = 0; i < 256; i++) {
             outw(ATA_DATA, buf[i]);
@@ -205,11 +344,229 @@ int ata_write_sectors(uint32_t lba, const void* buffer, uint8_t count) {
         buf += 256;
     }
 
-    // Flush the write cache so data actually hits the disk
-    outb(ATA_COMMAND, ATA_CMD_FLUSH);
+    // Let the last sector land
+    int err = irq ? ata_wait_irq(false) : ata_wait_busy();
+    if (err) return err;
 
-    // Wait for flush to complete
-    while (inb(ATA_STATUS) & ATA_SR_BSY) {}
+    return ata_flush(irq);
+}
+
+// =============================================================================
+// Bus-master DMA
+//
+// The IDE controller (PIIX style, found on PCI) moves the data itself: it
+// walks a table of physical regions (PRDs) and the drive interrupts once at
+// the end of the whole transfer instead of once per sector. Buffers in the
+// identity-mapped low 4MB are used in place - virtual is physical there -
+// anything else goes through a bounce buffer. Needs IRQ mode; any failure
+// turns DMA off and the transfer is redone with PIO.
+// =============================================================================
 
+#define PCI_PROGIF_BUSMASTER 0x80     // IDE controller with a BAR4
+
+// Bus-master registers, primary channel (offsets from BAR4)
+#define BM_COMMAND      0x00
+#define BM_STATUS       0x02
+#define BM_PRDT         0x04
+
+#define BM_CMD_START    0x01
+#define BM_CMD_READ     0x08    // Device to memory
+#define BM_SR_ERR       0x02    // Write 1 to clear
+#define BM_SR_IRQ       0x04    // Write 1 to clear
+
+#define IDENTITY_MAPPED_END 0x400000
+#define ATA_DMA_MAX_SECTORS 128         // Bounce buffer size: 64KB
+#define ATA_PRD_EOT         0x8000      // Last entry of the table
+
+struct AtaPrd {
+    uint32_t addr;       // Physical
+    uint16_t bytes;      // 0 = 64KB
+    uint16_t flags;
+} __attribute__((packed));
+
+static uint16_t bm_base = 0;            // 0 = no bus-master controller
+static bool     ata_dma_on = false;
+static AtaPrd*  prd_table = 0;          // Own frame, so never across 64KB
+static uint8_t* bounce = 0;
+static uint32_t ata_dma_errors = 0;
+
+// Claims the first IDE controller that can bus master: its BAR4 is the
+// bus-master register block. Runs under ata_lock, from ata_dma_init.
+static bool ata_pci_probe(PciDevice* dev) {
+    if (bm_base || !(dev->prog_if & PCI_PROGIF_BUSMASTER)) return false;
+    if (!dev->bar[4].io || !dev->bar[4].base) return false;
+
+    if (!prd_table) {
+        prd_table = (AtaPrd*)pmm_alloc_contiguous(1, IDENTITY_MAPPED_END);
+        bounce = (uint8_t*)pmm_alloc_contiguous(ATA_DMA_MAX_SECTORS * ATA_SECTOR_SIZE / PAGE_SIZE,
+                                                IDENTITY_MAPPED_END);
+    }
+    if (!prd_table || !bounce) return false;
+
+    pci_enable(dev, PCI_CMD_IO | PCI_CMD_BUSMASTER);
+    bm_base = (uint16_t)dev->bar[4].base;
+    ata_dma_on = true;
+    return true;
+}
+
+static const PciDriver ata_pci_driver = {
+    "ata", PCI_ANY_ID, PCI_ANY_ID, PCI_CLASS_IDE >> 8, PCI_CLASS_IDE & 0xFF, ata_pci_probe
+};
+
+// Binds right away if pci_init has run; DMA just stays off without a match
+static void ata_dma_init() {
+    pci_register_driver(&ata_pci_driver);
+}
+
+static void copy_bytes(void* dst, const void* src, uint32_t len) {
+    uint32_t* d = (uint32_t*)dst;
+    const uint32_t* s = (const uint32_t*)src;
+    for (uint32_t i = 0; i < len / 4; i++) d[i] = s[i];
+}
+
+// One DMA command, at most ATA_DMA_MAX_SECTORS
+static int ata_dma_chunk(uint32_t lba, uint8_t count, uint8_t* buf, bool write) {
+    uint32_t len = count * ATA_SECTOR_SIZE;
+    uint32_t addr = (uint32_t)buf;
+    bool direct = addr + len <= IDENTITY_MAPPED_END && !(addr & 1);
+    if (!direct) {
+        addr = (uint32_t)bounce;
+        if (write) copy_bytes(bounce, buf, len);
+    }
+
+    // One PRD per piece up to the next 64KB boundary, which no region may
+    // cross. A full 64KB piece wraps to 0, as the controller expects.
+    int n = 0;
+    for (uint32_t left = len; left; n++) {
+        uint32_t piece = 0x10000 - (addr & 0xFFFF);
+        if (piece > left) piece = left;
+        prd_table[n].addr  = addr;
+        prd_table[n].bytes = (uint16_t)piece;
+        prd_table[n].flags = 0;
+        addr += piece;
+        left -= piece;
+    }
+    prd_table[n - 1].flags = ATA_PRD_EOT;
+
+    uint8_t dir = write ? 0 : BM_CMD_READ;
+    outb(bm_base + BM_COMMAND, dir);                    // Stopped
+    outb(bm_base + BM_STATUS, BM_SR_ERR | BM_SR_IRQ);
+    outl(bm_base + BM_PRDT, (uint32_t)prd_table);
+
+    ata_set_lba(lba, count);
+    ata_arm();
+    outb(ATA_COMMAND, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    outb(bm_base + BM_COMMAND, dir | BM_CMD_START);
+
+    int err = ata_wait_irq(false);
+    uint8_t bm_status = inb(bm_base + BM_STATUS);
+    outb(bm_base + BM_COMMAND, 0);
+    outb(bm_base + BM_STATUS, BM_SR_ERR | BM_SR_IRQ);
+    if (err) return err;
+    if (bm_status & BM_SR_ERR) return ATA_ERR_DMA;
+
+    if (!direct && !write) copy_bytes(buf, bounce, len);
     return 0;
+}
+
+static int ata_dma_sectors(uint32_t lba, uint8_t count, uint8_t* buf, bool write) {
+    if (count == 0) return 1;
+
+    while (count) {
+        uint8_t n = count > ATA_DMA_MAX_SECTORS ? ATA_DMA_MAX_SECTORS : count;
+        int err = ata_dma_chunk(lba, n, buf, write);
+        if (err) {
+            ata_dma_errors++;
+            ata_dma_on = false;
+            return err;
+        }
+        lba += n;
+        buf += n * ATA_SECTOR_SIZE;
+        count -= n;
+    }
+    return write ? ata_flush(true) : 0;
+}
+
+// DMA only when a transfer can sleep until the interrupt
+static bool ata_dma_usable() {
+    return ata_dma_on && ata_can_block();
+}
+
+// =============================================================================
+// Public API
+// =============================================================================
+
+int ata_init() {
+    mutex_lock(&ata_lock);
+    outb(ATA_DEV_CTRL, ATA_CTRL_NIEN);      // IDENTIFY is always polled
+    int result = ata_init_locked();
+    if (ata_irq_mode) outb(ATA_DEV_CTRL, 0);
+    mutex_unlock(&ata_lock);
+    return result;
+}
+
+void ata_enable_irq() {
+    mutex_lock(&ata_lock);
+    // Through the common stub: the fast ones skip the priority levels, and
+    // IRQ14 is one of the lowest - it must wait behind the PIT and keyboard
+    register_interrupt_handler(46, ata_irq_handler);
+    inb(ATA_STATUS);                        // Drop anything left pending
+    irq_set_masked(14, false);
+    outb(ATA_DEV_CTRL, 0);                  // nIEN off: the drive raises IRQ14
+    ata_irq_mode = true;
+    ata_dma_init();
+    mutex_unlock(&ata_lock);
+}
+
+bool ata_dma_available() {
+    return bm_base != 0;
+}
+
+bool ata_dma_enabled() {
+    return ata_dma_on;
+}
+
+void ata_set_dma(bool on) {
+    mutex_lock(&ata_lock);
+    ata_dma_on = on && bm_base;
+    mutex_unlock(&ata_lock);
+}
+
+uint32_t ata_get_dma_errors() {
+    return ata_dma_errors;
+}
+
+bool ata_irq_enabled() {
+    return ata_irq_mode;
+}
+
+uint32_t ata_get_irq_count() {
+    return ata_irqs;
+}
+
+uint32_t ata_get_timeouts() {
+    return ata_timeouts;
+}
+
+// A failed DMA transfer is redone with PIO (DMA is off by then)
+int ata_read_sectors(uint32_t lba, uint8_t count, void* buffer) {
+    mutex_lock(&ata_lock);
+    int result = 1;
+    if (ata_dma_usable()) {
+        result = ata_recover(ata_dma_sectors(lba, count, (uint8_t*)buffer, false));
+    }
+    if (result) result = ata_recover(ata_read_sectors_locked(lba, count, buffer));
+    mutex_unlock(&ata_lock);
+    return result;
+}
+
+int ata_write_sectors(uint32_t lba, const void* buffer, uint8_t count) {
+    mutex_lock(&ata_lock);
+    int result = 1;
+    if (ata_dma_usable()) {
+        result = ata_recover(ata_dma_sectors(lba, count, (uint8_t*)buffer, true));
+    }
+    if (result) result = ata_recover(ata_write_sectors_locked(lba, buffer, count));
+    mutex_unlock(&ata_lock);
+    return result;
 }
\ No newline at end of file
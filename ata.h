@@ -18,4 +18,22 @@ int ata_read_sectors(uint32_t lba, uint8_t count, void* buffer);
 // Returns 0 on success, non-zero on error
 int ata_write_sectors(uint32_t lba, const void* buffer, uint8_t count);
 
+// Switch from polling to IRQ14: from then on callers sleep while the drive
+// works. Needs interrupts on and the scheduler running; calls made with
+// interrupts off still poll.
+void ata_enable_irq();
+bool ata_irq_enabled();
+
+// Bus-master DMA, set up by ata_enable_irq when the IDE controller on PCI
+// supports it. Used for every transfer that can sleep; a failed one turns
+// it off and is redone with PIO. ata_set_dma switches between the two.
+bool ata_dma_available();
+bool ata_dma_enabled();
+void ata_set_dma(bool on);
+
+// Stats
+uint32_t ata_get_irq_count();    // IRQ14s taken
+uint32_t ata_get_timeouts();     // Steps the drive never answered
+uint32_t ata_get_dma_errors();   // DMA transfers that fell back to PIO
+
 #endif
\ No newline at end of file
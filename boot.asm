@@ -1,5 +1,6 @@
 [org 0x7c00]                        
 KERNEL_LOCATION equ 0x10000
+KERNEL_SECTORS  equ 384     ; 192KB: 0x10000-0x3FFFF
 
 ; ============================================================
 ; E820 memory map stored at 0x8000:
@@ -21,6 +22,7 @@ mov sp, bp
 ; Step 1: Load kernel from disk FIRST (before E820)
 ; Load to physical address 0x10000 using ES:BX = 0x1000:0x0000
 ; This avoids overwriting the bootloader at 0x7C00
+; ES is bumped by 64KB every time BX wraps, so the kernel can exceed 64KB
 ; Floppy geometry: 18 sectors/track, 2 heads
 ; ============================================================
 load_kernel:
@@ -30,7 +32,7 @@ load_kernel:
     mov cl, 2               ; starting sector (1-indexed, sector 2)
     mov ch, 0               ; cylinder 0
     mov dh, 0               ; head 0
-    mov si, 80              ; total sectors to read
+    mov si, KERNEL_SECTORS  ; total sectors to read
 
 .read_loop:
     cmp si, 0
@@ -43,6 +45,11 @@ load_kernel:
     jc .read_loop           ; retry on error
 
     add bx, 512             ; advance buffer by one sector
+    jnz .same_segment
+    mov ax, es              ; BX wrapped: move ES up 64KB
+    add ax, 0x1000
+    mov es, ax
+.same_segment:
     dec si
 
     ; Advance CHS to next sector
@@ -0,0 +1,129 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+// CPUID leaf 1 EDX feature bits
+#define CPUID_EDX_FPU    (1 << 0)
+#define CPUID_EDX_TSC    (1 << 4)
+#define CPUID_EDX_MSR    (1 << 5)
+#define CPUID_EDX_APIC   (1 << 9)
+#define CPUID_EDX_SEP    (1 << 11)   // SYSENTER/SYSEXIT
+#define CPUID_EDX_FXSR   (1 << 24)
+#define CPUID_EDX_SSE    (1 << 25)
+#define CPUID_EDX_SSE2   (1 << 26)
+
+// CPUID leaf 1 ECX feature bits
+#define CPUID_ECX_TSC_DEADLINE (1 << 24)
+
+// Control register bits
+#define CR0_MP          (1 << 1)    // Monitor coprocessor (WAIT honours TS)
+#define CR0_EM          (1 << 2)    // Emulate FPU (must be clear for SSE)
+#define CR0_TS          (1 << 3)    // Task switched - next FPU op raises #NM
+#define CR0_NE          (1 << 5)    // Native FPU error reporting
+#define CR4_OSFXSR      (1 << 9)    // OS supports FXSAVE/FXRSTOR + SSE
+#define CR4_OSXMMEXCPT  (1 << 10)   // OS handles SIMD FP exceptions (#XM)
+
+#define EFLAGS_IF       0x200
+
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile("cpuid"
+                     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                     : "a"(leaf), "c"(0));
+}
+
+static inline uint32_t read_cr0() {
+    uint32_t val;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr0(uint32_t val) {
+    __asm__ volatile("mov %0, %%cr0" : : "r"(val) : "memory");
+}
+
+static inline uint32_t read_cr3() {
+    uint32_t val;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(val));
+    return val;
+}
+
+static inline uint32_t read_cr4() {
+    uint32_t val;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr4(uint32_t val) {
+    __asm__ volatile("mov %0, %%cr4" : : "r"(val) : "memory");
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+// Read the time-stamp counter
+static inline uint64_t rdtsc() {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// 64-by-32 unsigned division without libgcc's __udivdi3. Two divl steps:
+// the high word first, then the remainder with the low word.
+static inline uint64_t div64_32(uint64_t n, uint32_t d, uint32_t* rem) {
+    uint32_t hi = (uint32_t)(n >> 32);
+    uint32_t lo = (uint32_t)n;
+    uint32_t q_hi = hi / d;
+    uint32_t r    = hi % d;
+    uint32_t q_lo;
+    __asm__("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(r), "rm"(d));
+    if (rem) *rem = r;
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+// (a * mul) >> shift (1 <= shift <= 32) without a 64x64 multiply: the two
+// halves of 'a' are scaled separately so nothing overflows for sane inputs
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift) {
+    uint64_t lo = (uint64_t)(uint32_t)a * mul;
+    uint64_t hi = (uint64_t)(uint32_t)(a >> 32) * mul;
+    return (lo >> shift) + (hi << (32 - shift));
+}
+
+// Atomically store val into *ptr and return the old value
+static inline uint32_t atomic_xchg(volatile uint32_t* ptr, uint32_t val) {
+    __asm__ volatile("xchg %0, %1" : "+r"(val), "+m"(*ptr) : : "memory");
+    return val;
+}
+
+// If *ptr == expected, store desired. Returns the value *ptr held before.
+static inline uint32_t atomic_cmpxchg(volatile uint32_t* ptr, uint32_t expected, uint32_t desired) {
+    uint32_t prev;
+    __asm__ volatile("lock cmpxchg %2, %1"
+                     : "=a"(prev), "+m"(*ptr)
+                     : "r"(desired), "0"(expected)
+                     : "memory");
+    return prev;
+}
+
+// Disable interrupts, returning the previous EFLAGS for irq_restore()
+static inline uint32_t irq_save() {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Re-enable interrupts only if they were on when irq_save() was called
+static inline void irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+#endif
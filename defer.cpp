@@ -0,0 +1,158 @@
+#include "defer.h"
+#include "cpu.h"
+#include "sync.h"
+#include "task.h"
+
+// =============================================================================
+// Deferred work queues
+//
+// Each priority has a lock-free LIFO (Treiber stack): producers push with
+// cmpxchg from any context, the single drainer at a time grabs the whole
+// stack with one xchg and reverses it back into FIFO order. After every batch
+// the drainer restarts from DEFER_HIGH, so urgent work queued while normal
+// work runs goes next.
+//
+// The budget counts single items: a batch cut short keeps its tail in
+// 'carry', which only the drainer touches and which runs before anything
+// queued since.
+// =============================================================================
+
+// Max items run on the IRQ exit path before the rest goes to the worker
+#define DEFER_IRQ_BUDGET 16
+
+// Max items the worker runs before it yields to other tasks
+#define DEFER_WORKER_BUDGET 64
+
+static volatile uint32_t queue_head[DEFER_PRIORITIES];   // DeferredWork*
+static DeferredWork* volatile carry[DEFER_PRIORITIES];   // Taken, not run yet
+static volatile uint32_t draining = 0;   // Someone is already running work
+static uint32_t run_count[DEFER_PRIORITIES];
+static uint32_t worker_runs = 0;
+
+static Semaphore worker_kick = SEMAPHORE_INIT(0);
+static bool worker_started = false;
+
+static DeferredWork* queue_take_all(int prio) {
+    DeferredWork* list = (DeferredWork*)atomic_xchg(&queue_head[prio], 0);
+
+    // Reverse LIFO -> FIFO
+    DeferredWork* fifo = 0;
+    while (list) {
+        DeferredWork* next = list->next;
+        list->next = fifo;
+        fifo = list;
+        list = next;
+    }
+    return fifo;
+}
+
+// Drainer only
+static DeferredWork* queue_take(int prio) {
+    DeferredWork* w = carry[prio];
+    if (w) {
+        carry[prio] = 0;
+        return w;
+    }
+    return queue_take_all(prio);
+}
+
+static bool defer_any_pending() {
+    for (int p = 0; p < DEFER_PRIORITIES; p++) {
+        if (queue_head[p] || carry[p]) return true;
+    }
+    return false;
+}
+
+// Run queued work until empty or 'budget' items have run.
+// Returns true if work is still pending.
+static bool defer_drain(int budget) {
+    int done = 0;
+    int prio = 0;
+    while (prio < DEFER_PRIORITIES && done < budget) {
+        DeferredWork* w = queue_take(prio);
+        if (!w) {
+            prio++;
+            continue;
+        }
+        while (w && done < budget) {
+            DeferredWork* next = w->next;
+            w->pending = 0;   // Cleared first so fn may re-queue itself
+            w->fn(w->arg);
+            run_count[prio]++;
+            done++;
+            w = next;
+        }
+        carry[prio] = w;      // Out of budget: the rest stays in order
+        prio = 0;
+    }
+    return defer_any_pending();
+}
+
+// =============================================================================
+// Worker task
+// =============================================================================
+
+// Drains in bounded chunks with interrupts on, yielding in between so a
+// flood of work cannot keep other tasks off the CPU
+static void defer_worker() {
+    while (1) {
+        sem_wait(&worker_kick);
+        bool more = true;
+        while (more) {
+            if (atomic_xchg(&draining, 1) != 0) break;  // IRQ exit is on it
+            more = defer_drain(DEFER_WORKER_BUDGET);
+            worker_runs++;
+            draining = 0;
+            if (more) task_yield();
+        }
+    }
+}
+
+// =============================================================================
+// Public API
+// =============================================================================
+
+void defer_init() {
+    if (task_create(defer_worker, "kdeferd") >= 0) {
+        worker_started = true;
+    }
+}
+
+bool defer_schedule(DeferredWork* work, DeferPriority prio) {
+    if (atomic_xchg(&work->pending, 1) != 0) {
+        return false;  // Already queued
+    }
+
+    uint32_t old;
+    do {
+        old = queue_head[prio];
+        work->next = (DeferredWork*)old;
+    } while (atomic_cmpxchg(&queue_head[prio], old, (uint32_t)work) != old);
+
+    return true;
+}
+
+void defer_irq_exit() {
+    if (!defer_any_pending()) return;
+
+    // Nested IRQs arriving while we drain just leave their work queued;
+    // the outer drain (or the worker) picks it up
+    if (atomic_xchg(&draining, 1) != 0) return;
+
+    __asm__ volatile("sti");
+    bool leftover = defer_drain(DEFER_IRQ_BUDGET);
+    __asm__ volatile("cli");
+    draining = 0;
+
+    if (leftover && worker_started) {
+        sem_post(&worker_kick);
+    }
+}
+
+uint32_t defer_get_run_count(DeferPriority prio) {
+    return run_count[prio];
+}
+
+uint32_t defer_get_worker_runs() {
+    return worker_runs;
+}
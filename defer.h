@@ -0,0 +1,48 @@
+#ifndef DEFER_H
+#define DEFER_H
+
+#include <stdint.h>
+
+// =============================================================================
+// Deferred work (bottom halves)
+//
+// IRQ handlers should do the bare minimum (ack the device, grab the data) and
+// push the rest here. Queued work runs right after the EOI with interrupts
+// enabled, or - if too much piles up - in the "kdeferd" worker task.
+// =============================================================================
+
+enum DeferPriority {
+    DEFER_HIGH   = 0,
+    DEFER_NORMAL = 1,
+    DEFER_LOW    = 2,
+    DEFER_PRIORITIES
+};
+
+// One work item. Like a tasklet it can be queued at most once at a time;
+// re-queueing while still pending is a no-op. Its callback may re-queue it.
+struct DeferredWork {
+    void              (*fn)(void* arg);
+    void*             arg;
+    volatile uint32_t pending;
+    DeferredWork*     next;
+};
+
+#define DEFERRED_WORK_INIT(fn, arg) { (fn), (arg), 0, 0 }
+
+// Start the worker task (needs the scheduler)
+void defer_init();
+
+// Queue work at the given priority. Lock-free and safe from any context.
+// Returns false if the item was already pending.
+bool defer_schedule(DeferredWork* work, DeferPriority prio);
+
+// Called from the IRQ exit path after EOI (interrupts disabled on entry and
+// on return). Runs a bounded amount of pending work with interrupts enabled
+// and hands any leftovers to the worker task.
+void defer_irq_exit();
+
+// Stats
+uint32_t defer_get_run_count(DeferPriority prio);
+uint32_t defer_get_worker_runs();
+
+#endif
@@ -1,6 +1,7 @@
 #include "fat16.h"
 #include "ata.h"
 #include "vga.h"
+#include "sync.h"
 
 // =============================================================================
 // FAT16 Filesystem Driver
@@ -47,6 +48,11 @@ static uint8_t sector_buf[512];
 // Second buffer for write operations (avoids clobbering sector_buf mid-operation)
 static uint8_t write_buf[512];
 
+// Both buffers (and the static entry fat16_find_in_root hands out) are shared
+// by every caller, so each public entry point holds this for its whole run.
+// A mutex rather than a spinlock: disk I/O is slow, let other tasks run.
+static Mutex fat_lock = MUTEX_INIT;
+
 // =============================================================================
 // Internal helpers
 // =============================================================================
@@ -228,10 +234,10 @@ static void fat16_free_chain(uint16_t cluster) {
 }
 
 // =============================================================================
-// Public API
+// Operations - all run with fat_lock held
 // =============================================================================
 
-int fat16_init() {
+static int fat16_init_locked() {
     // Read the boot sector / BPB
     if (ata_read_sectors(0, 1, sector_buf) != 0) {
         return 1;
@@ -266,7 +272,7 @@ int fat16_init() {
     return 0;
 }
 
-void fat16_list_root() {
+static void fat16_list_root_locked() {
     if (!initialized) {
         vga_print("FAT16 not initialized\n");
         return;
@@ -353,7 +359,7 @@ done:
     vga_print(" bytes total\n");
 }
 
-int fat16_read_file(const char* filename, void* buffer, uint32_t max_size) {
+static int fat16_read_file_locked(const char* filename, void* buffer, uint32_t max_size) {
     if (!initialized) return -1;
     
     // Find the file
@@ -401,7 +407,7 @@ int fat16_read_file(const char* filename, void* buffer, uint32_t max_size) {
     return (int)bytes_read;
 }
 
-int fat16_file_size(const char* filename) {
+static int fat16_file_size_locked(const char* filename) {
     if (!initialized) return -1;
     
     fat16_dir_entry* entry = fat16_find_in_root(filename);
@@ -410,11 +416,13 @@ int fat16_file_size(const char* filename) {
     return (int)entry->file_size;
 }
 
-int fat16_create_file(const char* filename, const void* data, uint32_t size) {
+static int fat16_delete_locked(const char* filename);
+
+static int fat16_create_file_locked(const char* filename, const void* data, uint32_t size) {
     if (!initialized) return -1;
     
     // Delete existing file first if it exists (overwrite behavior)
-    fat16_delete(filename);
+    fat16_delete_locked(filename);
     
     // Find a free root directory entry
     int dir_sector = -1;
@@ -508,7 +516,7 @@ found_slot:
     return 0;
 }
 
-int fat16_delete(const char* filename) {
+static int fat16_delete_locked(const char* filename) {
     if (!initialized) return -1;
     
     for (uint32_t sec = 0; sec < root_dir_sectors; sec++) {
@@ -552,7 +560,7 @@ int fat16_delete(const char* filename) {
     return -1;  // Not found
 }
 
-int fat16_mkdir(const char* dirname) {
+static int fat16_mkdir_locked(const char* dirname) {
     if (!initialized) return -1;
     
     // Check if it already exists
@@ -637,4 +645,56 @@ int fat16_mkdir(const char* dirname) {
     // No free directory entry found - clean up the allocated cluster
     fat16_free_chain((uint16_t)cluster);
     return -1;
+}
+
+// =============================================================================
+// Public API
+// =============================================================================
+
+int fat16_init() {
+    mutex_lock(&fat_lock);
+    int result = fat16_init_locked();
+    mutex_unlock(&fat_lock);
+    return result;
+}
+
+void fat16_list_root() {
+    mutex_lock(&fat_lock);
+    fat16_list_root_locked();
+    mutex_unlock(&fat_lock);
+}
+
+int fat16_read_file(const char* filename, void* buffer, uint32_t max_size) {
+    mutex_lock(&fat_lock);
+    int result = fat16_read_file_locked(filename, buffer, max_size);
+    mutex_unlock(&fat_lock);
+    return result;
+}
+
+int fat16_file_size(const char* filename) {
+    mutex_lock(&fat_lock);
+    int result = fat16_file_size_locked(filename);
+    mutex_unlock(&fat_lock);
+    return result;
+}
+
+int fat16_create_file(const char* filename, const void* data, uint32_t size) {
+    mutex_lock(&fat_lock);
+    int result = fat16_create_file_locked(filename, data, size);
+    mutex_unlock(&fat_lock);
+    return result;
+}
+
+int fat16_delete(const char* filename) {
+    mutex_lock(&fat_lock);
+    int result = fat16_delete_locked(filename);
+    mutex_unlock(&fat_lock);
+    return result;
+}
+
+int fat16_mkdir(const char* dirname) {
+    mutex_lock(&fat_lock);
+    int result = fat16_mkdir_locked(dirname);
+    mutex_unlock(&fat_lock);
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,273 @@
+#include "fiber.h"
+#include "task.h"
+#include "kheap.h"
+#include "kstack.h"
+
+// =============================================================================
+// Ready list (host guard held)
+// =============================================================================
+
+static void ready_push(FiberHost* h, Fiber* f) {
+    f->next = 0;
+    if (h->ready_tail) h->ready_tail->next = f;
+    else               h->ready_head = f;
+    h->ready_tail = f;
+}
+
+static Fiber* ready_pop(FiberHost* h) {
+    Fiber* f = h->ready_head;
+    if (f) {
+        h->ready_head = f->next;
+        if (!h->ready_head) h->ready_tail = 0;
+        f->next = 0;
+    }
+    return f;
+}
+
+// Queue 'f' and wake the host loop if it is idle. Guard held; returns
+// whether the caller must post the host's semaphore after dropping it.
+static bool make_ready_locked(FiberHost* h, Fiber* f) {
+    f->state = FIBER_READY;
+    ready_push(h, f);
+    bool post = h->idle;
+    h->idle = false;
+    return post;
+}
+
+static void fiber_wake(Fiber* f) {
+    FiberHost* h = f->host;
+    spin_lock(&h->guard);
+    bool post = false;
+    if (f->state == FIBER_WAITING) post = make_ready_locked(h, f);
+    spin_unlock(&h->guard);
+    if (post) sem_post(&h->wakeup);
+}
+
+// =============================================================================
+// Switching
+// =============================================================================
+
+static FiberHost* current_host() {
+    Task* t = task_get_current();
+    return t ? t->fiber_host : 0;
+}
+
+// Leave 'cur' (already queued, waiting or done) for the next ready fiber,
+// straight from fiber to fiber, or for the host loop if there is none.
+// Returns when something switches back to 'cur'.
+static void switch_out(FiberHost* h, Fiber* cur) {
+    spin_lock(&h->guard);
+    Fiber* next = ready_pop(h);
+    spin_unlock(&h->guard);
+
+    // Woken again before we got away (a short timer, an IRQ signal):
+    // just keep running
+    if (next == cur) {
+        cur->state = FIBER_RUNNING;
+        return;
+    }
+
+    h->switches++;
+    if (next) {
+        next->state = FIBER_RUNNING;
+        h->current = next;
+        switch_context(&cur->esp, next->esp);
+    } else {
+        h->current = 0;
+        switch_context(&cur->esp, h->esp);
+    }
+}
+
+// First code a fiber runs (see fiber_create for the frame)
+static void fiber_start(Fiber* f) {
+    f->fn(f->arg);
+    fiber_exit();
+}
+
+// =============================================================================
+// Public API
+// =============================================================================
+
+void fiber_host_init(FiberHost* host) {
+    spin_init(&host->guard);
+    host->ready_head = host->ready_tail = 0;
+    host->dead     = 0;
+    host->current  = 0;
+    host->esp      = 0;
+    sem_init(&host->wakeup, 0);
+    host->idle     = false;
+    host->live     = 0;
+    host->next_id  = 1;
+    host->switches = 0;
+}
+
+Fiber* fiber_create(FiberHost* host, void (*fn)(void* arg), void* arg, uint32_t stack_size) {
+    if (stack_size == 0) stack_size = FIBER_STACK_SIZE;
+    stack_size = PAGE_ALIGN_UP(stack_size);
+
+    Fiber* f = (Fiber*)kmalloc(sizeof(Fiber));
+    if (!f) return 0;
+    f->stack = (uint8_t*)kstack_alloc(stack_size);
+    if (!f->stack) {
+        kfree(f);
+        return 0;
+    }
+
+    // Same initial frame as a new task: switch_context pops four callee-
+    // saved registers and "returns" into fiber_start with 'f' as argument
+    uint32_t* sp = (uint32_t*)(f->stack + stack_size);
+    *(--sp) = (uint32_t)f;              // fiber_start's argument
+    *(--sp) = 0;                        // Its return slot (never used)
+    *(--sp) = (uint32_t)fiber_start;
+    *(--sp) = 0;                        // ebp
+    *(--sp) = 0;                        // ebx
+    *(--sp) = 0;                        // esi
+    *(--sp) = 0;                        // edi
+
+    HrTimer timer = HRTIMER_INIT;
+    f->esp        = (uint32_t)sp;
+    f->stack_size = stack_size;
+    f->fn         = fn;
+    f->arg        = arg;
+    f->host       = host;
+    f->next       = 0;
+    f->timer      = timer;
+    f->timer.arg  = f;
+
+    spin_lock(&host->guard);
+    f->id = host->next_id++;
+    host->live++;
+    bool post = make_ready_locked(host, f);
+    spin_unlock(&host->guard);
+    if (post) sem_post(&host->wakeup);
+    return f;
+}
+
+void fiber_host_run(FiberHost* host) {
+    Task* self = task_get_current();
+    self->fiber_host = host;
+
+    for (;;) {
+        spin_lock(&host->guard);
+        Fiber* dead = host->dead;
+        host->dead = 0;
+        Fiber* f = ready_pop(host);
+        bool done = !f && host->live == 0;
+        if (!f && !done) host->idle = true;
+        spin_unlock(&host->guard);
+
+        // Whoever finished has switched off its stack by now
+        while (dead) {
+            Fiber* next = dead->next;
+            kstack_free((uint32_t)dead->stack, dead->stack_size);
+            kfree(dead);
+            dead = next;
+        }
+
+        if (done) break;
+        if (!f) {
+            sem_wait(&host->wakeup);
+            continue;
+        }
+
+        f->state = FIBER_RUNNING;
+        host->current = f;
+        host->switches++;
+        switch_context(&host->esp, f->esp);
+    }
+
+    self->fiber_host = 0;
+}
+
+Fiber* fiber_current() {
+    FiberHost* h = current_host();
+    return h ? h->current : 0;
+}
+
+void fiber_yield() {
+    FiberHost* h = current_host();
+    if (!h || !h->current) return;
+    Fiber* cur = h->current;
+
+    spin_lock(&h->guard);
+    if (!h->ready_head) {
+        spin_unlock(&h->guard);
+        return;
+    }
+    cur->state = FIBER_READY;
+    ready_push(h, cur);
+    spin_unlock(&h->guard);
+
+    switch_out(h, cur);
+}
+
+static void fiber_timer_fired(HrTimer* timer) {
+    fiber_wake((Fiber*)timer->arg);
+}
+
+void fiber_sleep_ns(uint64_t ns) {
+    FiberHost* h = current_host();
+    if (!h || !h->current) return;
+    Fiber* cur = h->current;
+
+    // Waiting before the timer is armed - it may fire before we are gone
+    spin_lock(&h->guard);
+    cur->state = FIBER_WAITING;
+    spin_unlock(&h->guard);
+    hrtimer_start(&cur->timer, ns, fiber_timer_fired);
+
+    switch_out(h, cur);
+}
+
+void fiber_exit() {
+    FiberHost* h = current_host();
+    if (!h || !h->current) return;
+    Fiber* cur = h->current;
+
+    spin_lock(&h->guard);
+    cur->state = FIBER_DONE;
+    cur->next = h->dead;
+    h->dead = cur;
+    h->live--;
+    spin_unlock(&h->guard);
+
+    switch_out(h, cur);
+    for (;;) __asm__ volatile("hlt");  // Never switched back to
+}
+
+void fiber_event_init(FiberEvent* ev) {
+    spin_init(&ev->guard);
+    ev->signaled = false;
+    ev->waiter   = 0;
+}
+
+void fiber_event_wait(FiberEvent* ev) {
+    FiberHost* h = current_host();
+    if (!h || !h->current) return;
+    Fiber* cur = h->current;
+
+    spin_lock(&ev->guard);
+    if (ev->signaled) {
+        ev->signaled = false;
+        spin_unlock(&ev->guard);
+        return;
+    }
+    // Mark ourselves waiting before the signaller can see us
+    spin_lock(&h->guard);
+    cur->state = FIBER_WAITING;
+    spin_unlock(&h->guard);
+    ev->waiter = cur;
+    spin_unlock(&ev->guard);
+
+    switch_out(h, cur);
+}
+
+void fiber_event_signal(FiberEvent* ev) {
+    spin_lock(&ev->guard);
+    Fiber* w = ev->waiter;
+    ev->waiter = 0;
+    if (!w) ev->signaled = true;
+    spin_unlock(&ev->guard);
+
+    if (w) fiber_wake(w);
+}
@@ -0,0 +1,97 @@
+#ifndef FIBER_H
+#define FIBER_H
+
+#include <stdint.h>
+#include "sync.h"
+#include "hrtimer.h"
+
+// =============================================================================
+// Fibers
+//
+// Cooperative threads multiplexed over one kernel task (the host). A fiber
+// is just a stack and a saved ESP - no task slot, no scheduler lock, no run
+// queue - and switching between two fibers of the same host is one
+// switch_context call. That makes thousands of small concurrent state
+// machines cheap.
+//
+// A fiber only gives up the CPU in the fiber_* calls below. It waits for a
+// timer with fiber_sleep_ns or for any other completion with a FiberEvent,
+// which IRQ handlers and other tasks can signal. Blocking the host task
+// (sem_wait, task_sleep, ...) from a fiber stalls all of its fibers.
+//
+// Interrupts, bottom halves and the host's preemption all run on the stack
+// of whichever fiber was current, so fiber stacks come from the guard-paged
+// stack region (kstack.h) like task stacks: running off the bottom faults
+// instead of trampling the heap. x87/SSE registers are per task, not per
+// fiber: don't keep FPU values live across a fiber switch.
+// =============================================================================
+
+#define FIBER_STACK_SIZE 4096     // One page, the smallest guard-paged stack
+
+enum FiberState {
+    FIBER_READY   = 0,
+    FIBER_RUNNING = 1,
+    FIBER_WAITING = 2,   // Sleeping or waiting on a FiberEvent
+    FIBER_DONE    = 3
+};
+
+struct FiberHost;
+
+struct Fiber {
+    uint32_t    esp;          // Saved stack pointer
+    uint8_t*    stack;        // kstack_alloc'd, above a guard page
+    uint32_t    stack_size;   // Whole pages
+    uint32_t    id;
+    void      (*fn)(void* arg);
+    void*       arg;
+    volatile FiberState state;
+    FiberHost*  host;
+    Fiber*      next;         // Ready or dead list
+    HrTimer     timer;        // fiber_sleep_ns
+};
+
+struct FiberHost {
+    Spinlock    guard;        // Ready list and fiber states - wakes come from anywhere
+    Fiber*      ready_head;
+    Fiber*      ready_tail;
+    Fiber*      dead;         // Finished, freed by the host loop
+    Fiber*      current;
+    uint32_t    esp;          // Host loop, while a fiber runs
+    Semaphore   wakeup;       // Posted when the host loop is idle and a fiber wakes
+    bool        idle;
+    uint32_t    live;         // Created and not yet finished
+    uint32_t    next_id;
+    uint32_t    switches;
+};
+
+struct FiberEvent {
+    Spinlock    guard;
+    bool        signaled;
+    Fiber*      waiter;
+};
+
+#define FIBER_EVENT_INIT { SPINLOCK_INIT, false, 0 }
+
+void   fiber_host_init(FiberHost* host);
+
+// Add a fiber that runs fn(arg) on a stack of 'stack_size' bytes, rounded
+// up to whole pages (0 = FIBER_STACK_SIZE). Any context but an IRQ handler. Returns 0 if out
+// of memory.
+Fiber* fiber_create(FiberHost* host, void (*fn)(void* arg), void* arg, uint32_t stack_size);
+
+// Turn the calling task into the host: run fibers until every one of them
+// has finished, blocking the task whenever all of them are waiting
+void   fiber_host_run(FiberHost* host);
+
+// From inside a fiber
+Fiber* fiber_current();                // 0 outside a fiber
+void   fiber_yield();                  // Let other ready fibers run
+void   fiber_sleep_ns(uint64_t ns);
+void   fiber_exit();                   // Also what returning from fn does
+
+// One-shot completion: a signal before the wait is not lost. One waiter.
+void   fiber_event_init(FiberEvent* ev);
+void   fiber_event_wait(FiberEvent* ev);     // Fiber context
+void   fiber_event_signal(FiberEvent* ev);   // Any context, IRQ handlers included
+
+#endif
@@ -0,0 +1,178 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "isr.h"
+#include "task.h"
+#include "kheap.h"
+#include "percpu.h"
+
+// =============================================================================
+// Lazy FPU/SSE context switching
+//
+// switch_context only swaps the callee-saved integer registers. Saving the
+// 512-byte x87/SSE image on every switch would be a waste when most tasks
+// never touch the FPU, so instead:
+//   - the scheduler sets CR0.TS whenever it switches to a task that does not
+//     currently own the FPU registers
+//   - the first FPU/SSE instruction that task executes raises #NM (ISR 7)
+//   - the #NM handler clears TS, FXSAVEs the previous owner's registers,
+//     FXRSTORs (or initialises) the current task's, and makes it the owner
+// A task that never uses the FPU never pays for it.
+//
+// With more than one CPU a task may resume on a different CPU than the one
+// holding its registers, which cannot be reached from here. So once SMP is
+// up, a task that used the FPU during its slice is saved eagerly when it is
+// switched out; restores stay lazy, and are skipped entirely when the task
+// comes back to the CPU that still holds its registers untouched.
+// =============================================================================
+
+#define MXCSR_DEFAULT 0x1F80   // All SIMD exceptions masked, round-to-nearest
+
+static bool has_fxsr = false;
+static bool has_sse = false;
+static bool eager_save = false;   // Set once tasks can migrate between CPUs
+
+static inline void fpu_save(uint8_t* area) {
+    if (has_fxsr) {
+        __asm__ volatile("fxsave (%0)" : : "r"(area) : "memory");
+    } else {
+        __asm__ volatile("fnsave (%0)" : : "r"(area) : "memory");
+    }
+}
+
+static inline void fpu_restore(uint8_t* area) {
+    if (has_fxsr) {
+        __asm__ volatile("fxrstor (%0)" : : "r"(area) : "memory");
+    } else {
+        __asm__ volatile("frstor (%0)" : : "r"(area) : "memory");
+    }
+}
+
+// Give a task its own 16-byte aligned save area on first FPU use
+static bool fpu_alloc_state(Task* t) {
+    uint8_t* raw = (uint8_t*)kmalloc(FPU_STATE_SIZE + 15);
+    if (!raw) return false;
+    t->fpu_alloc = raw;
+    t->fpu_state = (uint8_t*)(((uint32_t)raw + 15) & ~15u);
+    return true;
+}
+
+// =============================================================================
+// Device Not Available handler (ISR 7)
+// =============================================================================
+
+static void fpu_nm_handler(registers_t* regs) {
+    (void)regs;
+    __asm__ volatile("clts");
+
+    PerCpu* cpu = this_cpu();
+    Task* cur = cpu->current;
+    if (!cur) return;
+    if (cur == cpu->fpu_owner && cur->fpu_cpu == (int)cpu->id) return;
+
+    // With eager saving the previous owner's image is already in memory
+    if (cpu->fpu_owner && !eager_save) {
+        fpu_save(cpu->fpu_owner->fpu_state);
+    }
+
+    if (cur->fpu_state) {
+        fpu_restore(cur->fpu_state);
+    } else if (fpu_alloc_state(cur)) {
+        // First FPU use: start from a clean, known state
+        __asm__ volatile("fninit");
+        if (has_sse) {
+            uint32_t mxcsr = MXCSR_DEFAULT;
+            __asm__ volatile("ldmxcsr %0" : : "m"(mxcsr));
+        }
+    } else {
+        // No memory for a save area - nothing sane left to do with this task
+        cpu->fpu_owner = 0;
+        task_exit();
+        return;
+    }
+
+    cpu->fpu_owner = cur;
+    cur->fpu_cpu = cpu->id;
+}
+
+// =============================================================================
+// Public API
+// =============================================================================
+
+void fpu_init() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    has_fxsr = (edx & CPUID_EDX_FXSR) != 0;
+    has_sse  = has_fxsr && (edx & CPUID_EDX_SSE) != 0;
+
+    fpu_init_cpu();
+    register_interrupt_handler(7, fpu_nm_handler);
+}
+
+void fpu_init_cpu() {
+    // Native FPU, WAIT/FWAIT honours TS, no emulation
+    uint32_t cr0 = read_cr0();
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+
+    if (has_fxsr) {
+        uint32_t cr4 = read_cr4() | CR4_OSFXSR;
+        if (has_sse) cr4 |= CR4_OSXMMEXCPT;
+        write_cr4(cr4);
+    }
+
+    __asm__ volatile("fninit");
+
+    // Nobody owns the registers yet; the first FPU instruction traps
+    this_cpu()->fpu_owner = 0;
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+void fpu_enable_smp() {
+    // Whatever is still live only in this CPU's registers goes to memory
+    // first, so it can be restored anywhere
+    uint32_t flags = irq_save();
+    PerCpu* cpu = this_cpu();
+    if (cpu->fpu_owner) {
+        uint32_t cr0 = read_cr0();
+        __asm__ volatile("clts");
+        fpu_save(cpu->fpu_owner->fpu_state);
+        if (!has_fxsr) fpu_restore(cpu->fpu_owner->fpu_state);  // fnsave reinits the FPU
+        write_cr0(cr0);
+    }
+    eager_save = true;
+    irq_restore(flags);
+}
+
+void fpu_switch_to(Task* prev, Task* next) {
+    PerCpu* cpu = this_cpu();
+
+    // TS still clear means prev owned the registers during its slice
+    if (eager_save && cpu->fpu_owner == prev && !(read_cr0() & CR0_TS)) {
+        fpu_save(prev->fpu_state);
+        if (!has_fxsr) fpu_restore(prev->fpu_state);  // fnsave reinits the FPU
+    }
+
+    if (next == cpu->fpu_owner && next->fpu_cpu == (int)cpu->id) {
+        __asm__ volatile("clts");
+    } else {
+        write_cr0(read_cr0() | CR0_TS);
+    }
+}
+
+void fpu_release(Task* t) {
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        if (cpus[i].fpu_owner == t) {
+            cpus[i].fpu_owner = 0;
+        }
+    }
+    if (t->fpu_alloc) {
+        kfree(t->fpu_alloc);
+        t->fpu_alloc = 0;
+        t->fpu_state = 0;
+    }
+}
+
+bool fpu_has_sse() {
+    return has_sse;
+}
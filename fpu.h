@@ -0,0 +1,32 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+
+// FXSAVE image is 512 bytes and must be 16-byte aligned
+#define FPU_STATE_SIZE 512
+
+struct Task;
+
+// Detect the FPU/SSE, enable it in CR0/CR4 and install the #NM handler.
+// After this every task may use x87 and SSE instructions.
+void fpu_init();
+
+// Enable the FPU/SSE on the calling CPU (application processors)
+void fpu_init_cpu();
+
+// Called before the first application processor starts: from now on a task
+// that used the FPU is saved when switched out, since it may resume on
+// another CPU
+void fpu_enable_smp();
+
+// Called by the scheduler right before switching from 'prev' to 'next'.
+// Sets CR0.TS unless 'next' already owns this CPU's FPU registers.
+void fpu_switch_to(Task* prev, Task* next);
+
+// Forget a dying task's FPU state and free its save area
+void fpu_release(Task* t);
+
+bool fpu_has_sse();
+
+#endif
@@ -0,0 +1,113 @@
+#include "gdt.h"
+#include "percpu.h"
+#include "cpu.h"
+
+// =============================================================================
+// Kernel GDT
+//
+// The bootloader's GDT (flat code + data) lives in the boot sector and only
+// exists to get into protected mode. The kernel's own table keeps the same
+// selectors and adds one small data segment per CPU for GS - that is how
+// every CPU finds its PerCpu block without knowing its own number - plus the
+// task state segments.
+// =============================================================================
+
+#define GDT_ENTRIES (GDT_TSS_FIRST + SMP_MAX_CPUS)
+
+// Access bytes
+#define GDT_ACCESS_CODE  0x9A   // Present, ring 0, code, readable
+#define GDT_ACCESS_DATA  0x92   // Present, ring 0, data, writable
+#define GDT_ACCESS_UCODE 0xFA   // Present, ring 3, code, readable
+#define GDT_ACCESS_UDATA 0xF2   // Present, ring 3, data, writable
+#define GDT_ACCESS_TSS   0x89   // Present, ring 0, 32-bit TSS (available)
+
+// Granularity bytes
+#define GDT_FLAT         0xCF   // 4K granularity, 32-bit, limit 0xFFFFF
+#define GDT_BYTE         0x40   // Byte granularity, 32-bit
+
+PerCpu cpus[SMP_MAX_CPUS];
+Tss    cpu_tss[SMP_MAX_CPUS];
+
+static Tss double_fault_tss;
+
+static GDTEntry gdt[GDT_ENTRIES] __attribute__((aligned(8)));
+static GDTDescriptor gdt_descriptor;
+
+static void gdt_set_entry(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    gdt[num].base_low    = base & 0xFFFF;
+    gdt[num].base_mid    = (base >> 16) & 0xFF;
+    gdt[num].base_high   = (base >> 24) & 0xFF;
+    gdt[num].limit_low   = limit & 0xFFFF;
+    gdt[num].granularity = (gran & 0xF0) | ((limit >> 16) & 0x0F);
+    gdt[num].access      = access;
+}
+
+void gdt_init() {
+    gdt_set_entry(0, 0, 0, 0, 0);                                   // Null
+    gdt_set_entry(1, 0, 0xFFFFF, GDT_ACCESS_CODE, GDT_FLAT);        // 0x08 kernel code
+    gdt_set_entry(2, 0, 0xFFFFF, GDT_ACCESS_DATA, GDT_FLAT);        // 0x10 kernel data
+    gdt_set_entry(3, 0, 0xFFFFF, GDT_ACCESS_UCODE, GDT_FLAT);       // 0x18 user code
+    gdt_set_entry(4, 0, 0xFFFFF, GDT_ACCESS_UDATA, GDT_FLAT);       // 0x20 user data
+    gdt_set_entry(5, (uint32_t)&double_fault_tss, sizeof(Tss) - 1,   // 0x28 double fault task
+                  GDT_ACCESS_TSS, 0);
+
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        cpus[i].self = &cpus[i];
+        cpus[i].id   = i;
+        gdt_set_entry(GDT_PERCPU_FIRST + i, (uint32_t)&cpus[i], sizeof(PerCpu) - 1,
+                      GDT_ACCESS_DATA, GDT_BYTE);
+
+        cpu_tss[i].ss0        = GDT_KERNEL_DATA;
+        cpu_tss[i].iomap_base = sizeof(Tss);    // No I/O permission bitmap
+        gdt_set_entry(GDT_TSS_FIRST + i, (uint32_t)&cpu_tss[i], sizeof(Tss) - 1,
+                      GDT_ACCESS_TSS, 0);
+    }
+
+    gdt_descriptor.limit = sizeof(gdt) - 1;
+    gdt_descriptor.base  = (uint32_t)gdt;
+
+    gdt_load_cpu(0);
+}
+
+void gdt_load_cpu(uint32_t cpu) {
+    __asm__ volatile(
+        "lgdt %0\n"
+        "ljmp %1, $1f\n"        // Reload CS
+        "1:\n"
+        "mov %2, %%ax\n"
+        "mov %%ax, %%ds\n"
+        "mov %%ax, %%es\n"
+        "mov %%ax, %%fs\n"
+        "mov %%ax, %%ss\n"
+        "mov %3, %%ax\n"
+        "mov %%ax, %%gs\n"
+        "mov %4, %%ax\n"
+        "ltr %%ax\n"
+        :
+        : "m"(gdt_descriptor), "i"(GDT_KERNEL_CODE), "i"(GDT_KERNEL_DATA),
+          "r"((uint16_t)GDT_PERCPU_SEL(cpu)), "r"((uint16_t)GDT_TSS_SEL(cpu))
+        : "eax", "memory");
+}
+
+void gdt_set_double_fault_task(void (*entry)(), uint32_t stack_top) {
+    Tss* t = &double_fault_tss;
+    t->cr3    = read_cr3();
+    t->eip    = (uint32_t)entry;
+    t->eflags = 0x2;                // Reserved bit only - interrupts off
+    t->esp    = stack_top;
+    t->cs     = GDT_KERNEL_CODE;
+    t->ss     = GDT_KERNEL_DATA;
+    t->ds     = GDT_KERNEL_DATA;
+    t->es     = GDT_KERNEL_DATA;
+    t->fs     = GDT_KERNEL_DATA;
+    t->gs     = GDT_PERCPU_SEL(0);  // Fixed up by the handler if need be
+    t->iomap_base = sizeof(Tss);
+}
+
+int gdt_double_fault_cpu() {
+    uint32_t sel = double_fault_tss.prev_task & 0xFFFF;
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        if (sel == (uint32_t)GDT_TSS_SEL(i)) return i;
+    }
+    return -1;
+}
@@ -0,0 +1,67 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include <stdint.h>
+#include "percpu.h"
+
+// 8 bytes each
+struct GDTEntry {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t  base_mid;
+    uint8_t  access;        // Present, DPL, type
+    uint8_t  granularity;   // Flags (4K granularity, 32-bit) + limit 16-19
+    uint8_t  base_high;
+} __attribute__((packed));
+
+struct GDTDescriptor {
+    uint16_t limit;         // Size of GDT - 1
+    uint32_t base;          // Address of GDT
+} __attribute__((packed));
+
+// 32-bit task state segment. Each CPU has one loaded in TR (a hardware task
+// switch needs somewhere to save the outgoing state); the double fault
+// handler runs as a task of its own.
+struct Tss {
+    uint32_t prev_task;     // Back link, filled in by the CPU on a task switch
+    uint32_t esp0, ss0, esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed));
+
+// Selectors. The kernel keeps the same code/data layout as the bootloader.
+// 0x18/0x20 are ring 3 code/data: SYSENTER/SYSEXIT derive the user
+// selectors from the kernel CS, so they have to sit right after it.
+#define GDT_KERNEL_CODE   0x08
+#define GDT_KERNEL_DATA   0x10
+#define GDT_USER_CODE     0x18
+#define GDT_USER_DATA     0x20
+#define GDT_DOUBLE_FAULT_TSS 0x28
+
+// One GS descriptor per CPU, based at that CPU's PerCpu block, then one TSS
+// descriptor per CPU
+#define GDT_PERCPU_FIRST  6
+#define GDT_PERCPU_SEL(cpu) ((GDT_PERCPU_FIRST + (cpu)) * 8)
+#define GDT_TSS_FIRST     (GDT_PERCPU_FIRST + SMP_MAX_CPUS)
+#define GDT_TSS_SEL(cpu)  ((GDT_TSS_FIRST + (cpu)) * 8)
+
+extern Tss cpu_tss[SMP_MAX_CPUS];
+
+// Build the kernel GDT and load it on the bootstrap CPU (CPU 0)
+void gdt_init();
+
+// Load the GDT on the calling CPU, point its GS at cpus[cpu] and load its TSS
+void gdt_load_cpu(uint32_t cpu);
+
+// Set up the double fault task: 'entry' runs on 'stack_top' with the current
+// page directory. Hook it up with a task gate on vector 8.
+void gdt_set_double_fault_task(void (*entry)(), uint32_t stack_top);
+
+// CPU whose TSS the double fault task was entered from, or -1
+int  gdt_double_fault_cpu();
+
+#endif
@@ -0,0 +1,216 @@
+#include "hrtimer.h"
+#include "timer.h"
+#include "apic.h"
+#include "percpu.h"
+#include "sync.h"
+#include "cpu.h"
+
+static HrTimer* head = 0;
+static uint32_t pending_count = 0;
+static uint32_t fired_count = 0;
+
+// Protects the pending heap
+static Spinlock hrtimer_lock = SPINLOCK_INIT;
+
+// =============================================================================
+// Pending heap
+//
+// A pairing heap on expiry, the same shape as the scheduler's sleep heap: a
+// timer's children hang off 'child', 'next' is its next sibling and 'prev'
+// its previous sibling - or its parent, for a first child. Starting a timer
+// is O(1), and expiring or cancelling one O(log n) amortized, so thousands
+// of pending timers cost little with interrupts off. 'head' is the root,
+// the earliest expiry.
+// =============================================================================
+
+// Join two detached heaps: the later root becomes the other's first child
+static HrTimer* heap_meld(HrTimer* a, HrTimer* b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (b->expires < a->expires) {
+        HrTimer* t = a;
+        a = b;
+        b = t;
+    }
+    b->prev = a;
+    b->next = a->child;
+    if (a->child) a->child->prev = b;
+    a->child = b;
+    return a;
+}
+
+// Meld a sibling list back into one heap: pairs left to right, then the
+// pairs right to left (the results are stacked through 'next')
+static HrTimer* heap_merge_pairs(HrTimer* first) {
+    HrTimer* pairs = 0;
+    while (first) {
+        HrTimer* a = first;
+        HrTimer* b = a->next;
+        first = b ? b->next : 0;
+        a->next = a->prev = 0;
+        if (b) b->next = b->prev = 0;
+        HrTimer* m = heap_meld(a, b);
+        m->next = pairs;
+        pairs = m;
+    }
+
+    HrTimer* root = 0;
+    while (pairs) {
+        HrTimer* next = pairs->next;
+        pairs->next = 0;
+        root = heap_meld(pairs, root);
+        pairs = next;
+    }
+    return root;
+}
+
+static void heap_insert(HrTimer* t) {
+    t->next  = 0;
+    t->prev  = 0;
+    t->child = 0;
+    head = heap_meld(head, t);
+
+    t->queued = true;
+    pending_count++;
+}
+
+static void heap_remove(HrTimer* t) {
+    if (t != head) {
+        // Cut t's subtree out of its parent's child list, then meld it back
+        if (t->prev->child == t) {
+            t->prev->child = t->next;
+        } else {
+            t->prev->next = t->next;
+        }
+        if (t->next) t->next->prev = t->prev;
+        head = heap_meld(head, heap_merge_pairs(t->child));
+    } else {
+        head = heap_merge_pairs(t->child);
+    }
+
+    t->next = t->prev = t->child = 0;
+    t->queued = false;
+    pending_count--;
+}
+
+// Point the one-shot at the head. Only the bootstrap CPU can program it;
+// anywhere else, interrupt the bootstrap CPU on the one-shot vector so it
+// runs hrtimer_run and does it there.
+static void program_locked() {
+    if (!head) return;
+    if (this_cpu()->id == 0) {
+        timer_arm_oneshot(head->expires);
+    } else if (lapic_present()) {
+        lapic_send_ipi(cpus[0].apic_id, LAPIC_ONESHOT_VECTOR);
+    }
+}
+
+// =============================================================================
+// Expiry (timer interrupt on the bootstrap CPU, interrupts disabled)
+// =============================================================================
+
+static void hrtimer_deferred_run(void* arg) {
+    HrTimer* t = (HrTimer*)arg;
+    t->fn(t);
+}
+
+static void hrtimer_run() {
+    uint64_t now = timer_get_ns();
+
+    spin_lock(&hrtimer_lock);
+    while (head && head->expires <= now) {
+        HrTimer* t = head;
+        heap_remove(t);
+        fired_count++;
+
+        // Periodic: requeue first so the callback can still cancel it. If we
+        // fell more than a period behind, skip the missed expiries.
+        if (t->period) {
+            t->expires += t->period;
+            if (t->expires <= now) {
+                uint32_t behind = 1;
+                if (!(t->period >> 32)) {
+                    behind += (uint32_t)div64_32(now - t->expires, (uint32_t)t->period, 0);
+                }
+                t->overruns += behind;
+                t->expires += (uint64_t)behind * t->period;
+            }
+            heap_insert(t);
+        }
+
+        if (t->deferred) {
+            defer_schedule(&t->work, DEFER_HIGH);
+        } else {
+            // Unlocked, so the callback can restart or cancel timers
+            spin_unlock(&hrtimer_lock);
+            t->fn(t);
+            spin_lock(&hrtimer_lock);
+        }
+        now = timer_get_ns();
+    }
+    program_locked();
+    spin_unlock(&hrtimer_lock);
+}
+
+// =============================================================================
+// Public API
+// =============================================================================
+
+void hrtimer_init() {
+    timer_set_event_handler(hrtimer_run);
+}
+
+static void start(HrTimer* t, uint64_t ns, uint64_t period, hrtimer_fn cb) {
+    spin_lock(&hrtimer_lock);
+    if (t->queued) heap_remove(t);
+
+    t->fn       = cb;
+    t->period   = period;
+    t->overruns = 0;
+    t->expires  = timer_get_ns() + ns;
+    t->work.fn  = hrtimer_deferred_run;
+    t->work.arg = t;
+    heap_insert(t);
+
+    if (head == t) program_locked();
+    spin_unlock(&hrtimer_lock);
+}
+
+void hrtimer_start(HrTimer* timer, uint64_t ns, hrtimer_fn cb) {
+    start(timer, ns, 0, cb);
+}
+
+void hrtimer_start_periodic(HrTimer* timer, uint64_t period_ns, hrtimer_fn cb) {
+    if (period_ns == 0) return;
+    start(timer, period_ns, period_ns, cb);
+}
+
+bool hrtimer_cancel(HrTimer* timer) {
+    spin_lock(&hrtimer_lock);
+    bool was_queued = timer->queued;
+    if (was_queued) heap_remove(timer);
+    spin_unlock(&hrtimer_lock);
+
+    // The one-shot may still fire for it - hrtimer_run then finds nothing
+    // due and re-arms for the new head
+    return was_queued;
+}
+
+bool hrtimer_pending(HrTimer* timer) {
+    return timer->queued;
+}
+
+uint32_t hrtimer_get_pending_count() {
+    return pending_count;
+}
+
+uint32_t hrtimer_get_fired_count() {
+    return fired_count;
+}
+
+uint64_t hrtimer_get_next_expiry() {
+    spin_lock(&hrtimer_lock);
+    uint64_t next = head ? head->expires : 0;
+    spin_unlock(&hrtimer_lock);
+    return next;
+}
@@ -0,0 +1,62 @@
+#ifndef HRTIMER_H
+#define HRTIMER_H
+
+#include <stdint.h>
+#include "defer.h"
+
+// =============================================================================
+// High-resolution timers
+//
+// One-shot or periodic callbacks at nanosecond deadlines (timer_get_ns time).
+// Pending timers sit in a heap ordered by expiry, and the bootstrap CPU's
+// one-shot timer is always programmed for its root. The PIT tick checks the
+// head as well - with no local APIC that is the only check, so resolution
+// drops to one tick.
+//
+// Callbacks run in the timer interrupt with interrupts disabled or, for a
+// timer with 'deferred' set, from the DEFER_HIGH bottom half. Either way
+// they must not block. A callback may restart or cancel its own timer; for
+// a periodic timer 'expires' already holds the next expiry when it runs.
+// =============================================================================
+
+struct HrTimer;
+typedef void (*hrtimer_fn)(HrTimer* timer);
+
+struct HrTimer {
+    uint64_t      expires;     // timer_get_ns time
+    uint64_t      period;      // Restart interval, 0 for one-shot
+    hrtimer_fn    fn;
+    void*         arg;         // Free for the callback's use
+    bool          deferred;    // Run fn from the bottom half, not the IRQ
+    volatile bool queued;
+    uint32_t      overruns;    // Periods skipped because we fell behind
+    HrTimer*      next;        // Pending heap: next sibling
+    HrTimer*      prev;        // ... previous sibling, or parent of a first child
+    HrTimer*      child;       // ... first child
+    DeferredWork  work;
+};
+
+// Timers must start out zeroed (static storage, or this)
+#define HRTIMER_INIT { 0, 0, 0, 0, false, false, 0, 0, 0, 0, DEFERRED_WORK_INIT(0, 0) }
+
+// Hook into the timer interrupts (needs timer_init)
+void hrtimer_init();
+
+// Fire 'cb' once, 'ns' from now. Restarting a pending timer moves it.
+void hrtimer_start(HrTimer* timer, uint64_t ns, hrtimer_fn cb);
+
+// Fire 'cb' every 'period_ns', the first time one period from now
+void hrtimer_start_periodic(HrTimer* timer, uint64_t period_ns, hrtimer_fn cb);
+
+// Take a timer off the pending heap. Returns false if it was not pending.
+// A callback already running on another CPU is not waited for.
+bool hrtimer_cancel(HrTimer* timer);
+
+bool hrtimer_pending(HrTimer* timer);
+
+// Stats
+uint32_t hrtimer_get_pending_count();
+uint32_t hrtimer_get_fired_count();
+uint64_t hrtimer_get_next_expiry();    // 0 if nothing is pending
+
+#endif
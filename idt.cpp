@@ -82,9 +82,23 @@ void idt_init() {
     idt_set_gate(46, (uint32_t)isr46, 0x08, IDT_INTERRUPT_GATE);
     idt_set_gate(47, (uint32_t)isr47, 0x08, IDT_INTERRUPT_GATE);
 
+    // Software-only vector for 'bench irq'
+    idt_set_gate(ISR_BENCH_VECTOR, (uint32_t)isr237, 0x08, IDT_INTERRUPT_GATE);
+
+    // Local APIC vectors
+    idt_set_gate(238, (uint32_t)isr238, 0x08, IDT_INTERRUPT_GATE);
+    idt_set_gate(239, (uint32_t)isr239, 0x08, IDT_INTERRUPT_GATE);
+    idt_set_gate(240, (uint32_t)isr240, 0x08, IDT_INTERRUPT_GATE);
+    idt_set_gate(255, (uint32_t)isr255, 0x08, IDT_INTERRUPT_GATE);
+
     // Remap PIC
     pic_remap();
 
     // Load IDT
     idt_load((uint32_t)&idt_descriptor);
+}
+
+// The table is shared; each application processor just loads it
+void idt_load_cpu() {
+    idt_load((uint32_t)&idt_descriptor);
 }
\ No newline at end of file
@@ -24,9 +24,11 @@ struct IDTDescriptor {
 // Type attributes
 #define IDT_INTERRUPT_GATE 0x8E  // Present, Ring 0, 32-bit interrupt gate
 #define IDT_TRAP_GATE      0x8F  // Present, Ring 0, 32-bit trap gate
+#define IDT_TASK_GATE      0x85  // Present, Ring 0, task gate (selector = TSS)
 
 // Declarations
 void idt_init();
+void idt_load_cpu();
 void idt_set_gate(uint8_t num, uint32_t handler, uint16_t selector, uint8_t type_attr);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include "ioapic.h"
+#include "acpi.h"
+#include "apic.h"
+#include "pic.h"
+#include "paging.h"
+#include "sync.h"
+#include "cpu.h"
+
+// Registers are reached indirectly: write the index to IOREGSEL, then
+// read/write IOWIN
+#define IOAPIC_REGSEL     0x00
+#define IOAPIC_WIN        0x10
+
+#define IOAPIC_REG_VER    0x01    // Bits 16-23: highest redirection entry
+#define IOAPIC_REG_REDTBL 0x10    // Two 32-bit registers per pin
+
+// Redirection entry, low dword (fixed delivery, physical destination)
+#define REDIR_ACTIVE_LOW  0x2000
+#define REDIR_LEVEL       0x8000
+#define REDIR_MASKED      0x10000
+
+// ISA IRQ n is delivered on vector 32 + n, same as through the PIC
+#define ISA_VECTOR_BASE   32
+#define ISA_CASCADE_IRQ   2       // The PIC's slave line - never a device
+
+struct IoApic {
+    volatile uint32_t* regs;
+    uint32_t gsi_base;
+    uint32_t pins;
+};
+
+static IoApic ioapics[ACPI_MAX_IOAPICS];
+static int ioapic_count = 0;
+static bool active = false;
+extern "C" { volatile uint32_t* isa_eoi_reg = 0; }
+
+// Protects the IOREGSEL/IOWIN pairs
+static Spinlock ioapic_lock = SPINLOCK_INIT;
+
+static uint32_t ioapic_read(IoApic* io, uint32_t reg) {
+    io->regs[IOAPIC_REGSEL / 4] = reg;
+    return io->regs[IOAPIC_WIN / 4];
+}
+
+static void ioapic_write(IoApic* io, uint32_t reg, uint32_t val) {
+    io->regs[IOAPIC_REGSEL / 4] = reg;
+    io->regs[IOAPIC_WIN / 4] = val;
+}
+
+// IOAPIC serving 'gsi', with *pin set to its input there
+static IoApic* find_gsi(uint32_t gsi, uint32_t* pin) {
+    for (int i = 0; i < ioapic_count; i++) {
+        IoApic* io = &ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->pins) {
+            *pin = gsi - io->gsi_base;
+            return io;
+        }
+    }
+    return 0;
+}
+
+// Program one pin. Masked first, so it never fires half-written.
+static void set_entry(IoApic* io, uint32_t pin, uint32_t low, uint32_t high) {
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, REDIR_MASKED);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2 + 1, high);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, low);
+}
+
+// Look up the pin an ISA IRQ is wired to
+static IoApic* find_isa(uint8_t irq, uint32_t* pin) {
+    if (irq >= ISA_IRQ_COUNT) return 0;
+    return find_gsi(acpi_get_platform()->isa_gsi[irq], pin);
+}
+
+// =============================================================================
+// Public API
+// =============================================================================
+
+bool ioapic_init() {
+    const PlatformInfo* info = acpi_get_platform();
+    if (!lapic_present() || info->ioapic_count == 0) return false;
+
+    uint32_t flags = irq_save();
+
+    for (int i = 0; i < info->ioapic_count; i++) {
+        IoApic* io = &ioapics[ioapic_count];
+        map_identity(info->ioapics[i].addr, PAGE_SIZE, PTE_PRESENT | PTE_WRITABLE | PTE_NOCACHE);
+        io->regs     = (volatile uint32_t*)info->ioapics[i].addr;
+        io->gsi_base = info->ioapics[i].gsi_base;
+        io->pins     = ((ioapic_read(io, IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+        ioapic_count++;
+
+        for (uint32_t pin = 0; pin < io->pins; pin++) {
+            set_entry(io, pin, REDIR_MASKED, 0);
+        }
+    }
+
+    // Whatever was open at the PIC stays open, now delivered to this CPU
+    uint16_t pic_mask = pic_get_mask();
+    uint8_t  dest = (uint8_t)lapic_get_id();
+    for (uint8_t irq = 0; irq < ISA_IRQ_COUNT; irq++) {
+        if (irq == ISA_CASCADE_IRQ) continue;
+
+        uint32_t pin;
+        IoApic* io = find_isa(irq, &pin);
+        if (!io) continue;
+
+        uint16_t irq_flags = info->isa_flags[irq];
+        uint32_t low = ISA_VECTOR_BASE + irq;
+        if ((irq_flags & IRQ_POLARITY_MASK) == IRQ_ACTIVE_LOW) low |= REDIR_ACTIVE_LOW;
+        if ((irq_flags & IRQ_TRIGGER_MASK) == IRQ_LEVEL)       low |= REDIR_LEVEL;
+        if (pic_mask & (1 << irq))                              low |= REDIR_MASKED;
+        set_entry(io, pin, low, (uint32_t)dest << 24);
+    }
+
+    pic_disable();
+    active = true;
+    isa_eoi_reg = lapic_eoi_reg;
+
+    irq_restore(flags);
+    return true;
+}
+
+bool ioapic_active() {
+    return active;
+}
+
+void ioapic_set_masked(uint8_t irq, bool masked) {
+    uint32_t pin;
+    IoApic* io = find_isa(irq, &pin);
+    if (!io) return;
+
+    spin_lock(&ioapic_lock);
+    uint32_t low = ioapic_read(io, IOAPIC_REG_REDTBL + pin * 2);
+    if (masked) low |= REDIR_MASKED;
+    else        low &= ~REDIR_MASKED;
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, low);
+    spin_unlock(&ioapic_lock);
+}
+
+void ioapic_set_dest(uint8_t irq, uint8_t apic_id) {
+    uint32_t pin;
+    IoApic* io = find_isa(irq, &pin);
+    if (!io) return;
+
+    spin_lock(&ioapic_lock);
+    uint32_t low = ioapic_read(io, IOAPIC_REG_REDTBL + pin * 2);
+    set_entry(io, pin, low, (uint32_t)apic_id << 24);
+    spin_unlock(&ioapic_lock);
+}
+
+bool ioapic_get_route(uint8_t irq, IoApicRoute* out) {
+    uint32_t pin;
+    IoApic* io = find_isa(irq, &pin);
+    if (!io) return false;
+
+    spin_lock(&ioapic_lock);
+    uint32_t low  = ioapic_read(io, IOAPIC_REG_REDTBL + pin * 2);
+    uint32_t high = ioapic_read(io, IOAPIC_REG_REDTBL + pin * 2 + 1);
+    spin_unlock(&ioapic_lock);
+
+    out->gsi          = io->gsi_base + pin;
+    out->vector       = low & 0xFF;
+    out->dest_apic_id = high >> 24;
+    out->masked       = (low & REDIR_MASKED) != 0;
+    out->level        = (low & REDIR_LEVEL) != 0;
+    out->active_low   = (low & REDIR_ACTIVE_LOW) != 0;
+    return true;
+}
+
+int ioapic_get_count() {
+    return ioapic_count;
+}
+
+uint32_t ioapic_get_pins(int index) {
+    return (index >= 0 && index < ioapic_count) ? ioapics[index].pins : 0;
+}
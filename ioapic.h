@@ -0,0 +1,48 @@
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include <stdint.h>
+
+// =============================================================================
+// IOAPIC
+//
+// Replaces the 8259 for device interrupts: every input pin (global system
+// interrupt, GSI) has a redirection entry choosing its vector, trigger mode,
+// polarity and destination CPU. The ISA IRQs keep vectors 32-47, so drivers
+// register the same handlers either way, and EOI goes to the local APIC as
+// one MMIO write instead of one or two port writes to the PIC.
+// =============================================================================
+
+// One ISA IRQ's redirection entry, decoded
+struct IoApicRoute {
+    uint32_t gsi;
+    uint8_t  vector;
+    uint8_t  dest_apic_id;
+    bool     masked;
+    bool     level;          // Level triggered (otherwise edge)
+    bool     active_low;
+};
+
+// Map the IOAPICs from the firmware tables, mask every pin, then take the
+// ISA IRQs over from the PIC (inheriting its mask) and mask the PIC.
+// Needs the local APIC. Returns false - leaving the PIC in charge - if the
+// tables list no IOAPIC.
+bool ioapic_init();
+
+// IOAPIC delivery in use (EOI goes to the local APIC)
+bool ioapic_active();
+
+// Where the fast IRQ stubs (isr.asm) send EOI for ISA IRQs: the local
+// APIC's EOI register once the IOAPIC delivers them, 0 for the PIC
+extern "C" volatile uint32_t* isa_eoi_reg;
+
+// Per ISA IRQ (0-15) - follows interrupt source overrides
+void ioapic_set_masked(uint8_t irq, bool masked);
+void ioapic_set_dest(uint8_t irq, uint8_t apic_id);
+bool ioapic_get_route(uint8_t irq, IoApicRoute* out);
+
+// Info
+int      ioapic_get_count();
+uint32_t ioapic_get_pins(int index);
+
+#endif
@@ -0,0 +1,92 @@
+#include "irqstat.h"
+#include "percpu.h"
+#include "kheap.h"
+
+// A row of 256 per CPU is too big for the kernel image (the boot loader
+// reads 192KB, bss included), so it comes from the heap. Anything taken
+// before irqstat_init goes uncounted.
+static IrqStats (*stats)[256] = 0;
+static uint32_t max_depth[SMP_MAX_CPUS];
+static uint32_t depth_hist[SMP_MAX_CPUS][IRQSTAT_DEPTHS];
+
+void irqstat_init() {
+    stats = (IrqStats (*)[256])kmalloc(SMP_MAX_CPUS * 256 * sizeof(IrqStats));
+    if (stats) irqstat_reset();
+}
+
+// Called with interrupts off, on the CPU that took the interrupt, so
+// nothing else writes the same row
+void irqstat_record(uint8_t vector, uint64_t cycles, uint32_t depth) {
+    if (!stats) return;
+    uint32_t cpu = this_cpu()->id;
+    IrqStats* s = &stats[cpu][vector];
+    s->count++;
+    if (depth) s->nested++;
+    if (depth + 1 > max_depth[cpu]) max_depth[cpu] = depth + 1;
+    depth_hist[cpu][depth < IRQSTAT_DEPTHS ? depth : IRQSTAT_DEPTHS - 1]++;
+
+    uint32_t c = (cycles >> 32) ? 0xFFFFFFFF : (uint32_t)cycles;
+    if (c > s->max_cycles) s->max_cycles = c;
+    s->total_cycles += cycles;
+}
+
+void irqstat_count(uint8_t vector) {
+    if (!stats) return;
+    stats[this_cpu()->id][vector].count++;
+}
+
+void irqstat_spurious(uint8_t vector) {
+    if (!stats) return;
+    IrqStats* s = &stats[this_cpu()->id][vector];
+    s->count++;
+    s->spurious++;
+}
+
+void irqstat_defer(uint8_t vector) {
+    if (!stats) return;
+    stats[this_cpu()->id][vector].deferred++;
+}
+
+void irqstat_get(uint8_t vector, IrqStats* out) {
+    out->count = out->nested = out->spurious = out->deferred = out->max_cycles = 0;
+    out->total_cycles = 0;
+    if (!stats) return;
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        const IrqStats* s = &stats[cpu][vector];
+        out->count        += s->count;
+        out->nested       += s->nested;
+        out->spurious     += s->spurious;
+        out->deferred     += s->deferred;
+        out->total_cycles += s->total_cycles;
+        if (s->max_cycles > out->max_cycles) out->max_cycles = s->max_cycles;
+    }
+}
+
+uint32_t irqstat_get_max_depth() {
+    uint32_t depth = 0;
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (max_depth[cpu] > depth) depth = max_depth[cpu];
+    }
+    return depth;
+}
+
+void irqstat_get_depth_hist(uint32_t* hist) {
+    for (int d = 0; d < IRQSTAT_DEPTHS; d++) {
+        hist[d] = 0;
+        for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) hist[d] += depth_hist[cpu][d];
+    }
+}
+
+// Racy against other CPUs' interrupts, which only costs a count or two
+void irqstat_reset() {
+    if (!stats) return;
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (int v = 0; v < 256; v++) {
+            IrqStats* s = &stats[cpu][v];
+            s->count = s->nested = s->spurious = s->deferred = s->max_cycles = 0;
+            s->total_cycles = 0;
+        }
+        max_depth[cpu] = 0;
+        for (int d = 0; d < IRQSTAT_DEPTHS; d++) depth_hist[cpu][d] = 0;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef IRQSTAT_H
+#define IRQSTAT_H
+
+#include <stdint.h>
+
+// =============================================================================
+// Interrupt statistics
+//
+// Every vector that reaches a handler is counted here; hardware interrupts
+// also have their handler timed with the TSC (entry to exit, the EOI and
+// bottom half not included) and note whether they arrived while another
+// handler was running on the same CPU. Counters are per CPU so the entry
+// path never takes a lock; readers sum them up.
+// =============================================================================
+
+// Allocate the counters (needs the heap)
+void irqstat_init();
+
+struct IrqStats {
+    uint32_t count;
+    uint32_t nested;          // Arrived inside another handler
+    uint32_t spurious;        // Raised with nothing behind it (IRQ7/15, LAPIC 255)
+    uint32_t deferred;        // Held off by a higher-priority handler, run later
+    uint32_t max_cycles;      // Longest single handler run
+    uint64_t total_cycles;    // All timed runs
+};
+
+// A timed hardware interrupt: 'depth' is how many handlers were already
+// running on this CPU when it came in
+void irqstat_record(uint8_t vector, uint64_t cycles, uint32_t depth);
+
+// An exception or system call - counted, not timed (they may block)
+void irqstat_count(uint8_t vector);
+
+// A spurious interrupt, counted as one too
+void irqstat_spurious(uint8_t vector);
+
+// Held off by the running handler's priority level (see isr.h). Counted
+// again when it finally runs.
+void irqstat_defer(uint8_t vector);
+
+// Totals over every CPU
+void     irqstat_get(uint8_t vector, IrqStats* out);
+uint32_t irqstat_get_max_depth();    // Deepest nesting seen, 1 = never nested
+
+// How many handler runs started at each nesting depth: hist[0] with no other
+// handler running, hist[1] inside one, ... the last bucket takes the rest
+#define IRQSTAT_DEPTHS 4
+void irqstat_get_depth_hist(uint32_t* hist);
+
+void irqstat_reset();
+
+#endif
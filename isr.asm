@@ -2,6 +2,13 @@
 
 ; External C handler
 extern isr_handler
+extern isr_fast_exit
+extern interrupt_handlers
+extern lapic_eoi_reg
+extern isa_eoi_reg
+
+PERCPU_TO_TSS equ 8 * 8 ; SMP_MAX_CPUS descriptors (GDT_TSS_SEL - GDT_PERCPU_SEL)
+PERCPU_IRQ_DEPTH equ 4  ; PerCpu::irq_depth
 
 ; Macro for ISRs that dont push an error code
 %macro ISR_NO_ERR 1
@@ -12,6 +19,82 @@ isr%1:
     jmp isr_common
 %endmacro
 
+; Fast IRQ stub: same frame as isr_common, but it calls the registered
+; handler straight from the table, only reloads segments when coming from
+; ring 3 (in the kernel DS/ES/FS already hold the data segment) and sends
+; the EOI itself. Second argument is where the EOI goes.
+%define EOI_PIC_MASTER 0    ; ISA IRQ 0-7: master PIC, or the LAPIC via IOAPIC
+%define EOI_PIC_SLAVE  1    ; ISA IRQ 8-15: both PICs, or the LAPIC via IOAPIC
+%define EOI_LAPIC      2    ; Local APIC vectors
+
+%macro IRQ_FAST 2
+global irq_fast%1
+irq_fast%1:
+    push dword 0
+    push dword %1
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+
+    test byte [esp + 60], 3     ; Interrupted CS
+    jz %%kernel
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    str ax
+    sub ax, PERCPU_TO_TSS
+    mov gs, ax
+%%kernel:
+
+    ; Time the handler for irqstat: depth on entry in ebx, cycles in edi:esi
+    ; (all three survive the C call)
+    mov ebx, [gs:PERCPU_IRQ_DEPTH]
+    inc dword [gs:PERCPU_IRQ_DEPTH]
+    rdtsc
+    mov esi, eax
+    mov edi, edx
+
+    push esp
+    call [interrupt_handlers + %1 * 4]
+    add esp, 4
+
+    rdtsc
+    sub eax, esi
+    sbb edx, edi
+    mov esi, eax
+    mov edi, edx
+    dec dword [gs:PERCPU_IRQ_DEPTH]
+
+%if %2 == EOI_LAPIC
+    mov eax, [lapic_eoi_reg]
+    mov dword [eax], 0
+%else
+    mov eax, [isa_eoi_reg]
+    test eax, eax
+    jz %%pic
+    mov dword [eax], 0
+    jmp %%eoi_done
+%%pic:
+    mov al, 0x20
+  %if %2 == EOI_PIC_SLAVE
+    out 0xA0, al
+  %endif
+    out 0x20, al
+%%eoi_done:
+%endif
+
+    push ebx                    ; Record the stats, then bottom half and
+    push edi                    ; preemption as isr_handler does
+    push esi
+    push dword %1
+    call isr_fast_exit
+    add esp, 16
+    jmp isr_return
+%endmacro
+
 ; Macro for ISRs that DO push an error code
 %macro ISR_ERR 1
 global isr%1
@@ -72,6 +155,22 @@ ISR_NO_ERR 45  ; IRQ13 - FPU
 ISR_NO_ERR 46  ; IRQ14 - Primary ATA
 ISR_NO_ERR 47  ; IRQ15 - Secondary ATA
 
+; System call gate (callable from ring 3)
+ISR_NO_ERR 128 ; int 0x80
+
+; Local APIC vectors (per CPU)
+ISR_NO_ERR 237 ; bench irq (software only, see ISR_BENCH_VECTOR)
+ISR_NO_ERR 238 ; LAPIC one-shot (bootstrap CPU)
+ISR_NO_ERR 239 ; LAPIC timer
+ISR_NO_ERR 240 ; Reschedule IPI
+ISR_NO_ERR 255 ; Spurious
+
+; Fast paths for the timers (see register_fast_irq_handler)
+IRQ_FAST 32,  EOI_PIC_MASTER    ; PIT
+IRQ_FAST 237, EOI_LAPIC         ; bench irq
+IRQ_FAST 238, EOI_LAPIC         ; LAPIC one-shot
+IRQ_FAST 239, EOI_LAPIC         ; LAPIC timer
+
 ; Common handler - saves all registers, calls C, restores
 isr_common:
     ; Save all general purpose registers
@@ -83,12 +182,19 @@ isr_common:
     push fs
     push gs
     
-    ; Load kernel data segment
+    ; Load kernel data segment. GS is the per-CPU segment (see gdt.cpp) in
+    ; every kernel context, so it only needs loading when we came from ring
+    ; 3: this CPU's TSS descriptor (TR) sits a fixed distance after it.
     mov ax, 0x10        ; DATA_SEG from your GDT
     mov ds, ax
     mov es, ax
     mov fs, ax
+    test byte [esp + 60], 3     ; Interrupted CS
+    jz .kernel_gs
+    str ax
+    sub ax, PERCPU_TO_TSS
     mov gs, ax
+.kernel_gs:
     
     ; Push pointer to stack (registers_t struct)
     push esp
@@ -98,9 +204,17 @@ isr_common:
     
     ; Remove pushed pointer
     add esp, 4
-    
-    ; Restore segment registers
+
+isr_return:
+    ; Restore segment registers. GS only for ring 3: a kernel context
+    ; keeps this CPU's, since the task may have resumed on another CPU.
+    test byte [esp + 60], 3
+    jz .keep_gs
     pop gs
+    jmp .gs_done
+.keep_gs:
+    add esp, 4
+.gs_done:
     pop fs
     pop es
     pop ds
@@ -1,30 +1,260 @@
 #include "isr.h"
 #include "ports.h"
+#include "defer.h"
+#include "task.h"
+#include "percpu.h"
+#include "apic.h"
+#include "ioapic.h"
+#include "pic.h"
+#include "syscall.h"
+#include "user.h"
+#include "cpu.h"
+#include "idt.h"
+#include "irqstat.h"
 
-// Array of handler function pointers (one per interrupt 0-47)
-static isr_handler_t interrupt_handlers[48] = {0};
+// Array of handler function pointers (one per interrupt vector). The fast
+// stubs in isr.asm call straight through it too.
+extern "C" { isr_handler_t interrupt_handlers[256] = {0}; }
 
 // Register a handler for interrupt n
 void register_interrupt_handler(uint8_t n, isr_handler_t handler) {
-    if (n < 48) {
-        interrupt_handlers[n] = handler;
+    interrupt_handlers[n] = handler;
+}
+
+// Entry stubs for the vectors that have a fast one (0 if none)
+static uint32_t fast_stub(uint8_t n) {
+    switch (n) {
+        case 32:  return (uint32_t)irq_fast32;
+        case ISR_BENCH_VECTOR: return (uint32_t)irq_fast237;
+        case 238: return (uint32_t)irq_fast238;
+        case 239: return (uint32_t)irq_fast239;
+        default:  return 0;
     }
 }
 
-// Main ISR dispatcher - called from assembly
-extern "C" void isr_handler(registers_t* regs) {
-    uint8_t int_no = regs->int_no;
-    
-    // Call registered handler if one exists
-    if (int_no < 48 && interrupt_handlers[int_no] != 0) {
-        interrupt_handlers[int_no](regs);
+static uint32_t common_stub(uint8_t n) {
+    switch (n) {
+        case 32:  return (uint32_t)isr32;
+        case ISR_BENCH_VECTOR: return (uint32_t)isr237;
+        case 238: return (uint32_t)isr238;
+        case 239: return (uint32_t)isr239;
+        default:  return 0;
     }
-    
-    // Send EOI for hardware interrupts (IRQs 0-15 = interrupts 32-47)
-    if (int_no >= 32 && int_no < 48) {
+}
+
+static bool fast_path_on[256];
+
+void register_fast_irq_handler(uint8_t n, isr_handler_t handler) {
+    interrupt_handlers[n] = handler;
+    isr_set_fast_path(n, true);
+}
+
+bool isr_set_fast_path(uint8_t n, bool fast) {
+    uint32_t stub = fast ? fast_stub(n) : common_stub(n);
+    if (!stub) return false;
+    bool was = fast_path_on[n];
+    idt_set_gate(n, stub, 0x08, IDT_INTERRUPT_GATE);
+    fast_path_on[n] = fast;
+    return was;
+}
+
+isr_handler_t isr_get_handler(uint8_t n) {
+    return interrupt_handlers[n];
+}
+
+void irq_set_masked(uint8_t irq, bool masked) {
+    if (ioapic_active()) {
+        ioapic_set_masked(irq, masked);
+    } else {
+        pic_set_masked(irq, masked);
+    }
+}
+
+// =============================================================================
+// Priority levels and nesting
+//
+// Levels are enforced in software, the same way for the PIC and the IOAPIC:
+// each CPU tracks the level of the handler it is running, and an ISA IRQ
+// that comes in at or below it is acknowledged, masked and noted in
+// irq_pending. When the level drops the held-off IRQs run, highest first,
+// and are unmasked again. Holding them off costs nothing until it actually
+// happens, unlike re-programming the PIC or IOAPIC masks on every entry -
+// and an edge masked at the IOAPIC would simply be lost.
+// =============================================================================
+
+static uint8_t irq_priority[16] = {
+    IRQ_PRIO_MAX,       // 0  PIT
+    12,                 // 1  keyboard
+    IRQ_PRIO_NORMAL,    // 2  cascade
+    6, 6,               // 3, 4 serial
+    IRQ_PRIO_NORMAL,    // 5
+    IRQ_PRIO_NORMAL,    // 6  floppy
+    IRQ_PRIO_LOW,       // 7  parallel
+    10,                 // 8  RTC
+    IRQ_PRIO_NORMAL,    // 9
+    IRQ_PRIO_NORMAL,    // 10
+    IRQ_PRIO_NORMAL,    // 11
+    IRQ_PRIO_NORMAL,    // 12 mouse
+    IRQ_PRIO_NORMAL,    // 13
+    4, 4                // 14, 15 ATA
+};
+
+static bool irq_nested[16];
+
+void irq_set_priority(uint8_t irq, uint8_t prio) {
+    if (irq >= 16) return;
+    if (prio < 1) prio = 1;
+    if (prio > IRQ_PRIO_MAX) prio = IRQ_PRIO_MAX;
+    irq_priority[irq] = prio;
+}
+
+uint8_t irq_get_priority(uint8_t irq) {
+    return irq < 16 ? irq_priority[irq] : IRQ_PRIO_LAPIC;
+}
+
+void irq_set_nested(uint8_t irq, bool nested) {
+    if (irq >= 16) return;
+    if (nested) isr_set_fast_path(32 + irq, false);
+    irq_nested[irq] = nested;
+}
+
+bool irq_get_nested(uint8_t irq) {
+    return irq < 16 && irq_nested[irq];
+}
+
+// IRQs 0-15 (interrupts 32-47) came from the PIC unless the IOAPIC has
+// taken over, anything above from this CPU's local APIC
+static void send_eoi(uint8_t int_no) {
+    if (int_no >= 48 || ioapic_active()) {
+        lapic_eoi();
+    } else {
         if (int_no >= 40) {
             outb(0xA0, 0x20);  // EOI to slave PIC
         }
         outb(0x20, 0x20);      // EOI to master PIC
     }
+}
+
+static void irq_replay(PerCpu* cpu, registers_t* regs);
+
+// Run a hardware interrupt's handler at its level and acknowledge it.
+// Interrupts are off on entry and on return. 'acked' = EOI already sent
+// (a held-off IRQ being replayed).
+static void irq_run(PerCpu* cpu, uint8_t int_no, registers_t* regs, bool acked) {
+    bool nested = int_no < 48 && irq_nested[int_no - 32];
+    uint32_t old_level = cpu->irq_level;
+    cpu->irq_level = irq_get_priority(int_no - 32);
+    uint32_t depth = cpu->irq_depth++;
+
+    if (nested) {
+        if (!acked) send_eoi(int_no);
+        acked = true;
+        __asm__ volatile("sti");
+    }
+
+    uint64_t start = rdtsc();
+    if (interrupt_handlers[int_no] != 0) {
+        interrupt_handlers[int_no](regs);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    if (nested) __asm__ volatile("cli");
+    cpu->irq_depth--;
+    cpu->irq_level = old_level;
+    irqstat_record(int_no, cycles, depth);
+
+    if (!acked) send_eoi(int_no);
+    if (cpu->irq_pending) irq_replay(cpu, regs);
+}
+
+// Run whatever was held off that is now above the level, highest first
+static void irq_replay(PerCpu* cpu, registers_t* regs) {
+    while (1) {
+        int best = -1;
+        for (int irq = 0; irq < 16; irq++) {
+            if (!(cpu->irq_pending & (1 << irq))) continue;
+            if (irq_priority[irq] <= cpu->irq_level) continue;
+            if (best < 0 || irq_priority[irq] > irq_priority[best]) best = irq;
+        }
+        if (best < 0) return;
+
+        cpu->irq_pending &= ~(1 << best);
+        registers_t r = *regs;
+        r.int_no = 32 + best;
+        irq_run(cpu, 32 + best, &r, true);
+        irq_set_masked(best, false);
+    }
+}
+
+// Main ISR dispatcher - called from assembly
+extern "C" void isr_handler(registers_t* regs) {
+    uint8_t int_no = regs->int_no;
+
+    // First thing, so the probe sees just the stub and isr_common
+    irq_entry_probe(int_no);
+    
+    // Exceptions and system calls: call the registered handler if one
+    // exists. An exception nobody handles ends a user task rather than
+    // retrying the faulting instruction. Either may block or never come
+    // back, so they are counted but not timed.
+    if (int_no < 32 || int_no == SYSCALL_VECTOR) {
+        irqstat_count(int_no);
+        if (interrupt_handlers[int_no] != 0) {
+            interrupt_handlers[int_no](regs);
+        } else if (int_no < 32 && (regs->cs & 3)) {
+            user_fault(regs, 0);
+        }
+        return;
+    }
+
+    // Spurious APIC interrupts must not be acknowledged
+    if (int_no == LAPIC_SPURIOUS_VECTOR) {
+        irqstat_spurious(int_no);
+        if (interrupt_handlers[int_no] != 0) interrupt_handlers[int_no](regs);
+        return;
+    }
+
+    // The PIC raises IRQ7/IRQ15 when a request went away before the CPU
+    // acknowledged it. A real one is in service; a spurious one gets no
+    // handler and no EOI - except the master's for the cascade line.
+    if ((int_no == 39 || int_no == 47) && !ioapic_active() &&
+        !(pic_get_isr() & (1 << (int_no - 32)))) {
+        irqstat_spurious(int_no);
+        if (int_no == 47) outb(0x20, 0x20);
+        return;
+    }
+
+    // At or below the running handler's level: hold it off until it drops
+    PerCpu* cpu = this_cpu();
+    if (int_no < 48 && irq_priority[int_no - 32] <= cpu->irq_level) {
+        irq_set_masked(int_no - 32, true);
+        cpu->irq_pending |= 1 << (int_no - 32);
+        irqstat_defer(int_no);
+        send_eoi(int_no);
+        return;
+    }
+
+    irq_run(cpu, int_no, regs, false);
+    isr_irq_exit();
+}
+
+extern "C" void isr_fast_exit(uint32_t vector, uint64_t cycles, uint32_t depth) {
+    irqstat_record((uint8_t)vector, cycles, depth);
+    isr_irq_exit();
+}
+
+// Bottom half: run deferred work with interrupts back on, then switch tasks
+// if a handler asked for it. Both happen after the EOI so the PIC can
+// deliver the next interrupt straight away. An IRQ that interrupted a
+// bottom half leaves both to the outer one, and so does one that preempted
+// a nested handler. The flag is per CPU - other CPUs have their own IRQ
+// exits.
+extern "C" void isr_irq_exit() {
+    PerCpu* cpu = this_cpu();
+    if (!cpu->bottom_half_active && !cpu->irq_depth) {
+        cpu->bottom_half_active = 1;
+        defer_irq_exit();
+        cpu->bottom_half_active = 0;
+        task_preempt_check();
+    }
 }
\ No newline at end of file
@@ -25,6 +25,18 @@ extern "C" {
     void isr36(); void isr37(); void isr38(); void isr39();
     void isr40(); void isr41(); void isr42(); void isr43();
     void isr44(); void isr45(); void isr46(); void isr47();
+    void isr128();
+    void isr237(); void isr238(); void isr239(); void isr240(); void isr255();
+
+    // Fast IRQ stubs
+    void irq_fast32(); void irq_fast237(); void irq_fast238(); void irq_fast239();
+
+    // IRQ exit path after the EOI, shared with the fast stubs
+    void isr_irq_exit();
+
+    // Where the fast stubs leave: records the handler's run for irqstat
+    // (cycles, and the nesting depth it started at), then isr_irq_exit
+    void isr_fast_exit(uint32_t vector, uint64_t cycles, uint32_t depth);
 }
 
 // Function pointer type for interrupt handlers
@@ -33,4 +45,46 @@ typedef void (*isr_handler_t)(registers_t*);
 // Register a handler for a specific interrupt number
 void register_interrupt_handler(uint8_t n, isr_handler_t handler);
 
+// Same, but entered through a specialised stub (vectors 32, 238, 239 and
+// ISR_BENCH_VECTOR only): it calls the handler straight from isr.asm, skips
+// the segment reloads when the interrupt came from kernel mode and sends the
+// EOI inline, instead of going through isr_common and isr_handler's
+// dispatch. Priority levels (below) are not checked there: a fast vector
+// always runs, so only the top-level timers have one.
+void register_fast_irq_handler(uint8_t n, isr_handler_t handler);
+
+// No device ever raises this one: 'bench irq' raises it with int, through
+// either stub, and acknowledges it at the local APIC like any vector above
+// the ISA range
+#define ISR_BENCH_VECTOR 0xED
+
+// Point a vector at its fast stub or back at the common one. Returns
+// whether it was on the fast one - false as well if it has none.
+bool isr_set_fast_path(uint8_t n, bool fast);
+isr_handler_t isr_get_handler(uint8_t n);
+
+// Mask/unmask a legacy IRQ line (0-15, vector 32 + irq) at whichever
+// controller delivers it - the IOAPIC if active, else the PIC
+void irq_set_masked(uint8_t irq, bool masked);
+
+// Interrupt priority levels for the ISA IRQs (0-15), 1 lowest to
+// IRQ_PRIO_MAX. While a handler runs, lines at or below its level are held
+// off - acknowledged, masked and run once it returns - and higher ones can
+// preempt it if it runs nested. Local APIC vectors (timers, IPIs) sit above
+// every level. The PIT starts at the top and the disk near the bottom.
+#define IRQ_PRIO_LOW    2
+#define IRQ_PRIO_NORMAL 8
+#define IRQ_PRIO_MAX    15
+#define IRQ_PRIO_LAPIC  (IRQ_PRIO_MAX + 1)
+
+void    irq_set_priority(uint8_t irq, uint8_t prio);
+uint8_t irq_get_priority(uint8_t irq);
+
+// Run the handler for 'irq' with interrupts enabled (after its EOI), so a
+// slow one no longer holds up the timer. It must not share unguarded state
+// with higher-priority handlers. Nested vectors give up their fast stub -
+// the fast stubs know nothing about levels.
+void irq_set_nested(uint8_t irq, bool nested);
+bool irq_get_nested(uint8_t irq);
+
 #endif // warhammer darktide is so fun they need to add adeptus mechanicus as a class tho
\ No newline at end of file
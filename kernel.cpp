@@ -1,3 +1,4 @@
+#include "gdt.h"
 #include "idt.h"
 #include "keyboard.h"
 #include "timer.h"
@@ -7,11 +8,26 @@
 #include "paging.h"
 #include "kheap.h"
 #include "task.h"
+#include "fpu.h"
+#include "defer.h"
+#include "workqueue.h"
 #include "ata.h"
 #include "fat16.h"
+#include "smp.h"
+#include "acpi.h"
+#include "apic.h"
+#include "ioapic.h"
+#include "hrtimer.h"
+#include "syscall.h"
+#include "user.h"
+#include "irqstat.h"
+#include "pci.h"
 
 
 extern "C" void main() {
+    // Kernel GDT first: the per-CPU GS segment has to be valid before
+    // anything asks which task is running
+    gdt_init();
     idt_init();
     
     // Initialize drivers
@@ -29,16 +45,57 @@ extern "C" void main() {
     // Heap allocator
     kheap_init();
 
+    // Interrupt counters (on the heap, so counting starts here)
+    irqstat_init();
+
     // Multitasking scheduler (bootstraps current execution as task 0)
     task_init();
 
+    // FPU/SSE with lazy per-task state switching (needs the heap and task 0)
+    fpu_init();
+
+    // Deferred work worker for IRQ bottom halves
+    defer_init();
+
+    // Worker pool for blocking work (also reaps dead tasks)
+    work_init();
+
+    // High-resolution timer callbacks, driven from the timer interrupts
+    hrtimer_init();
+
+    // Ring 3: user-accessible code pages, int 0x80 and SYSENTER
+    user_init();
+    syscall_init();
+
+    // Interrupts (the AP startup delays below are timed by the PIT)
+    __asm__ volatile("sti");
+
+    // Firmware tables, then the APICs: the local APIC for IPIs and EOI, and
+    // the IOAPIC takes the ISA IRQs over from the 8259 if there is one
+    acpi_init();
+    if (lapic_init(acpi_get_platform()->lapic_base)) {
+        ioapic_init();
+    }
+
+    // High-resolution clock: TSC and LAPIC timer rates measured on the PIT
+    timer_calibrate();
+
+    // Wake the other CPUs; each one joins the scheduler with its own idle task
+    smp_init();
+
+    // Walk the PCI buses; drivers bind as they register
+    pci_init();
+
+    // Disk transfers sleep on IRQ14 from here on (fat16_init above polled)
+    ata_enable_irq();
+
     // Start shell (this clears screen and shows prompt)
     shell_init();
 
-    // Interrupts
-    __asm__ volatile("sti");
+    // The shell runs as its own task, fed by the keyboard IRQ's scancode ring
+    task_create(shell_task, "shell");
     
-    // Halt loop (god willing)
+    // Halt loop (god willing) - this is now the idle task
     while (1) {
         __asm__ volatile("hlt");
     }
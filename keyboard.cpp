@@ -1,7 +1,7 @@
 #include "keyboard.h"
 #include "isr.h"
 #include "ports.h"
-#include "shell.h"
+#include "sync.h"
 
 // Scan codes for special keys
 #define SC_LSHIFT     0x2A
@@ -35,67 +35,127 @@ static const char scancode_shifted[] = {
     '*', 0, ' '
 };
 
+// =============================================================================
+// Scancode ring
+//
+// Single producer (the IRQ1 handler) and single consumer (the shell task), so
+// the ring itself needs no lock: only the IRQ writes kbd_head, only the reader
+// writes kbd_tail, and x86 keeps stores in order. The IRQ does nothing but
+// read port 0x60 and push - all decoding and command execution happen in the
+// reader's task context with interrupts on.
+//
+// kbd_avail counts scancodes in the ring and is what the reader sleeps on.
+// =============================================================================
+
+#define KBD_RING_SIZE 128   // Must be a power of two
+#define KBD_RING_MASK (KBD_RING_SIZE - 1)
+
+static volatile uint8_t  kbd_ring[KBD_RING_SIZE];
+static volatile uint32_t kbd_head;      // Next slot to write (producer only)
+static volatile uint32_t kbd_tail;      // Next slot to read (consumer only)
+static volatile uint32_t kbd_dropped;   // Scancodes lost to a full ring
+static Semaphore kbd_avail = SEMAPHORE_INIT(0);
+
+static void kbd_ring_push(uint8_t scancode) {
+    uint32_t head = kbd_head;
+    if (head - kbd_tail == KBD_RING_SIZE) {
+        kbd_dropped++;
+        return;
+    }
+    kbd_ring[head & KBD_RING_MASK] = scancode;
+    __asm__ volatile("" : : : "memory");  // Publish data before the index
+    kbd_head = head + 1;
+    sem_post(&kbd_avail);
+}
+
+static uint8_t kbd_ring_pop() {
+    uint32_t tail = kbd_tail;
+    uint8_t scancode = kbd_ring[tail & KBD_RING_MASK];
+    __asm__ volatile("" : : : "memory");  // Read data before freeing the slot
+    kbd_tail = tail + 1;
+    return scancode;
+}
+
 static void keyboard_callback(registers_t* regs) {
     (void)regs;
-    uint8_t scancode = inb(0x60);
-    
+    kbd_ring_push(inb(0x60));
+}
+
+// =============================================================================
+// Scancode decoding (reader side)
+// =============================================================================
+
+// Update modifier state for one scancode and translate it.
+// Returns the key (ASCII or KEY_*), or 0 if the scancode produces no key.
+static uint8_t keyboard_decode(uint8_t scancode) {
     // Handle shift press/release
     if (scancode == SC_LSHIFT || scancode == SC_RSHIFT) {
         shift_pressed = true;
-        return;
+        return 0;
     }
     if (scancode == SC_LSHIFT_REL || scancode == SC_RSHIFT_REL) {
         shift_pressed = false;
-        return;
+        return 0;
     }
     
     // Handle caps lock (toggle on press only)
     if (scancode == SC_CAPSLOCK) {
         caps_on = !caps_on;
-        return;
+        return 0;
     }
     
+    // Key releases produce nothing
+    if (scancode & 0x80) {
+        return 0;
+    }
+
     // Handle arrow keys (extended scancodes)
-    if (!(scancode & 0x80)) { 
-        switch (scancode) {
-            case SC_UP:
-                shell_handle_key(KEY_UP);
-                return;
-            case SC_DOWN:
-                shell_handle_key(KEY_DOWN);
-                return;
-            case SC_LEFT:
-                shell_handle_key(KEY_LEFT);
-                return;
-            case SC_RIGHT:
-                shell_handle_key(KEY_RIGHT);
-                return;
-        }
-        
-        if (scancode < sizeof(scancode_normal)) {
-            char c;
-            bool use_shift = shift_pressed;
-            
-            // Caps lock affects only letters
-            if (caps_on && scancode_normal[scancode] >= 'a' && scancode_normal[scancode] <= 'z') {
-                use_shift = !use_shift;
-            }
-            
-            if (use_shift) {
-                c = scancode_shifted[scancode];
-            } else {
-                c = scancode_normal[scancode];
-            }
-            
-            if (c != 0) {
-                shell_handle_key(c);
-            }
-        }
+    switch (scancode) {
+        case SC_UP:    return KEY_UP;
+        case SC_DOWN:  return KEY_DOWN;
+        case SC_LEFT:  return KEY_LEFT;
+        case SC_RIGHT: return KEY_RIGHT;
+    }
+    
+    if (scancode >= sizeof(scancode_normal)) {
+        return 0;
+    }
+
+    bool use_shift = shift_pressed;
+    
+    // Caps lock affects only letters
+    if (caps_on && scancode_normal[scancode] >= 'a' && scancode_normal[scancode] <= 'z') {
+        use_shift = !use_shift;
+    }
+    
+    return (uint8_t)(use_shift ? scancode_shifted[scancode] : scancode_normal[scancode]);
+}
+
+uint8_t keyboard_getchar() {
+    while (1) {
+        sem_wait(&kbd_avail);
+        uint8_t key = keyboard_decode(kbd_ring_pop());
+        if (key) return key;
+    }
+}
+
+int keyboard_try_getchar() {
+    while (sem_trywait(&kbd_avail)) {
+        uint8_t key = keyboard_decode(kbd_ring_pop());
+        if (key) return key;
     }
+    return -1;
+}
+
+uint32_t keyboard_get_dropped() {
+    return kbd_dropped;
 }
 
 void keyboard_init() {
     shift_pressed = false;
     caps_on = false;
+    kbd_head = 0;
+    kbd_tail = 0;
+    kbd_dropped = 0;
     register_interrupt_handler(33, keyboard_callback);
 }
\ No newline at end of file
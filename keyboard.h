@@ -5,6 +5,17 @@
 
 void keyboard_init();
 
+// Block until a key is available and return it (ASCII or KEY_*).
+// Single reader only - the shell task. The reader sleeps until IRQ1 posts
+// a scancode and returns with its interrupt flag as it was on entry.
+uint8_t keyboard_getchar();
+
+// Non-blocking variant: returns the key, or -1 if none is pending
+int keyboard_try_getchar();
+
+// Scancodes dropped because the reader fell behind
+uint32_t keyboard_get_dropped();
+
 #define KEY_UP      0x80
 #define KEY_DOWN    0x81
 #define KEY_LEFT    0x82
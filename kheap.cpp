@@ -1,6 +1,7 @@
 #include "kheap.h"
 #include "pmm.h"
 #include "paging.h"
+#include "sync.h"
 
 // ============================================================================
 // Heap configuration
@@ -10,7 +11,7 @@
 // Physical frames are allocated from PMM and mapped into this range
 #define HEAP_START      0x400000
 #define HEAP_INITIAL_PAGES  4       // Start with 16KB
-#define HEAP_MAX_PAGES      256     // Max 1MB heap
+#define HEAP_MAX_PAGES      2048    // Max 8MB heap (4MB-12MB)
 
 // ============================================================================
 // Block header sits right before every allocation
@@ -36,6 +37,11 @@ static BlockHeader* heap_start_block;
 static uint32_t heap_vaddr_end;         // Next unmapped virtual address
 static uint32_t heap_pages_used;
 
+// Serializes every heap operation. A spinlock (not a mutex) because the
+// scheduler frees dead task stacks and the #NM handler allocates FPU areas
+// from interrupt context.
+static Spinlock heap_lock = SPINLOCK_INIT;
+
 // ============================================================================
 // Expand the heap by mapping more pages
 // ============================================================================
@@ -132,10 +138,10 @@ static void split_block(BlockHeader* block, uint32_t size) {
 }
 
 // ============================================================================
-// kmalloc: allocate size bytes
+// kmalloc: allocate size bytes (heap_lock held)
 // ============================================================================
 
-void* kmalloc(uint32_t size) {
+static void* kmalloc_locked(uint32_t size) {
     if (size == 0) {
         return 0;
     }
@@ -229,10 +235,10 @@ static void coalesce(BlockHeader* block) {
 }
 
 // ============================================================================
-// kfree: free a previously allocated pointer
+// kfree: free a previously allocated pointer (heap_lock held)
 // ============================================================================
 
-void kfree(void* ptr) {
+static void kfree_locked(void* ptr) {
     if (!ptr) {
         return;
     }
@@ -257,6 +263,23 @@ void kfree(void* ptr) {
     coalesce(block);
 }
 
+// ============================================================================
+// Locked entry points
+// ============================================================================
+
+void* kmalloc(uint32_t size) {
+    spin_lock(&heap_lock);
+    void* ptr = kmalloc_locked(size);
+    spin_unlock(&heap_lock);
+    return ptr;
+}
+
+void kfree(void* ptr) {
+    spin_lock(&heap_lock);
+    kfree_locked(ptr);
+    spin_unlock(&heap_lock);
+}
+
 // ============================================================================
 // Stats n stuff
 // ============================================================================
@@ -267,6 +290,7 @@ uint32_t kheap_get_total_bytes() {
 
 uint32_t kheap_get_used_bytes() {
     uint32_t used = 0;
+    spin_lock(&heap_lock);
     BlockHeader* current = heap_start_block;
     while (current) {
         if (!current->free) {
@@ -274,6 +298,7 @@ uint32_t kheap_get_used_bytes() {
         }
         current = current->next;
     }
+    spin_unlock(&heap_lock);
     return used;
 }
 
@@ -283,11 +308,13 @@ uint32_t kheap_get_free_bytes() {
 
 uint32_t kheap_get_block_count() {
     uint32_t count = 0;
+    spin_lock(&heap_lock);
     BlockHeader* current = heap_start_block;
     while (current) {
         count++;
         current = current->next;
     }
+    spin_unlock(&heap_lock);
     return count;
 }
 
@@ -301,6 +328,7 @@ void kheap_dump() {
     const char* hex = "0123456789ABCDEF";
 
     int row = 5;
+    spin_lock(&heap_lock);
     BlockHeader* current = heap_start_block;
     int block_num = 0;
 
@@ -338,4 +366,5 @@ void kheap_dump() {
         block_num++;
         current = current->next;
     }
+    spin_unlock(&heap_lock);
 }
\ No newline at end of file
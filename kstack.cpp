@@ -0,0 +1,128 @@
+#include "kstack.h"
+#include "paging.h"
+#include "pmm.h"
+#include "sync.h"
+
+// A pooled stack keeps its pages; the link lives in its lowest word
+struct FreeStack {
+    FreeStack* next;
+};
+
+static FreeStack* pool[2][KSTACK_MAX_PAGES + 1];   // [user][page count]
+static uint32_t next_vaddr = KSTACK_REGION_START;
+static uint32_t in_use = 0;
+static uint32_t pooled = 0;
+static uint32_t mapped_pages = 0;
+
+static Spinlock kstack_lock = SPINLOCK_INIT;
+
+static uint32_t size_to_pages(uint32_t size) {
+    return PAGE_ALIGN_UP(size) / PAGE_SIZE;
+}
+
+// Carve a fresh guard + stack slot out of the region and back the stack
+// part with frames. Lock held.
+static uint32_t carve(uint32_t pages, bool user) {
+    uint32_t base = next_vaddr + PAGE_SIZE;     // Guard page stays unmapped
+    uint32_t top  = base + pages * PAGE_SIZE;
+    if (top > KSTACK_REGION_END) return 0;
+
+    // Get every frame before mapping any, so running out leaves nothing
+    // half-built
+    void* frames[KSTACK_MAX_PAGES];
+    for (uint32_t i = 0; i < pages; i++) {
+        frames[i] = pmm_alloc_frame();
+        if (!frames[i]) {
+            while (i--) pmm_free_frame(frames[i]);
+            return 0;
+        }
+    }
+    uint32_t flags = PTE_PRESENT | PTE_WRITABLE | (user ? PTE_USER : 0);
+    for (uint32_t i = 0; i < pages; i++) {
+        map_page(base + i * PAGE_SIZE, (uint32_t)frames[i], flags);
+    }
+
+    next_vaddr = top;
+    mapped_pages += pages;
+    return base;
+}
+
+static uint32_t alloc(uint32_t size, bool user) {
+    uint32_t pages = size_to_pages(size);
+    if (pages == 0 || pages > KSTACK_MAX_PAGES) return 0;
+
+    spin_lock(&kstack_lock);
+    uint32_t base = 0;
+    FreeStack* s = pool[user][pages];
+    if (s) {
+        pool[user][pages] = s->next;
+        pooled--;
+        base = (uint32_t)s;
+    } else {
+        base = carve(pages, user);
+    }
+    if (base) in_use++;
+    spin_unlock(&kstack_lock);
+    return base;
+}
+
+static void release(uint32_t base, uint32_t size, bool user) {
+    uint32_t pages = size_to_pages(size);
+    if (!base || pages == 0 || pages > KSTACK_MAX_PAGES) return;
+
+    spin_lock(&kstack_lock);
+    FreeStack* s = (FreeStack*)base;
+    s->next = pool[user][pages];
+    pool[user][pages] = s;
+    pooled++;
+    in_use--;
+    spin_unlock(&kstack_lock);
+}
+
+uint32_t kstack_alloc(uint32_t size) {
+    return alloc(size, false);
+}
+
+void kstack_free(uint32_t base, uint32_t size) {
+    release(base, size, false);
+}
+
+uint32_t kstack_alloc_user(uint32_t size) {
+    return alloc(size, true);
+}
+
+void kstack_free_user(uint32_t base, uint32_t size) {
+    release(base, size, true);
+}
+
+void kstack_paint(uint32_t base, uint32_t size) {
+    uint32_t* p = (uint32_t*)base;
+    for (uint32_t i = 0; i < size / 4; i++) {
+        p[i] = KSTACK_CANARY;
+    }
+}
+
+uint32_t kstack_peak(uint32_t base, uint32_t size) {
+    // Stacks grow down, so the untouched part is at the bottom
+    uint32_t* p = (uint32_t*)base;
+    uint32_t words = size / 4;
+    uint32_t i = 0;
+    while (i < words && p[i] == KSTACK_CANARY) i++;
+    return (words - i) * 4;
+}
+
+uint32_t kstack_get_in_use() {
+    return in_use;
+}
+
+uint32_t kstack_get_pooled() {
+    return pooled;
+}
+
+uint32_t kstack_get_mapped_pages() {
+    return mapped_pages;
+}
+
+uint32_t kstack_get_region_used() {
+    return next_vaddr - KSTACK_REGION_START;
+}
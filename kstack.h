@@ -0,0 +1,55 @@
+#ifndef KSTACK_H
+#define KSTACK_H
+
+#include <stdint.h>
+#include "paging.h"
+
+// =============================================================================
+// Kernel stack allocator
+//
+// Task stacks live in their own virtual region rather than on the heap.
+// Every stack sits directly above an unmapped guard page, so running off the
+// bottom faults instead of trampling whatever was allocated below. Freed
+// stacks keep their pages mapped and go into a pool per size, so creating
+// and reaping tasks does not churn the page tables (and never needs a TLB
+// shootdown on other CPUs). Ring-3 stacks come from the same region but are
+// mapped user-accessible, so they have a pool of their own and are never
+// handed out as kernel stacks.
+// =============================================================================
+
+#define KSTACK_REGION_START 0xC00000    // Right after the heap (4MB-12MB)
+#define KSTACK_REGION_END   KERNEL_VIRTUAL_END  // 48MB: 6144 one-page stacks
+#define KSTACK_MAX_PAGES    16          // 64KB per stack at most
+#define KSTACK_CANARY       0xCAFED00D  // Fill pattern for never-touched words
+
+// Allocate a stack of at least 'size' bytes (whole pages). Returns its
+// lowest usable address - the guard page is just below - or 0.
+uint32_t kstack_alloc(uint32_t size);
+
+// Return a stack to the pool (size as passed to kstack_alloc)
+void     kstack_free(uint32_t base, uint32_t size);
+
+// Same for user-mode stacks (PTE_USER)
+uint32_t kstack_alloc_user(uint32_t size);
+void     kstack_free_user(uint32_t base, uint32_t size);
+
+// Fill a stack with KSTACK_CANARY, so kstack_peak can later tell how deep
+// it ever got
+void     kstack_paint(uint32_t base, uint32_t size);
+
+// Deepest use of a painted stack in bytes: everything from the top down to
+// the lowest word that no longer holds the canary
+uint32_t kstack_peak(uint32_t base, uint32_t size);
+
+// 'addr' lies in the guard page below the stack at 'base'
+static inline bool kstack_in_guard(uint32_t base, uint32_t addr) {
+    return base && addr < base && addr >= base - 4096;
+}
+
+// Stats
+uint32_t kstack_get_in_use();          // Stacks handed out
+uint32_t kstack_get_pooled();          // Stacks waiting in the free pool
+uint32_t kstack_get_mapped_pages();    // Pages backing both
+uint32_t kstack_get_region_used();     // Bytes of the region carved up so far
+
+#endif
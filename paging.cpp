@@ -1,6 +1,11 @@
 #include "paging.h"
 #include "isr.h"
 #include "pmm.h"
+#include "idt.h"
+#include "gdt.h"
+#include "task.h"
+#include "percpu.h"
+#include "user.h"
 
 // Page directory - allocated from PMM during init
 static uint32_t* page_directory;
@@ -28,6 +33,37 @@ static void vga_print_hex_at(int row, int col, uint32_t val, uint8_t color) {
     vga_print_at(row, col, buf, color);
 }
 
+// Returns the number of digits printed
+static int vga_print_dec_at(int row, int col, uint32_t val, uint8_t color) {
+    char buf[11];
+    int i = 10;
+    buf[i] = 0;
+    do {
+        buf[--i] = '0' + val % 10;
+        val /= 10;
+    } while (val);
+    vga_print_at(row, col, &buf[i], color);
+    return 10 - i;
+}
+
+static void vga_clear_rows(int first, int last) {
+    for (int i = 80 * first; i < 80 * (last + 1); i++) {
+        vga[i] = (0x0C << 8) | ' ';
+    }
+}
+
+// "Stack overflow in task N (name)" on 'row'
+static void print_stack_overflow(int row, Task* t) {
+    const char* name = t->name ? t->name : "?";
+    vga_print_at(row, 0, "Stack overflow in task ", 0x0C);
+    int col = 23 + vga_print_dec_at(row, 23, t->id, 0x0E);
+    vga_print_at(row, col, " (", 0x0C);
+    col += 2;
+    vga_print_at(row, col, name, 0x0E);
+    while (*name++) col++;
+    vga_print_at(row, col, ")", 0x0C);
+}
+
 // ============================================================================
 // Page fault handler (ISR 14)
 // ============================================================================
@@ -42,12 +78,23 @@ static void page_fault_handler(registers_t* regs) {
     // bit 1: 0 = read, 1 = write
     // bit 2: 0 = kernel mode, 1 = user mode
 
-    // Panic with debug info
-    for (int i = 80 * 10; i < 80 * 16; i++) {
-        vga[i] = (0x0C << 8) | ' ';
+    // A user task only takes itself down
+    if (err & 4) {
+        user_fault(regs, faulting_addr);
+        return;
     }
 
-    vga_print_at(10, 0, "=== PAGE FAULT ===", 0x4F);
+    // Panic with debug info
+    vga_clear_rows(10, 16);
+
+    // Touching a guard page means some task ran off the bottom of its stack
+    Task* overflowed = task_find_stack_guard(faulting_addr);
+    if (overflowed) {
+        vga_print_at(10, 0, "=== STACK OVERFLOW ===", 0x4F);
+        print_stack_overflow(16, overflowed);
+    } else {
+        vga_print_at(10, 0, "=== PAGE FAULT ===", 0x4F);
+    }
 
     vga_print_at(11, 0, "Faulting address: ", 0x0C);
     vga_print_hex_at(11, 18, faulting_addr, 0x0E);
@@ -63,6 +110,53 @@ static void page_fault_handler(registers_t* regs) {
     __asm__ volatile("cli; hlt");
 }
 
+// ============================================================================
+// Double fault task (vector 8, task gate)
+//
+// A task that overflows its stack faults on the guard page, and the CPU then
+// has nowhere to push the page fault frame - it faults again, which is a
+// double fault. An ordinary gate would hit the same wall and triple fault,
+// so vector 8 is a task gate: the CPU saves the broken state into the
+// current CPU's TSS and switches to a fresh one with its own stack.
+// ============================================================================
+
+static uint8_t double_fault_stack[4096] __attribute__((aligned(16)));
+
+static void double_fault_task() {
+    uint32_t faulting_addr;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(faulting_addr));
+
+    vga_clear_rows(10, 16);
+
+    // The faulting CPU's TSS holds the state at the time of the fault
+    int cpu = gdt_double_fault_cpu();
+    Task* t = task_find_stack_guard(faulting_addr);
+    if (!t && cpu >= 0) t = task_find_stack_guard(cpu_tss[cpu].esp);
+
+    if (t) {
+        vga_print_at(10, 0, "=== STACK OVERFLOW ===", 0x4F);
+        print_stack_overflow(16, t);
+    } else {
+        vga_print_at(10, 0, "=== DOUBLE FAULT ===", 0x4F);
+    }
+
+    vga_print_at(11, 0, "Faulting address: ", 0x0C);
+    vga_print_hex_at(11, 18, faulting_addr, 0x0E);
+    if (cpu >= 0) {
+        vga_print_at(12, 0, "EIP: ", 0x0C);
+        vga_print_hex_at(12, 5, cpu_tss[cpu].eip, 0x0E);
+        vga_print_at(13, 0, "ESP: ", 0x0C);
+        vga_print_hex_at(13, 5, cpu_tss[cpu].esp, 0x0E);
+        vga_print_at(14, 0, "CPU: ", 0x0C);
+        vga_print_dec_at(14, 5, cpu, 0x0E);
+    }
+
+    // Halt - a task switch back would just fault again
+    for (;;) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
 // ============================================================================
 // Allocate a zeroed page from PMM (for page tables)
 // ============================================================================
@@ -96,12 +190,18 @@ void map_page(uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags) {
         uint32_t* new_table = alloc_page_table();
         page_directory[pde_idx] = (uint32_t)new_table | PTE_PRESENT | PTE_WRITABLE;
     }
+    if (flags & PTE_USER) {
+        page_directory[pde_idx] |= PTE_USER;
+    }
 
     // Get the page table address (mask off the flags in lower 12 bits)
     uint32_t* page_table = (uint32_t*)(page_directory[pde_idx] & 0xFFFFF000);
 
     // Set the page table entry
     page_table[pte_idx] = PAGE_ALIGN_DOWN(physical_addr) | (flags & 0xFFF);
+
+    // Drop any stale translation (harmless before paging is on)
+    __asm__ volatile("invlpg (%0)" : : "r"(virtual_addr) : "memory");
 }
 
 // ============================================================================
@@ -117,6 +217,25 @@ static void identity_map_range(uint32_t start, uint32_t end, uint32_t flags) {
     }
 }
 
+void map_identity(uint32_t phys_addr, uint32_t size, uint32_t flags) {
+    identity_map_range(phys_addr, phys_addr + size, flags);
+}
+
+bool paging_user_range(uint32_t addr, uint32_t len) {
+    if (len == 0) return true;
+    if (addr + len < addr) return false;   // Wraps around
+
+    const uint32_t need = PTE_PRESENT | PTE_USER;
+    for (uint32_t page = PAGE_ALIGN_DOWN(addr); page < addr + len; page += PAGE_SIZE) {
+        uint32_t pde = page_directory[PDE_INDEX(page)];
+        if ((pde & need) != need) return false;
+        uint32_t* table = (uint32_t*)(pde & 0xFFFFF000);
+        if ((table[PTE_INDEX(page)] & need) != need) return false;
+        if (page + PAGE_SIZE < page) break;    // Last page of the address space
+    }
+    return true;
+}
+
 // ============================================================================
 // Initialize paging
 // ============================================================================
@@ -142,6 +261,13 @@ void paging_init() {
     // PMM allocates from above 1MB, so we need to map those frames too
     map_page((uint32_t)page_directory, (uint32_t)page_directory, PTE_PRESENT | PTE_WRITABLE);
 
+    // Page tables are reached through their physical address, so they must
+    // come from the identity mapped 4MB. Create the heap and stack region's
+    // tables now, while that is still mostly free.
+    for (uint32_t addr = IDENTITY_MAPPED_END; addr < KERNEL_VIRTUAL_END; addr += 0x400000) {
+        page_directory[PDE_INDEX(addr)] = (uint32_t)alloc_page_table() | PTE_PRESENT | PTE_WRITABLE;
+    }
+
     // Map all page tables that were allocated during identity_map_range
     for (int i = 0; i < 1024; i++) {
         if (page_directory[i] & PTE_PRESENT) {
@@ -163,4 +289,10 @@ void paging_init() {
         : "r"(page_directory)
         : "eax"
     );
+
+    // Double faults switch to their own task and stack (see above), which
+    // picks up the page directory we just loaded
+    gdt_set_double_fault_task(double_fault_task,
+                              (uint32_t)(double_fault_stack + sizeof(double_fault_stack)));
+    idt_set_gate(8, 0, GDT_DOUBLE_FAULT_TSS, IDT_TASK_GATE);
 }
\ No newline at end of file
@@ -26,7 +26,24 @@
 #define PDE_INDEX(vaddr) (((vaddr) >> 22) & 0x3FF)  // Top 10 bits
 #define PTE_INDEX(vaddr) (((vaddr) >> 12) & 0x3FF)  // Middle 10 bits
 
+// Kernel virtual layout: the first 4MB are identity mapped, the kernel heap
+// and the task stack region (kheap.cpp, kstack.h) follow up to
+// KERNEL_VIRTUAL_END. Firmware tables and MMIO get identity mapped on
+// demand, which only works above that.
+#define IDENTITY_MAPPED_END 0x400000
+#define KERNEL_VIRTUAL_END  0x3C00000
+
 void paging_init();
+
+// Map one page. With PTE_USER the covering page directory entry is opened
+// to ring 3 as well - its other pages stay kernel-only through their own PTEs.
 void map_page(uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags);
 
+// Every page of [addr, addr + len) is present and user-accessible - what a
+// system call checks before touching a pointer it was handed
+bool paging_user_range(uint32_t addr, uint32_t len);
+
+// Identity map [phys_addr, phys_addr + size) - MMIO registers, firmware tables
+void map_identity(uint32_t phys_addr, uint32_t size, uint32_t flags);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,289 @@
+#include "pci.h"
+#include "ports.h"
+#include "paging.h"
+#include "sync.h"
+#include "cpu.h"
+
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+#define PCI_CONFIG_ENABLE   0x80000000
+
+static PciDevice devices[PCI_MAX_DEVICES];
+static int device_count = 0;
+static uint32_t devices_dropped = 0;     // Found with the table already full
+
+static const PciDriver* drivers[PCI_MAX_DRIVERS];
+static int driver_count = 0;
+static bool enumerated = false;
+
+// The address/data pair is one shared register window
+static Spinlock pci_lock = SPINLOCK_INIT;
+
+// =============================================================================
+// Configuration space
+// =============================================================================
+
+static uint32_t config_address(uint8_t bus, uint8_t dev, uint8_t fn, uint8_t offset) {
+    return PCI_CONFIG_ENABLE | (bus << 16) | ((dev & 0x1F) << 11) | ((fn & 0x07) << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_config_read(uint8_t bus, uint8_t dev, uint8_t fn, uint8_t offset) {
+    spin_lock(&pci_lock);
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, dev, fn, offset));
+    uint32_t value = inl(PCI_CONFIG_DATA);
+    spin_unlock(&pci_lock);
+    return value;
+}
+
+void pci_config_write(uint8_t bus, uint8_t dev, uint8_t fn, uint8_t offset, uint32_t value) {
+    spin_lock(&pci_lock);
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, dev, fn, offset));
+    outl(PCI_CONFIG_DATA, value);
+    spin_unlock(&pci_lock);
+}
+
+static uint16_t read_vendor(uint8_t bus, uint8_t dev, uint8_t fn) {
+    return pci_config_read(bus, dev, fn, PCI_VENDOR_ID) & 0xFFFF;
+}
+
+static uint8_t read_header_type(uint8_t bus, uint8_t dev, uint8_t fn) {
+    return (pci_config_read(bus, dev, fn, PCI_HEADER_TYPE) >> 16) & 0xFF;
+}
+
+// Mechanism #1 is there if the address register keeps what was written
+static bool mechanism1_present() {
+    spin_lock(&pci_lock);
+    uint32_t saved = inl(PCI_CONFIG_ADDRESS);
+    outl(PCI_CONFIG_ADDRESS, PCI_CONFIG_ENABLE);
+    bool present = inl(PCI_CONFIG_ADDRESS) == PCI_CONFIG_ENABLE;
+    outl(PCI_CONFIG_ADDRESS, saved);
+    spin_unlock(&pci_lock);
+    return present;
+}
+
+// =============================================================================
+// Enumeration
+// =============================================================================
+
+// Write all-ones to each BAR, read back which address bits stick, restore.
+// Decoding is off meanwhile so the half-written BAR never claims anything -
+// except on host bridges, which may not like losing it.
+static void size_bars(PciDevice* d) {
+    int count = 0;
+    if ((d->header_type & 0x7F) == 0) count = 6;
+    else if ((d->header_type & 0x7F) == 1) count = 2;
+    if (!count) return;
+
+    bool host = d->class_code == 0x06 && d->subclass == 0x00;
+    uint32_t flags = irq_save();
+    uint32_t cmd = pci_config_read(d->bus, d->dev, d->fn, PCI_COMMAND) & 0xFFFF;
+    if (!host) {
+        pci_config_write(d->bus, d->dev, d->fn, PCI_COMMAND, cmd & ~(PCI_CMD_IO | PCI_CMD_MEMORY));
+    }
+
+    for (int i = 0; i < count; i++) {
+        uint8_t offset = PCI_BAR0 + i * 4;
+        uint32_t orig = pci_config_read(d->bus, d->dev, d->fn, offset);
+        pci_config_write(d->bus, d->dev, d->fn, offset, 0xFFFFFFFF);
+        uint32_t mask = pci_config_read(d->bus, d->dev, d->fn, offset);
+        pci_config_write(d->bus, d->dev, d->fn, offset, orig);
+
+        PciBar* bar = &d->bar[i];
+        if (orig & 1) {
+            // I/O: the top half may read back as zero, ports are 16 bits
+            bar->io   = true;
+            bar->base = orig & 0xFFFC;
+            uint32_t m = mask & 0xFFFC;
+            bar->size = m ? (~(m | 0xFFFF0000)) + 1 : 0;
+        } else {
+            bar->prefetchable = (orig & 0x08) != 0;
+            bar->base = orig & 0xFFFFFFF0;
+            uint32_t m = mask & 0xFFFFFFF0;
+            bar->size = m ? ~m + 1 : 0;
+
+            // 64-bit: the next BAR is the upper half. Usable only while
+            // that is zero.
+            if (((orig >> 1) & 3) == 2 && i + 1 < count) {
+                i++;
+                if (pci_config_read(d->bus, d->dev, d->fn, PCI_BAR0 + i * 4)) {
+                    bar->above_4g = true;
+                }
+            }
+        }
+    }
+
+    if (!host) pci_config_write(d->bus, d->dev, d->fn, PCI_COMMAND, cmd);
+    irq_restore(flags);
+}
+
+static void scan_bus(uint8_t bus);
+
+static void scan_function(uint8_t bus, uint8_t dev, uint8_t fn) {
+    uint32_t id = pci_config_read(bus, dev, fn, PCI_VENDOR_ID);
+    if ((id & 0xFFFF) == 0xFFFF) return;
+    if (device_count == PCI_MAX_DEVICES) {
+        devices_dropped++;
+        return;
+    }
+
+    PciDevice* d = &devices[device_count++];
+    d->bus       = bus;
+    d->dev       = dev;
+    d->fn        = fn;
+    d->vendor_id = id & 0xFFFF;
+    d->device_id = id >> 16;
+
+    uint32_t class_rev = pci_config_read(bus, dev, fn, PCI_CLASS_REV);
+    d->class_code  = class_rev >> 24;
+    d->subclass    = (class_rev >> 16) & 0xFF;
+    d->prog_if     = (class_rev >> 8) & 0xFF;
+    d->revision    = class_rev & 0xFF;
+    d->header_type = read_header_type(bus, dev, fn);
+    d->irq_line    = pci_config_read(bus, dev, fn, PCI_INTERRUPT_LINE) & 0xFF;
+    d->driver      = 0;
+    size_bars(d);
+
+    // A PCI-to-PCI bridge: walk the bus behind it. Secondary numbers only
+    // go up, which also keeps a misconfigured bridge from looping.
+    if ((d->header_type & 0x7F) == 1 &&
+        ((d->class_code << 8) | d->subclass) == PCI_CLASS_BRIDGE_PCI) {
+        uint8_t secondary = (pci_config_read(bus, dev, fn, PCI_SECONDARY_BUS & 0xFC) >> 8) & 0xFF;
+        if (secondary > bus) scan_bus(secondary);
+    }
+}
+
+static void scan_bus(uint8_t bus) {
+    for (uint8_t dev = 0; dev < 32; dev++) {
+        if (read_vendor(bus, dev, 0) == 0xFFFF) continue;
+        scan_function(bus, dev, 0);
+
+        // Multi-function device: functions 1-7 may be there too
+        if (read_header_type(bus, dev, 0) & 0x80) {
+            for (uint8_t fn = 1; fn < 8; fn++) {
+                scan_function(bus, dev, fn);
+            }
+        }
+    }
+}
+
+// =============================================================================
+// Drivers
+// =============================================================================
+
+static bool driver_matches(const PciDriver* drv, const PciDevice* d) {
+    if (drv->vendor_id  != PCI_ANY_ID    && drv->vendor_id  != d->vendor_id)  return false;
+    if (drv->device_id  != PCI_ANY_ID    && drv->device_id  != d->device_id)  return false;
+    if (drv->class_code != PCI_ANY_CLASS && drv->class_code != d->class_code) return false;
+    if (drv->subclass   != PCI_ANY_CLASS && drv->subclass   != d->subclass)   return false;
+    return true;
+}
+
+// Offer a driver every unclaimed device it matches
+static void bind_driver(const PciDriver* drv) {
+    for (int i = 0; i < device_count; i++) {
+        PciDevice* d = &devices[i];
+        if (d->driver || !driver_matches(drv, d)) continue;
+        if (!drv->probe || drv->probe(d)) d->driver = drv;
+    }
+}
+
+// =============================================================================
+// Public API
+// =============================================================================
+
+void pci_init() {
+    if (mechanism1_present()) {
+        // A multi-function host bridge means one host controller per
+        // function, each with its own root bus
+        if (read_header_type(0, 0, 0) & 0x80) {
+            for (uint8_t fn = 0; fn < 8; fn++) {
+                if (read_vendor(0, 0, fn) != 0xFFFF) scan_bus(fn);
+            }
+        } else {
+            scan_bus(0);
+        }
+    }
+
+    enumerated = true;
+    for (int i = 0; i < driver_count; i++) {
+        bind_driver(drivers[i]);
+    }
+}
+
+void pci_register_driver(const PciDriver* driver) {
+    if (driver_count == PCI_MAX_DRIVERS) return;
+    drivers[driver_count++] = driver;
+    if (enumerated) bind_driver(driver);
+}
+
+void pci_enable(PciDevice* dev, uint16_t cmd_bits) {
+    uint32_t cmd = pci_config_read(dev->bus, dev->dev, dev->fn, PCI_COMMAND) & 0xFFFF;
+    // Only the command half: status bits are write-1-to-clear
+    pci_config_write(dev->bus, dev->dev, dev->fn, PCI_COMMAND, cmd | cmd_bits);
+}
+
+volatile void* pci_map_bar(PciDevice* dev, int index) {
+    if (index < 0 || index >= 6) return 0;
+    PciBar* bar = &dev->bar[index];
+    if (bar->io || bar->above_4g || !bar->base || !bar->size) return 0;
+
+    uint32_t end = bar->base + bar->size;
+    if (end < bar->base) return 0;                       // Runs past 4GB
+    // Heap and task stacks sit in between, virtually (same rule as ACPI)
+    if (bar->base < KERNEL_VIRTUAL_END && end > IDENTITY_MAPPED_END) return 0;
+
+    map_identity(bar->base, bar->size, PTE_PRESENT | PTE_WRITABLE | PTE_NOCACHE);
+    return (volatile void*)bar->base;
+}
+
+int pci_get_device_count() {
+    return device_count;
+}
+
+PciDevice* pci_get_device(int index) {
+    if (index < 0 || index >= device_count) return 0;
+    return &devices[index];
+}
+
+uint32_t pci_get_dropped_count() {
+    return devices_dropped;
+}
+
+struct PciClassName {
+    uint8_t     class_code;
+    uint8_t     subclass;      // PCI_ANY_CLASS = the whole class
+    const char* name;
+};
+
+static const PciClassName class_names[] = {
+    { 0x01, 0x00, "SCSI controller" },
+    { 0x01, 0x01, "IDE controller" },
+    { 0x01, 0x06, "SATA controller" },
+    { 0x01, 0x08, "NVMe controller" },
+    { 0x01, PCI_ANY_CLASS, "Storage controller" },
+    { 0x02, 0x00, "Ethernet controller" },
+    { 0x02, PCI_ANY_CLASS, "Network controller" },
+    { 0x03, 0x00, "VGA controller" },
+    { 0x03, PCI_ANY_CLASS, "Display controller" },
+    { 0x04, PCI_ANY_CLASS, "Multimedia device" },
+    { 0x05, PCI_ANY_CLASS, "Memory controller" },
+    { 0x06, 0x00, "Host bridge" },
+    { 0x06, 0x01, "ISA bridge" },
+    { 0x06, 0x04, "PCI bridge" },
+    { 0x06, PCI_ANY_CLASS, "Bridge" },
+    { 0x07, PCI_ANY_CLASS, "Communication controller" },
+    { 0x08, PCI_ANY_CLASS, "System peripheral" },
+    { 0x0C, 0x03, "USB controller" },
+    { 0x0C, 0x05, "SMBus controller" },
+    { 0x0C, PCI_ANY_CLASS, "Serial bus controller" },
+};
+
+const char* pci_class_name(uint8_t class_code, uint8_t subclass) {
+    for (uint32_t i = 0; i < sizeof(class_names) / sizeof(class_names[0]); i++) {
+        const PciClassName* c = &class_names[i];
+        if (c->class_code == class_code && (c->subclass == PCI_ANY_CLASS || c->subclass == subclass)) {
+            return c->name;
+        }
+    }
+    return "Unknown device";
+}
@@ -0,0 +1,103 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+// =============================================================================
+// PCI
+//
+// Configuration space through mechanism #1 (address at 0xCF8, data at
+// 0xCFC). pci_init walks the bus tree from bus 0 through PCI-to-PCI
+// bridges and records every function with its BARs sized. Drivers register
+// a match on vendor/device and/or class; each matching device that nobody
+// has claimed yet is offered to the driver's probe, at registration or at
+// pci_init, whichever comes later. Enumeration and binding are boot-time
+// only; config space accesses themselves are serialized and safe anywhere.
+// =============================================================================
+
+#define PCI_MAX_DEVICES 32
+#define PCI_MAX_DRIVERS 8
+
+// Wildcards for PciDriver matches
+#define PCI_ANY_ID      0xFFFF
+#define PCI_ANY_CLASS   0xFF
+
+// Config space offsets
+#define PCI_VENDOR_ID   0x00
+#define PCI_COMMAND     0x04
+#define PCI_CLASS_REV   0x08    // Class, subclass, prog IF, revision
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0        0x10
+#define PCI_SECONDARY_BUS 0x19  // Bridges (header type 1)
+#define PCI_INTERRUPT_LINE 0x3C
+
+// Command register bits
+#define PCI_CMD_IO        0x0001
+#define PCI_CMD_MEMORY    0x0002
+#define PCI_CMD_BUSMASTER 0x0004
+
+// A few classes (class << 8 | subclass)
+#define PCI_CLASS_IDE     0x0101
+#define PCI_CLASS_SATA    0x0106
+#define PCI_CLASS_BRIDGE_PCI 0x0604
+
+struct PciBar {
+    uint32_t base;           // I/O port or physical address, 0 = unused
+    uint32_t size;
+    bool     io;
+    bool     prefetchable;
+    bool     above_4g;       // 64-bit BAR placed out of reach - unusable
+};
+
+struct PciDriver;
+
+struct PciDevice {
+    uint8_t          bus, dev, fn;
+    uint16_t         vendor_id;
+    uint16_t         device_id;
+    uint8_t          class_code;
+    uint8_t          subclass;
+    uint8_t          prog_if;
+    uint8_t          revision;
+    uint8_t          header_type;    // Low 7 bits: 0 device, 1 bridge
+    uint8_t          irq_line;       // Legacy IRQ the firmware routed it to, 0xFF = none
+    PciBar           bar[6];         // Header type 0 has six, bridges two
+    const PciDriver* driver;         // Claimed by, or 0
+};
+
+struct PciDriver {
+    const char* name;
+    uint16_t    vendor_id;           // PCI_ANY_ID matches any
+    uint16_t    device_id;
+    uint8_t     class_code;          // PCI_ANY_CLASS matches any
+    uint8_t     subclass;
+    bool        (*probe)(PciDevice* dev);   // True = claimed
+};
+
+// Enumerate every bus. BARs are sized here but only mapped when a driver
+// asks (pci_map_bar).
+void pci_init();
+
+// Raw config space access - whole dwords, 'offset' rounded down to one
+uint32_t pci_config_read(uint8_t bus, uint8_t dev, uint8_t fn, uint8_t offset);
+void     pci_config_write(uint8_t bus, uint8_t dev, uint8_t fn, uint8_t offset, uint32_t value);
+
+// Add a driver to the table and offer it the devices found so far
+void pci_register_driver(const PciDriver* driver);
+
+// Turn on decoding and/or bus mastering (PCI_CMD_* bits) for a device
+void pci_enable(PciDevice* dev, uint16_t cmd_bits);
+
+// Identity map a memory BAR uncached and return it - 0 for I/O BARs and
+// ones that cannot be identity mapped (they overlap the heap or stacks)
+volatile void* pci_map_bar(PciDevice* dev, int index);
+
+// Found devices
+int        pci_get_device_count();
+PciDevice* pci_get_device(int index);
+const char* pci_class_name(uint8_t class_code, uint8_t subclass);
+
+// Functions that did not fit in the device table
+uint32_t pci_get_dropped_count();
+
+#endif
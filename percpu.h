@@ -0,0 +1,73 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stdint.h>
+#include "task.h"
+#include "cpu.h"
+
+// =============================================================================
+// Per-CPU data
+//
+// Each CPU's GS selector points at its own GDT descriptor whose base is that
+// CPU's PerCpu block (see gdt.cpp), so this_cpu() is a single %gs-relative
+// load no matter which CPU runs it. Only the owning CPU writes most fields;
+// the run queue is shared with work stealing and is guarded by the
+// scheduler lock in task.cpp.
+// =============================================================================
+
+#define SMP_MAX_CPUS 8
+
+struct PerCpu {
+    PerCpu*           self;          // Must stay first: this_cpu() reads %gs:0
+    volatile uint32_t irq_depth;     // Handlers running right now. Must stay
+                                     // second: the fast IRQ stubs use %gs:4
+    uint32_t          id;            // Logical CPU number, 0 = bootstrap CPU
+    uint32_t          apic_id;
+    volatile bool     online;
+
+    // Scheduler
+    Task*             current;
+    Task*             idle;          // Never queued, runs when nothing else can
+    TaskQueue         ready_queue;
+    uint32_t          nr_ready;
+    volatile bool     need_resched;
+
+    volatile uint32_t bottom_half_active;   // See isr.cpp
+    uint32_t          irq_level;     // Priority of the innermost running handler, 0 = none
+    uint16_t          irq_pending;   // ISA IRQs held off by irq_level, to run when it drops
+    Task*             fpu_owner;     // Task whose FPU state is in this CPU's registers
+
+    // Interrupt entry probe (bench sched): a task spinning on this CPU arms
+    // it, and the next interrupt stamps its vector and entry TSC and disarms
+    volatile uint32_t irq_probe_armed;
+    uint32_t          irq_probe_vector;
+    uint64_t          irq_probe_tsc;
+
+    // Stats
+    uint32_t          local_ticks;   // Timer interrupts taken on this CPU
+    uint32_t          resched_ipis;  // Reschedule IPIs received
+    uint32_t          steals;        // READY tasks pulled from other CPUs
+};
+
+extern PerCpu cpus[SMP_MAX_CPUS];
+
+// volatile: a task can migrate at any schedule point, so the compiler must
+// never reuse the result across calls
+static inline PerCpu* this_cpu() {
+    PerCpu* cpu;
+    __asm__ volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// Feed this CPU's entry probe if armed - first thing in an interrupt
+// handler, so the stamp covers just the entry path
+static inline void irq_entry_probe(uint32_t vector) {
+    PerCpu* cpu = this_cpu();
+    if (cpu->irq_probe_armed) {
+        cpu->irq_probe_tsc    = rdtsc();
+        cpu->irq_probe_vector = vector;
+        cpu->irq_probe_armed  = 0;
+    }
+}
+
+#endif
@@ -1,3 +1,4 @@
+#include "pic.h"
 #include "ports.h"
 
 #define PIC1_COMMAND 0x20
@@ -39,4 +40,34 @@ void pic_remap() {
     // Enable only keyboard (IRQ1) for now
     outb(PIC1_DATA, 0xFC); // Now timer and keyboard - 11111100  - she still bi on my nary
     outb(PIC2_DATA, 0xFF);  // All disabled
+}
+
+uint16_t pic_get_mask() {
+    return (uint16_t)(inb(PIC2_DATA) << 8) | inb(PIC1_DATA);
+}
+
+void pic_set_masked(uint8_t irq, bool masked) {
+    uint16_t port = PIC1_DATA;
+    if (irq >= 8) {
+        // Slave lines only get through with the cascade (IRQ2) open
+        if (!masked) pic_set_masked(2, false);
+        port = PIC2_DATA;
+        irq -= 8;
+    }
+    uint8_t mask = inb(port);
+    if (masked) mask |= (1 << irq);
+    else        mask &= ~(1 << irq);
+    outb(port, mask);
+}
+
+uint16_t pic_get_isr() {
+    // OCW3: the next command port read returns the ISR instead of the IRR
+    outb(PIC1_COMMAND, 0x0B);
+    outb(PIC2_COMMAND, 0x0B);
+    return (uint16_t)(inb(PIC2_COMMAND) << 8) | inb(PIC1_COMMAND);
+}
+
+void pic_disable() {
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
 }
\ No newline at end of file
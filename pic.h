@@ -1,6 +1,18 @@
 #ifndef PIC_H
 #define PIC_H
 
+#include <stdint.h>
+
 void pic_remap();
 
+// IRQ mask, one bit per line (bit set = masked); slave lines are 8-15
+uint16_t pic_get_mask();
+void pic_set_masked(uint8_t irq, bool masked);
+
+// In-service register, one bit per line being handled (not yet EOI'd)
+uint16_t pic_get_isr();
+
+// Mask every line - the IOAPIC has taken over
+void pic_disable();
+
 #endif
\ No newline at end of file
@@ -2,8 +2,9 @@
 #include "vga.h"
 
 
-// Bitmap lives at 0x20000 — past IDT (0x10000) and descriptor (0x10800)
-#define BITMAP_ADDR 0x20000
+// Bitmap lives at 0x80000 — above the kernel image (0x10000-0x3FFFF) and
+// below the boot stack at 0x90000
+#define BITMAP_ADDR 0x80000
 
 // Max 256MB support. 256MB / 4KB = 65536 frames = 8KB bitmap for nowish
 #define MAX_MEMORY    (256 * 1024 * 1024)
@@ -104,6 +105,27 @@ void* pmm_alloc_frame() {
     return nullptr;  // Out of memory
 }
 
+void* pmm_alloc_contiguous(uint32_t count, uint32_t limit) {
+    if (count == 0) return nullptr;
+    uint32_t end = limit / PAGE_SIZE;
+    if (end > total_frames) end = total_frames;
+
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < end; i++) {
+        if (bitmap_test(i)) {
+            run = 0;
+            continue;
+        }
+        if (++run == count) {
+            uint32_t first = i + 1 - count;
+            for (uint32_t f = first; f <= i; f++) bitmap_set(f);
+            used_frames += count;
+            return (void*)(first * PAGE_SIZE);
+        }
+    }
+    return nullptr;
+}
+
 void pmm_free_frame(void* frame) {
     uint32_t addr = (uint32_t)frame;
     uint32_t index = addr / PAGE_SIZE;
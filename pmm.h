@@ -38,6 +38,10 @@ void pmm_init();
 // Allocate a single 4KB page frame, returns physical address (or nullptr if OOM)
 void* pmm_alloc_frame();
 
+// Allocate 'count' physically contiguous frames, all below 'limit' - for
+// DMA buffers. Returns the first one's address (or nullptr).
+void* pmm_alloc_contiguous(uint32_t count, uint32_t limit);
+
 // Free a previously allocated page frame
 void pmm_free_frame(void* frame);
 
@@ -27,6 +27,17 @@ static inline void outw(uint16_t port, uint16_t data) {
     __asm__ volatile("outw %0, %1" : : "a"(data), "Nd"(port));
 }
 
+// 32-bit versions (PCI configuration space, bus-master DMA registers)
+static inline uint32_t inl(uint16_t port) {
+    uint32_t result;
+    __asm__ volatile("inl %1, %0" : "=a"(result) : "Nd"(port));
+    return result;
+}
+
+static inline void outl(uint16_t port, uint32_t data) {
+    __asm__ volatile("outl %0, %1" : : "a"(data), "Nd"(port));
+}
+
 // Small delay for safety (reading port 0x80 takes ~1µs on ISA bus)
 static inline void io_wait() {
     outb(0x80, 0);
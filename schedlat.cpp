@@ -0,0 +1,79 @@
+#include "schedlat.h"
+#include "task.h"
+#include "timer.h"
+#include "cpu.h"
+
+static LatencyHist global_hist;
+static SchedLatMax worst;
+
+static void hist_add(LatencyHist* h, uint64_t cycles) {
+    h->count++;
+    h->total += cycles;
+    if (cycles > h->max) h->max = cycles;
+    h->buckets[schedlat_bucket(cycles)]++;
+}
+
+int schedlat_bucket(uint64_t cycles) {
+    if (cycles >> 32) return SCHEDLAT_BUCKETS - 1;
+    uint32_t low = (uint32_t)cycles;
+    if (low == 0) return 0;
+    return 31 - __builtin_clz(low);
+}
+
+void schedlat_hist_clear(LatencyHist* h) {
+    h->count = 0;
+    h->total = 0;
+    h->max   = 0;
+    for (int i = 0; i < SCHEDLAT_BUCKETS; i++) {
+        h->buckets[i] = 0;
+    }
+}
+
+void schedlat_wake(Task* t, Task* running) {
+    // Woken while idling in task_wait_commit: nobody was in the way
+    if (running == t) running = 0;
+    t->woken_at        = rdtsc();
+    t->woken_over      = running ? running->id : 0;
+    t->woken_over_name = running ? running->name : 0;
+}
+
+void schedlat_dispatch(Task* t, uint64_t now) {
+    if (!t->woken_at) return;  // Preempted and requeued, not a wake-up
+    uint64_t latency = now - t->woken_at;
+    t->woken_at = 0;
+
+    hist_add(&t->wake_lat, latency);
+    hist_add(&global_hist, latency);
+
+    if (latency > worst.cycles) {
+        worst.cycles         = latency;
+        worst.tick           = timer_get_ticks();
+        worst.task_id        = t->id;
+        worst.task_name      = t->name;
+        worst.preemptor_id   = t->woken_over;
+        worst.preemptor_name = t->woken_over_name;
+    }
+}
+
+void schedlat_reset() {
+    uint32_t flags = task_list_lock();
+    schedlat_hist_clear(&global_hist);
+    worst.cycles         = 0;
+    worst.tick           = 0;
+    worst.task_id        = 0;
+    worst.task_name      = 0;
+    worst.preemptor_id   = 0;
+    worst.preemptor_name = 0;
+    for (Task* t = task_get_list(); t; t = t->all_next) {
+        schedlat_hist_clear(&t->wake_lat);
+    }
+    task_list_unlock(flags);
+}
+
+const LatencyHist* schedlat_get_global() {
+    return &global_hist;
+}
+
+const SchedLatMax* schedlat_get_max() {
+    return &worst;
+}
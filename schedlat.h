@@ -0,0 +1,50 @@
+#ifndef SCHEDLAT_H
+#define SCHEDLAT_H
+
+#include <stdint.h>
+
+// =============================================================================
+// Scheduler wakeup-latency tracer
+//
+// A task is stamped with the TSC when it is woken (sleep expiry or a
+// task_wake_* call) and measured again when the scheduler actually hands it
+// the CPU. The difference goes into a log2 histogram - per task and global -
+// and the worst case is remembered together with the task that was holding
+// the CPU when the wake-up happened.
+// =============================================================================
+
+// Bucket n counts latencies in [2^n, 2^(n+1)) cycles; the last one is open
+#define SCHEDLAT_BUCKETS 32
+
+struct LatencyHist {
+    uint32_t count;
+    uint64_t total;     // Sum of all samples, for the mean
+    uint64_t max;
+    uint32_t buckets[SCHEDLAT_BUCKETS];
+};
+
+struct SchedLatMax {
+    uint64_t    cycles;
+    uint32_t    tick;            // When it happened
+    uint32_t    task_id;         // Who waited
+    const char* task_name;
+    uint32_t    preemptor_id;    // Who was running when it was woken
+    const char* preemptor_name;
+};
+
+struct Task;
+
+// Scheduler hooks (interrupts disabled)
+void schedlat_wake(Task* t, Task* running);
+void schedlat_dispatch(Task* t, uint64_t now);
+
+// Clear the global stats and every task's histogram
+void schedlat_reset();
+
+void schedlat_hist_clear(LatencyHist* h);
+int  schedlat_bucket(uint64_t cycles);
+
+const LatencyHist* schedlat_get_global();
+const SchedLatMax* schedlat_get_max();
+
+#endif
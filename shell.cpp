@@ -9,6 +9,23 @@
 #include "ata.h"
 #include "fat16.h"
 #include "task.h"
+#include "fpu.h"
+#include "sync.h"
+#include "cpu.h"
+#include "schedlat.h"
+#include "smp.h"
+#include "percpu.h"
+#include "acpi.h"
+#include "apic.h"
+#include "ioapic.h"
+#include "hrtimer.h"
+#include "kstack.h"
+#include "syscall.h"
+#include "user.h"
+#include "fiber.h"
+#include "workqueue.h"
+#include "irqstat.h"
+#include "pci.h"
 
 #define CMD_BUFFER_SIZE 256
 #define HISTORY_SIZE 10
@@ -137,6 +154,8 @@ static void cmd_help() {
     vga_print("  heap          - Show kernel heap stats\n");
     vga_print("  heaptest      - Test kmalloc/kfree\n");
     vga_print("  disktest      - Test ATA disk driver\n");
+    vga_print("  diskbench     - Sequential read MB/s, PIO vs DMA\n");
+    vga_print("  lspci [-v]    - List PCI devices / with their BARs\n");
     vga_print("  ls            - List files on disk\n");
     vga_print("  cat <file>    - Display file contents\n");
     vga_print("  write <f> <t> - Create file with text\n");
@@ -144,8 +163,26 @@ static void cmd_help() {
     vga_print("  rm <file>     - Delete a file\n");
     vga_print("  mkdir <name>  - Create a directory\n");
     vga_print("  ps            - List running tasks\n");
+    vga_print("  top           - Live per-task CPU usage (any key quits)\n");
+    vga_print("  schedlat [id|reset] - Scheduler wakeup-latency histograms\n");
     vga_print("  spawn         - Spawn a demo counter task\n");
     vga_print("  kill <id>     - Kill a task by ID\n");
+    vga_print("  smp           - Show CPUs and per-CPU scheduler stats\n");
+    vga_print("  apic          - Show interrupt controllers and IRQ routing\n");
+    vga_print("  clock         - Show clock sources and test sleep accuracy\n");
+    vga_print("  hrtimer       - Show hrtimer stats and measure callback lateness\n");
+    vga_print("  stacks [overflow] - Task stack stats / overflow a guard page\n");
+    vga_print("  workq [test]  - Work queue depth and latency / queue a burst and flush\n");
+    vga_print("  sysbench      - Time a null system call from ring 3\n");
+    vga_print("  bench sched   - Yield, timer IRQ entry and sleep(0) cycles\n");
+    vga_print("  bench irq     - Cycles per interrupt, common vs fast entry stub\n");
+    vga_print("  irqstat [reset|nest] - Interrupt counts and cycles / nested handler demo\n");
+    vga_print("  cputest [n]   - Time n compute tasks (default 4) across CPUs\n");
+    vga_print("  fibers [n]    - Run n sleeping fibers, time fiber vs task switches\n");
+    vga_print("  rt [demo]     - Real-time tasks / start periodic EDF demo tasks\n");
+    vga_print("  fputest       - Check FPU/SSE state survives task switches\n");
+    vga_print("  synctest      - Race tasks on a mutex counter, post a semaphore from an IRQ\n");
+    vga_print("  tasktest [n]  - Create and kill n tasks (default 2000)\n");
 }
 
 static void cmd_echo(const char* args) {
@@ -514,6 +551,21 @@ static void cmd_disktest() {
         vga_print("FAIL - data mismatch!\n");
     }
     vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+
+    vga_print("  Completion: ");
+    if (ata_irq_enabled()) {
+        vga_print("IRQ14, ");
+        vga_print_int(ata_get_irq_count());
+        vga_print(" interrupts, ");
+        vga_print_int(ata_get_timeouts());
+        vga_print(" timeouts\n");
+    } else {
+        vga_print("polling\n");
+    }
+    vga_print("  Transfers:  ");
+    if (ata_dma_enabled())        vga_print("bus-master DMA\n");
+    else if (ata_dma_available()) vga_print("PIO (DMA switched off)\n");
+    else                          vga_print("PIO\n");
 }
 
 static void cmd_ls() {
@@ -595,134 +647,1838 @@ static void cmd_cat(const char* args) {
     kfree(buf);
 }
 
-static void cmd_write(const char* args) {
-    args = skip_spaces(args);
-    if (*args == '\0') {
-        vga_print("Usage: write <filename> <text>\n");
+static void cmd_write(const char* args) {
+    args = skip_spaces(args);
+    if (*args == '\0') {
+        vga_print("Usage: write <filename> <text>\n");
+        return;
+    }
+    
+    // Parse filename (first word)
+    char filename[64];
+    int fi = 0;
+    while (*args && *args != ' ' && fi < 63) {
+        filename[fi++] = *args++;
+    }
+    filename[fi] = '\0';
+    
+    // Rest is the content
+    args = skip_spaces(args);
+    if (*args == '\0') {
+        vga_print("Usage: write <filename> <text>\n");
+        return;
+    }
+    
+    int len = str_len(args);
+    
+    int result = fat16_create_file(filename, args, (uint32_t)len);
+    if (result == 0) {
+        vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
+        vga_print("Wrote ");
+        vga_print_int(len);
+        vga_print(" bytes to ");
+        vga_print(filename);
+        vga_put_char('\n');
+    } else {
+        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        vga_print("Failed to write file\n");
+    }
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+}
+
+static void cmd_touch(const char* args) {
+    args = skip_spaces(args);
+    if (*args == '\0') {
+        vga_print("Usage: touch <filename>\n");
+        return;
+    }
+    
+    // Check if file already exists
+    int size = fat16_file_size(args);
+    if (size >= 0) {
+        vga_print("File already exists (");
+        vga_print_int(size);
+        vga_print(" bytes)\n");
+        return;
+    }
+    
+    int result = fat16_create_file(args, nullptr, 0);
+    if (result == 0) {
+        vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
+        vga_print("Created ");
+        vga_print(args);
+        vga_put_char('\n');
+    } else {
+        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        vga_print("Failed to create file\n");
+    }
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+}
+
+static void cmd_rm(const char* args) {
+    args = skip_spaces(args);
+    if (*args == '\0') {
+        vga_print("Usage: rm <filename>\n");
+        return;
+    }
+    
+    int result = fat16_delete(args);
+    if (result == 0) {
+        vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
+        vga_print("Deleted ");
+        vga_print(args);
+        vga_put_char('\n');
+    } else {
+        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        vga_print("File not found: ");
+        vga_print(args);
+        vga_put_char('\n');
+    }
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+}
+
+// Demo task that counts to 5 with 1-second pauses, then exits
+static void demo_counter_task() {
+    for (int i = 0; i < 5; i++) {
+        vga_set_color(VGA_LIGHT_CYAN, VGA_BLACK);
+        vga_print("[task ");
+        vga_print_int(task_get_current_id());
+        vga_print("] count ");
+        vga_print_int(i);
+        vga_put_char('\n');
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        task_sleep(100);  // 100 ticks = 1 second at 100Hz
+    }
+    vga_set_color(VGA_LIGHT_CYAN, VGA_BLACK);
+    vga_print("[task ");
+    vga_print_int(task_get_current_id());
+    vga_print("] done!\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    task_exit();
+}
+
+// Pad with spaces up to screen column 'col'
+static void print_to_col(int col) {
+    while (vga_get_cursor_x() < col) vga_put_char(' ');
+}
+
+// Stack use as "peak/size" bytes, or "-" for boot stacks
+static void print_stack_use(uint32_t peak, uint32_t size) {
+    if (!size) {
+        vga_print("-");
+        return;
+    }
+    vga_print_int(peak);
+    vga_put_char('/');
+    vga_print_int(size);
+}
+
+// Running stack worst cases per name and entry function, and the deepest
+// of them against the default stack size
+static void ps_stack_records() {
+    StackRecord recs[STACK_RECORD_MAX];
+    int n = task_get_stack_records(recs, STACK_RECORD_MAX);
+    if (n == 0) return;
+
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("\nENTRY       NAME         TASKS  PEAK/SIZE\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    StackRecord* deepest = &recs[0];
+    for (int i = 0; i < n; i++) {
+        vga_print_hex((uint32_t)recs[i].entry);
+        print_to_col(12); vga_print(recs[i].name ? recs[i].name : "?");
+        print_to_col(25); vga_print_int(recs[i].tasks);
+        print_to_col(32); print_stack_use(recs[i].peak, recs[i].stack_size);
+        vga_put_char('\n');
+        if (recs[i].peak > deepest->peak) deepest = &recs[i];
+    }
+    vga_print("Deepest: ");
+    vga_print_int(deepest->peak);
+    vga_print(" bytes (");
+    vga_print(deepest->name ? deepest->name : "?");
+    vga_print("), default stack ");
+    vga_print_int(TASK_STACK_SIZE);
+    vga_print(" bytes\n");
+}
+
+static void cmd_ps() {
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("ID  CPU STATE     STACK      RT MISS    NAME\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    for (Task* t = task_get_list(); t; t = t->all_next) {
+        vga_print_int(t->id);
+        print_to_col(4);
+        vga_print_int(t->cpu);
+        print_to_col(8);
+        switch (t->state) {
+            case TASK_RUNNING:  vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK); vga_print("RUNNING   "); break;
+            case TASK_READY:    vga_set_color(VGA_LIGHT_CYAN, VGA_BLACK);  vga_print("READY     "); break;
+            case TASK_SLEEPING: vga_set_color(VGA_YELLOW, VGA_BLACK);      vga_print("SLEEPING  "); break;
+            case TASK_BLOCKED:  vga_set_color(VGA_LIGHT_MAGENTA, VGA_BLACK); vga_print("BLOCKED   "); break;
+            default: break;
+        }
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        print_stack_use(task_stack_peak(t), t->stack_size);
+        print_to_col(29);
+        if (t->rt_period) {
+            if (t->rt_misses) vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+            vga_print_int(t->rt_misses);
+            vga_put_char('/');
+            vga_print_int(t->rt_jobs);
+            vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        } else {
+            vga_print("-");
+        }
+        print_to_col(40);
+        vga_print(t->name ? t->name : "?");
+        vga_put_char('\n');
+    }
+    vga_print("Total: ");
+    vga_print_int(task_get_count());
+    vga_print(" tasks\n");
+    ps_stack_records();
+}
+
+// top: snapshot every task's counters once a second and show what each one
+// did in between. The wait is a task_sleep, so top costs nothing while idle.
+#define TOP_REFRESH_TICKS 100   // 1 second at 100Hz
+#define TOP_POLL_TICKS    10    // How often to check for a key press
+#define TOP_MAX_ROWS      20
+
+struct TopRow {
+    TaskStats* cur;
+    uint64_t   cpu;
+    uint64_t   ready;
+    uint64_t   sleep;
+    uint32_t   ticks;
+    uint32_t   vcsw;
+    uint32_t   ivcsw;
+};
+
+// part/whole in tenths of a percent, using only 32-bit division
+static uint32_t per_mille(uint64_t part, uint64_t whole) {
+    while (whole >> 22) {
+        whole >>= 1;
+        part >>= 1;
+    }
+    if (whole == 0) return 0;
+    if (part > whole) part = whole;
+    return (uint32_t)part * 1000 / (uint32_t)whole;
+}
+
+static void print_per_mille(uint32_t pm) {
+    vga_print_int(pm / 10);
+    vga_put_char('.');
+    vga_print_int(pm % 10);
+}
+
+static TaskStats* top_find(TaskStats* snap, int n, uint32_t id) {
+    for (int i = 0; i < n; i++) {
+        if (snap[i].id == id) return &snap[i];
+    }
+    return 0;
+}
+
+// Wait one refresh period; returns true if a key was pressed
+static bool top_wait() {
+    for (int t = 0; t < TOP_REFRESH_TICKS; t += TOP_POLL_TICKS) {
+        task_sleep(TOP_POLL_TICKS);
+        if (keyboard_try_getchar() >= 0) return true;
+    }
+    return false;
+}
+
+static void top_render(TopRow* rows, int n, uint64_t elapsed) {
+    uint32_t total_ticks = 0, total_cs = 0;
+    for (int i = 0; i < n; i++) {
+        total_ticks += rows[i].ticks;
+        total_cs    += rows[i].vcsw + rows[i].ivcsw;
+    }
+
+    vga_clear();
+    vga_set_color(VGA_WHITE, VGA_BLACK);
+    vga_print("top - up ");
+    vga_print_int(timer_get_ticks() / 100);
+    vga_print("s, ");
+    vga_print_int(task_get_count());
+    vga_print(" tasks, ");
+    vga_print_int((int)div64_32(elapsed, 1000000, 0));
+    vga_print(" Mcycles, ");
+    vga_print_int(total_ticks);
+    vga_print(" ticks, ");
+    vga_print_int(total_cs);
+    vga_print(" switches this interval\n");
+    vga_set_color(VGA_DARK_GREY, VGA_BLACK);
+    vga_print("Press any key to quit\n");
+
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("ID");
+    print_to_col(6);  vga_print("NAME");
+    print_to_col(19); vga_print("STATE");
+    print_to_col(28); vga_print("CPU%");
+    print_to_col(35); vga_print("READY%");
+    print_to_col(43); vga_print("SLEEP%");
+    print_to_col(51); vga_print("TICKS");
+    print_to_col(58); vga_print("VCSW");
+    print_to_col(66); vga_print("IVCSW");
+    vga_put_char('\n');
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+
+    int shown = n < TOP_MAX_ROWS ? n : TOP_MAX_ROWS;
+    for (int i = 0; i < shown; i++) {
+        TopRow* r = &rows[i];
+        vga_print_int(r->cur->id);
+        print_to_col(6);
+        vga_print(r->cur->name ? r->cur->name : "?");
+        print_to_col(19);
+        switch (r->cur->state) {
+            case TASK_RUNNING:  vga_print("RUN");   break;
+            case TASK_READY:    vga_print("READY"); break;
+            case TASK_SLEEPING: vga_print("SLEEP"); break;
+            case TASK_BLOCKED:  vga_print("BLOCK"); break;
+            default:            vga_print("?");     break;
+        }
+        print_to_col(28); print_per_mille(per_mille(r->cpu, elapsed));
+        print_to_col(35); print_per_mille(per_mille(r->ready, elapsed));
+        print_to_col(43); print_per_mille(per_mille(r->sleep, elapsed));
+        print_to_col(51); vga_print_int(r->ticks);
+        print_to_col(58); vga_print_int(r->vcsw);
+        print_to_col(66); vga_print_int(r->ivcsw);
+        vga_put_char('\n');
+    }
+    if (n > shown) {
+        vga_print("... ");
+        vga_print_int(n - shown);
+        vga_print(" more\n");
+    }
+}
+
+static void cmd_top() {
+    // Leave headroom for tasks spawned while we run; extras are just not shown
+    int cap = task_get_count() * 2 + 16;
+    TaskStats* prev = (TaskStats*)kmalloc(cap * sizeof(TaskStats));
+    TaskStats* cur  = (TaskStats*)kmalloc(cap * sizeof(TaskStats));
+    TopRow* rows    = (TopRow*)kmalloc(cap * sizeof(TopRow));
+    if (!prev || !cur || !rows) {
+        if (prev) kfree(prev);
+        if (cur)  kfree(cur);
+        if (rows) kfree(rows);
+        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        vga_print("Out of memory\n");
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        return;
+    }
+
+    uint64_t prev_tsc, cur_tsc;
+    int prev_n = task_collect_stats(prev, cap, &prev_tsc);
+
+    while (!top_wait()) {
+        int n = task_collect_stats(cur, cap, &cur_tsc);
+
+        // Diff against the last snapshot; tasks born since count from zero
+        for (int i = 0; i < n; i++) {
+            TaskStats* c = &cur[i];
+            TaskStats* p = top_find(prev, prev_n, c->id);
+            TopRow* r = &rows[i];
+            r->cur   = c;
+            r->cpu   = c->cpu_cycles   - (p ? p->cpu_cycles   : 0);
+            r->ready = c->ready_cycles - (p ? p->ready_cycles : 0);
+            r->sleep = c->sleep_cycles - (p ? p->sleep_cycles : 0);
+            r->ticks = c->run_ticks    - (p ? p->run_ticks    : 0);
+            r->vcsw  = c->nvcsw        - (p ? p->nvcsw        : 0);
+            r->ivcsw = c->nivcsw       - (p ? p->nivcsw       : 0);
+        }
+
+        // Busiest first (insertion sort - task counts are small)
+        for (int i = 1; i < n; i++) {
+            TopRow key = rows[i];
+            int j = i - 1;
+            while (j >= 0 && rows[j].cpu < key.cpu) {
+                rows[j + 1] = rows[j];
+                j--;
+            }
+            rows[j + 1] = key;
+        }
+
+        top_render(rows, n, cur_tsc - prev_tsc);
+
+        TaskStats* swap = prev;
+        prev = cur;
+        cur = swap;
+        prev_n = n;
+        prev_tsc = cur_tsc;
+    }
+
+    kfree(prev);
+    kfree(cur);
+    kfree(rows);
+}
+
+// schedlat: wakeup latency = cycles from a task being made READY by a
+// wake-up until the scheduler actually switches to it
+#define SCHEDLAT_BAR_WIDTH 40
+
+static void print_cycles(uint64_t cycles) {
+    // Plain int up to ~2G cycles, then switch to millions
+    if (cycles >> 31) {
+        vga_print_int((int)div64_32(cycles, 1000000, 0));
+        vga_put_char('M');
+    } else {
+        vga_print_int((int)cycles);
+    }
+}
+
+static uint64_t hist_mean(const LatencyHist* h) {
+    return h->count ? div64_32(h->total, h->count, 0) : 0;
+}
+
+static void print_hist(const LatencyHist* h) {
+    vga_print("  Samples: ");
+    vga_print_int(h->count);
+    vga_print("  mean: ");
+    print_cycles(hist_mean(h));
+    vga_print("  max: ");
+    print_cycles(h->max);
+    vga_print(" cycles\n");
+    if (h->count == 0) return;
+
+    uint32_t peak = 0;
+    for (int i = 0; i < SCHEDLAT_BUCKETS; i++) {
+        if (h->buckets[i] > peak) peak = h->buckets[i];
+    }
+    for (int i = 0; i < SCHEDLAT_BUCKETS; i++) {
+        if (h->buckets[i] == 0) continue;
+        vga_print("  >= 2^");
+        vga_print_int(i);
+        print_to_col(10);
+        vga_print_int(h->buckets[i]);
+        print_to_col(18);
+        uint32_t bar = h->buckets[i] * SCHEDLAT_BAR_WIDTH / peak;
+        if (bar == 0) bar = 1;
+        vga_set_color(VGA_LIGHT_CYAN, VGA_BLACK);
+        for (uint32_t b = 0; b < bar; b++) vga_put_char('#');
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        vga_put_char('\n');
+    }
+}
+
+static void cmd_schedlat(const char* args) {
+    args = skip_spaces(args);
+
+    if (str_eq(args, "reset")) {
+        schedlat_reset();
+        vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
+        vga_print("Latency stats cleared\n");
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        return;
+    }
+
+    LatencyHist h;
+    if (*args) {
+        uint32_t flags = irq_save();
+        Task* t = task_find((uint32_t)parse_int(args));
+        if (t) h = t->wake_lat;
+        irq_restore(flags);
+        if (!t) {
+            vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+            vga_print("No task with id ");
+            vga_print(args);
+            vga_put_char('\n');
+            vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+            return;
+        }
+        vga_set_color(VGA_YELLOW, VGA_BLACK);
+        vga_print("Wakeup latency, task ");
+        vga_print(args);
+        vga_print(" (cycles):\n");
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        print_hist(&h);
+        return;
+    }
+
+    SchedLatMax worst;
+    uint32_t flags = irq_save();
+    h = *schedlat_get_global();
+    worst = *schedlat_get_max();
+    irq_restore(flags);
+
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("Wakeup latency, all tasks (cycles):\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    print_hist(&h);
+    if (worst.cycles) {
+        vga_print("  Worst: ");
+        print_cycles(worst.cycles);
+        vga_print(" cycles, task ");
+        vga_print_int(worst.task_id);
+        vga_print(" (");
+        vga_print(worst.task_name ? worst.task_name : "?");
+        vga_print(") behind ");
+        vga_print_int(worst.preemptor_id);
+        vga_print(" (");
+        vga_print(worst.preemptor_name ? worst.preemptor_name : "idle");
+        vga_print(") at tick ");
+        vga_print_int(worst.tick);
+        vga_put_char('\n');
+    }
+
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("ID");
+    print_to_col(6);  vga_print("NAME");
+    print_to_col(19); vga_print("WAKEUPS");
+    print_to_col(29); vga_print("MEAN");
+    print_to_col(41); vga_print("MAX");
+    vga_put_char('\n');
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    for (Task* t = task_get_list(); t; t = t->all_next) {
+        flags = irq_save();
+        h = t->wake_lat;
+        irq_restore(flags);
+        if (h.count == 0) continue;
+        vga_print_int(t->id);
+        print_to_col(6);  vga_print(t->name ? t->name : "?");
+        print_to_col(19); vga_print_int(h.count);
+        print_to_col(29); print_cycles(hist_mean(&h));
+        print_to_col(41); print_cycles(h.max);
+        vga_put_char('\n');
+    }
+}
+
+static void cmd_smp() {
+    uint32_t n = smp_get_cpu_count();
+    const char* source = smp_get_source();
+    vga_print("CPUs online: ");
+    vga_print_int(n);
+    vga_print(" (");
+    vga_print(source ? source : "no MP/ACPI tables");
+    vga_print(")\n");
+
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("CPU");
+    print_to_col(5);  vga_print("APIC");
+    print_to_col(11); vga_print("CURRENT");
+    print_to_col(25); vga_print("QUEUED");
+    print_to_col(33); vga_print("TICKS");
+    print_to_col(42); vga_print("IPIS");
+    print_to_col(50); vga_print("STEALS");
+    vga_put_char('\n');
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        PerCpu* cpu = &cpus[i];
+        if (!cpu->online) continue;
+        uint32_t flags = task_list_lock();
+        const char* name = cpu->current ? cpu->current->name : "?";
+        uint32_t queued = cpu->nr_ready;
+        task_list_unlock(flags);
+
+        vga_print_int(i);
+        print_to_col(5);  vga_print_int(cpu->apic_id);
+        print_to_col(11); vga_print(name ? name : "?");
+        print_to_col(25); vga_print_int(queued);
+        print_to_col(33); vga_print_int(cpu->local_ticks);
+        print_to_col(42); vga_print_int(cpu->resched_ipis);
+        print_to_col(50); vga_print_int(cpu->steals);
+        vga_put_char('\n');
+    }
+}
+
+static void cmd_apic() {
+    const PlatformInfo* info = acpi_get_platform();
+
+    vga_print("IRQ delivery: ");
+    vga_print(ioapic_active() ? "IOAPIC (8259 masked)\n" : "8259 PIC\n");
+    if (!lapic_present()) {
+        vga_print("No local APIC\n");
+        return;
+    }
+    vga_print("Local APIC: id ");
+    vga_print_int(lapic_get_id());
+    vga_print(" at ");
+    vga_print_hex(info->lapic_base ? info->lapic_base : LAPIC_DEFAULT_BASE);
+    vga_put_char('\n');
+
+    for (int i = 0; i < ioapic_get_count(); i++) {
+        const IoApicInfo* io = &info->ioapics[i];
+        vga_print("IOAPIC ");
+        vga_print_int(io->id);
+        vga_print(" at ");
+        vga_print_hex(io->addr);
+        vga_print(", GSI ");
+        vga_print_int(io->gsi_base);
+        vga_put_char('-');
+        vga_print_int(io->gsi_base + ioapic_get_pins(i) - 1);
+        vga_put_char('\n');
+    }
+    if (!ioapic_active()) return;
+
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("IRQ");
+    print_to_col(5);  vga_print("GSI");
+    print_to_col(10); vga_print("VECTOR");
+    print_to_col(18); vga_print("DEST");
+    print_to_col(23); vga_print("TRIGGER");
+    print_to_col(36); vga_print("STATE");
+    vga_put_char('\n');
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+
+    for (uint8_t irq = 0; irq < ISA_IRQ_COUNT; irq++) {
+        IoApicRoute r;
+        if (irq == 2 || !ioapic_get_route(irq, &r)) continue;
+        vga_print_int(irq);
+        print_to_col(5);  vga_print_int(r.gsi);
+        print_to_col(10); vga_print_int(r.vector);
+        print_to_col(18); vga_print_int(r.dest_apic_id);
+        print_to_col(23); vga_print(r.level ? "level" : "edge");
+        vga_print(r.active_low ? "/low" : "/high");
+        print_to_col(36);
+        if (r.masked) {
+            vga_print("masked");
+        } else {
+            vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
+            vga_print("enabled");
+            vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        }
+        vga_put_char('\n');
+    }
+}
+
+// Nanoseconds as microseconds with one decimal
+static void print_us(uint32_t ns) {
+    vga_print_int(ns / 1000);
+    vga_put_char('.');
+    vga_print_int((ns % 1000) / 100);
+    vga_print(" us");
+}
+
+// clock: time a few sleeps of different lengths against timer_get_ns
+static void cmd_clock() {
+    static const uint32_t sleep_lengths_us[] = { 10, 100, 1000, 2500, 10000 };
+
+    vga_print("Clock source: ");
+    vga_print(timer_get_clocksource());
+    uint32_t khz = timer_get_tsc_khz();
+    if (khz) {
+        vga_print(" (");
+        vga_print_int(khz / 1000);
+        vga_put_char('.');
+        uint32_t frac = khz % 1000;
+        if (frac < 100) vga_put_char('0');
+        if (frac < 10)  vga_put_char('0');
+        vga_print_int(frac);
+        vga_print(" MHz)");
+    }
+    vga_print("\nTimer events: ");
+    vga_print(timer_get_event_backend());
+    vga_print("\nUptime: ");
+    vga_print_int((int)div64_32(timer_get_ns(), 1000, 0));
+    vga_print(" us\n");
+
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("REQUESTED");
+    print_to_col(14); vga_print("ACTUAL");
+    print_to_col(28); vga_print("ERROR\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+
+    for (uint32_t i = 0; i < sizeof(sleep_lengths_us) / sizeof(sleep_lengths_us[0]); i++) {
+        uint32_t us = sleep_lengths_us[i];
+        uint64_t start = timer_get_ns();
+        sleep_us(us);
+        uint32_t actual_ns = (uint32_t)(timer_get_ns() - start);
+        uint32_t error_ns = actual_ns - us * 1000;
+
+        vga_print_int(us);
+        vga_print(" us");
+        print_to_col(14);
+        print_us(actual_ns);
+        print_to_col(28);
+        vga_set_color(error_ns < 50000 ? VGA_LIGHT_GREEN : VGA_LIGHT_RED, VGA_BLACK);
+        vga_put_char('+');
+        print_us(error_ns);
+        vga_put_char('\n');
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    }
+}
+
+// hrtimer: run a 2.5ms periodic timer for a while, once with callbacks in
+// the interrupt and once from the bottom half, and see how late they fire
+#define HRTEST_PERIOD_NS  2500000
+#define HRTEST_FIRES      100
+
+static HrTimer hrtest_timer;
+static Semaphore hrtest_done = SEMAPHORE_INIT(0);
+static uint32_t hrtest_count;
+static uint32_t hrtest_min_ns;
+static uint32_t hrtest_max_ns;
+static uint64_t hrtest_total_ns;
+
+static void hrtest_tick(HrTimer* t) {
+    // Periodic: 'expires' has already moved on to the next period
+    uint64_t late = timer_get_ns() - (t->expires - t->period);
+    uint32_t ns = (late >> 32) ? 0xFFFFFFFF : (uint32_t)late;
+    if (ns < hrtest_min_ns) hrtest_min_ns = ns;
+    if (ns > hrtest_max_ns) hrtest_max_ns = ns;
+    hrtest_total_ns += ns;
+
+    if (++hrtest_count == HRTEST_FIRES) {
+        hrtimer_cancel(t);
+        sem_post(&hrtest_done);
+    }
+}
+
+static void hrtest_run(bool deferred) {
+    hrtest_count = 0;
+    hrtest_min_ns = 0xFFFFFFFF;
+    hrtest_max_ns = 0;
+    hrtest_total_ns = 0;
+    hrtest_timer.deferred = deferred;
+
+    hrtimer_start_periodic(&hrtest_timer, HRTEST_PERIOD_NS, hrtest_tick);
+    sem_wait(&hrtest_done);
+
+    vga_print(deferred ? "deferred" : "irq");
+    print_to_col(12); print_us(hrtest_min_ns);
+    print_to_col(26); print_us((uint32_t)div64_32(hrtest_total_ns, HRTEST_FIRES, 0));
+    print_to_col(40); print_us(hrtest_max_ns);
+    print_to_col(54); vga_print_int(hrtest_timer.overruns);
+    vga_put_char('\n');
+}
+
+static void cmd_hrtimer() {
+    vga_print("Timer events: ");
+    vga_print(timer_get_event_backend());
+    vga_print("\nPending: ");
+    vga_print_int(hrtimer_get_pending_count());
+    vga_print("  fired: ");
+    vga_print_int(hrtimer_get_fired_count());
+    uint64_t next = hrtimer_get_next_expiry();
+    if (next) {
+        uint64_t now = timer_get_ns();
+        vga_print("  next in ");
+        print_us(next > now ? (uint32_t)(next - now) : 0);
+    }
+    vga_print("\n\n");
+
+    vga_print("Lateness over ");
+    vga_print_int(HRTEST_FIRES);
+    vga_print(" fires of a 2.5ms periodic timer:\n");
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("CONTEXT");
+    print_to_col(12); vga_print("MIN");
+    print_to_col(26); vga_print("AVG");
+    print_to_col(40); vga_print("MAX");
+    print_to_col(54); vga_print("OVERRUNS\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+
+    hrtest_run(false);
+    hrtest_run(true);
+}
+
+// stacks overflow: a task recurses until it runs into its guard page. That
+// halts the machine with a "stack overflow in task N" report - on purpose.
+static volatile uint32_t overflow_depth;
+
+static void overflow_recurse(uint32_t n) {
+    volatile uint8_t pad[256];
+    pad[0] = (uint8_t)n;
+    overflow_depth = n;
+    if (n != 0xFFFFFFFF) overflow_recurse(n + 1);
+    pad[1] = pad[0];    // Keeps the call from becoming a jump
+}
+
+static void overflow_task() {
+    overflow_recurse(0);
+    task_exit();
+}
+
+static void cmd_stacks(const char* args) {
+    args = skip_spaces(args);
+    if (str_eq(args, "overflow")) {
+        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        vga_print("Spawning a task that overflows its stack - this halts the system\n");
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        task_create(overflow_task, "overflow");
+        return;
+    }
+    if (*args) {
+        vga_print("Usage: stacks [overflow]\n");
+        return;
+    }
+
+    vga_print("Stack region: ");
+    vga_print_hex(KSTACK_REGION_START);
+    vga_print(" - ");
+    vga_print_hex(KSTACK_REGION_END);
+    vga_print("\n  In use:  ");
+    vga_print_int(kstack_get_in_use());
+    vga_print("\n  Pooled:  ");
+    vga_print_int(kstack_get_pooled());
+    vga_print("\n  Mapped:  ");
+    vga_print_int(kstack_get_mapped_pages());
+    vga_print(" pages (");
+    vga_print_int(kstack_get_mapped_pages() * 4);
+    vga_print(" KB)\n  Carved:  ");
+    vga_print_int(kstack_get_region_used() / 1024);
+    vga_print(" of ");
+    vga_print_int((KSTACK_REGION_END - KSTACK_REGION_START) / 1024);
+    vga_print(" KB (one guard page per stack)\n");
+}
+
+// workq: worker pool stats. 'test' queues a burst of sleeping items at all
+// three priorities, so the low ones visibly wait, and times the flush.
+#define WORKQ_TEST_PER_PRIO 8
+#define WORKQ_TEST_SLEEP_NS 2000000
+
+static WorkItem workq_items[WORK_PRIORITIES * WORKQ_TEST_PER_PRIO];
+
+static void workq_test_item(void* arg) {
+    (void)arg;
+    task_sleep_ns(WORKQ_TEST_SLEEP_NS);   // Work items may block
+}
+
+static void workq_test() {
+    uint64_t start = timer_get_ns();
+    int queued = 0;
+    // Low first, so only priority explains the high ones overtaking it
+    for (int p = WORK_PRIORITIES - 1; p >= 0; p--) {
+        for (int i = 0; i < WORKQ_TEST_PER_PRIO; i++) {
+            WorkItem* w = &workq_items[p * WORKQ_TEST_PER_PRIO + i];
+            w->fn  = workq_test_item;
+            w->arg = 0;
+            if (work_queue(w, (WorkPriority)p)) queued++;
+        }
+    }
+    work_queue_flush();
+    uint64_t elapsed = timer_get_ns() - start;
+
+    vga_print("Queued ");
+    vga_print_int(queued);
+    vga_print(" items sleeping ");
+    vga_print_int(WORKQ_TEST_SLEEP_NS / 1000000);
+    vga_print(" ms each, flushed after ");
+    vga_print_int((uint32_t)div64_32(elapsed, 1000000, 0));
+    vga_print(" ms\n\n");
+}
+
+static void cmd_workq(const char* args) {
+    args = skip_spaces(args);
+    if (str_eq(args, "test")) {
+        workq_test();
+    } else if (*args) {
+        vga_print("Usage: workq [test]\n");
+        return;
+    }
+
+    static const char* prio_names[WORK_PRIORITIES] = { "high", "normal", "low" };
+    WorkQueueStats st;
+    work_get_stats(&st);
+
+    vga_print("Workers: ");
+    vga_print_int(st.workers);
+    vga_print(" (");
+    vga_print_int(st.busy);
+    vga_print(" busy)  Deepest queue: ");
+    vga_print_int(st.max_depth);
+    vga_print("  Flushes: ");
+    vga_print_int(st.flushes);
+    vga_print("\nLongest item: ");
+    print_us((uint32_t)st.max_run_ns);
+    vga_print("\n\n");
+
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("PRIO");
+    print_to_col(8);  vga_print("QUEUED");
+    print_to_col(16); vga_print("RUN");
+    print_to_col(24); vga_print("DEPTH");
+    print_to_col(31); vga_print("AVG WAIT");
+    print_to_col(45); vga_print("MAX WAIT\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+
+    for (int p = 0; p < WORK_PRIORITIES; p++) {
+        vga_print(prio_names[p]);
+        print_to_col(8);  vga_print_int(st.queued[p]);
+        print_to_col(16); vga_print_int(st.run[p]);
+        print_to_col(24); vga_print_int(st.depth[p]);
+        print_to_col(31);
+        if (st.run[p]) {
+            print_us((uint32_t)div64_32(st.wait_ns[p], st.run[p], 0));
+            print_to_col(45);
+            print_us((uint32_t)st.max_wait_ns[p]);
+        } else {
+            vga_print("-");
+            print_to_col(45);
+            vga_print("-");
+        }
+        vga_put_char('\n');
+    }
+}
+
+// sysbench: a ring-3 task times the null system call through SYSENTER and
+// through the int 0x80 gate, and prints the results itself. Everything it
+// runs or reads has to live in the user sections (see user.h), hence its
+// own little string helpers. Batches keep every TSC delta within 32 bits.
+#define SYSBENCH_BATCH  1000
+#define SYSBENCH_ROUNDS 64
+
+static const char sb_title[]    USER_RODATA = "Null system call from ring 3, cycles per call:\n";
+static const char sb_head[]     USER_RODATA = "  PATH            BEST     AVG\n";
+static const char sb_sysenter[] USER_RODATA = "  sysenter   ";
+static const char sb_int[]      USER_RODATA = "  int 0x80   ";
+static const char sb_no_sep[]   USER_RODATA = "  sysenter   not supported by this CPU\n";
+static const char sb_nl[]       USER_RODATA = "\n";
+
+USER_TEXT static void sb_print(const char* s) {
+    uint32_t len = 0;
+    while (s[len]) len++;
+    user_syscall_int(SYS_WRITE, (uint32_t)s, len, 0);
+}
+
+// Right-aligned in 'width' columns
+USER_TEXT static void sb_print_uint(uint32_t v, int width) {
+    char buf[12];
+    int i = 11;
+    do {
+        buf[--i] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (11 - i < width) buf[--i] = ' ';
+    user_syscall_int(SYS_WRITE, (uint32_t)&buf[i], 11 - i, 0);
+}
+
+USER_TEXT static uint32_t sb_rdtsc() {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+USER_TEXT static void sb_time(const char* label, bool fast) {
+    uint32_t best = 0xFFFFFFFF, sum = 0;
+    for (int r = 0; r < SYSBENCH_ROUNDS; r++) {
+        uint32_t start = sb_rdtsc();
+        if (fast) {
+            for (int i = 0; i < SYSBENCH_BATCH; i++) user_syscall(SYS_NULL, 0, 0, 0);
+        } else {
+            for (int i = 0; i < SYSBENCH_BATCH; i++) user_syscall_int(SYS_NULL, 0, 0, 0);
+        }
+        uint32_t per = (sb_rdtsc() - start) / SYSBENCH_BATCH;
+        if (per < best) best = per;
+        sum += per;
+    }
+    sb_print(label);
+    sb_print_uint(best, 8);
+    sb_print_uint(sum / SYSBENCH_ROUNDS, 8);
+    sb_print(sb_nl);
+}
+
+USER_TEXT static void sysbench_run(bool sysenter) {
+    sb_print(sb_title);
+    sb_print(sb_head);
+    if (sysenter) sb_time(sb_sysenter, true);
+    else          sb_print(sb_no_sep);
+    sb_time(sb_int, false);
+}
+
+USER_TEXT static void sysbench_main()     { sysbench_run(true); }
+USER_TEXT static void sysbench_int_only() { sysbench_run(false); }
+
+static void cmd_sysbench() {
+    int id = task_create_user(syscall_has_sysenter() ? sysbench_main : sysbench_int_only,
+                              "sysbench");
+    if (id < 0) {
+        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        vga_print("Failed to create the user task\n");
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        return;
+    }
+
+    // It prints its own results; wait until it has exited
+    while (task_find(id)) task_sleep(1);
+}
+
+// cputest: n tasks each burn through the same fixed amount of integer work.
+// Busy time is the sum of the workers' run ticks, so busy / elapsed is how
+// many CPUs were effectively working in parallel.
+#define CPUTEST_DEFAULT_TASKS 4
+#define CPUTEST_MAX_TASKS     16
+#define CPUTEST_ITERATIONS    50000000
+
+static Semaphore cputest_done = SEMAPHORE_INIT(0);
+static Spinlock cputest_lock = SPINLOCK_INIT;
+static uint32_t cputest_busy_ticks;
+static volatile uint32_t cputest_sink;
+
+static void cputest_worker() {
+    uint32_t x = (uint32_t)task_get_current_id();
+    for (uint32_t i = 0; i < CPUTEST_ITERATIONS; i++) {
+        x = x * 1103515245 + 12345;
+    }
+    cputest_sink = x;
+
+    spin_lock(&cputest_lock);
+    cputest_busy_ticks += task_get_current()->run_ticks;
+    spin_unlock(&cputest_lock);
+    sem_post(&cputest_done);
+}
+
+static void cmd_cputest(const char* args) {
+    args = skip_spaces(args);
+    int n = *args ? parse_int(args) : CPUTEST_DEFAULT_TASKS;
+    if (n < 1 || n > CPUTEST_MAX_TASKS) {
+        vga_print("Usage: cputest [1-16]\n");
+        return;
+    }
+
+    vga_print("Running ");
+    vga_print_int(n);
+    vga_print(" compute tasks on ");
+    vga_print_int(smp_get_cpu_count());
+    vga_print(" CPU(s)...\n");
+
+    cputest_busy_ticks = 0;
+    uint32_t start = timer_get_ticks();
+    int spawned = 0;
+    for (int i = 0; i < n; i++) {
+        if (task_create(cputest_worker, "cputest") >= 0) spawned++;
+    }
+    for (int i = 0; i < spawned; i++) {
+        sem_wait(&cputest_done);
+    }
+    uint32_t elapsed = timer_get_ticks() - start;
+    if (elapsed == 0) elapsed = 1;
+
+    vga_print("  Elapsed: ");
+    vga_print_int(elapsed);
+    vga_print(" ticks, CPU time: ");
+    vga_print_int(cputest_busy_ticks);
+    vga_print(" ticks, parallelism ");
+    uint32_t x10 = cputest_busy_ticks * 10 / elapsed;
+    vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
+    vga_print_int(x10 / 10);
+    vga_put_char('.');
+    vga_print_int(x10 % 10);
+    vga_print("x\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+}
+
+// rt: admitted real-time tasks. 'demo' starts a few periodic tasks that
+// each burn half their budget every period for RTDEMO_SECONDS, one that
+// tries to burn three times its budget and gets throttled, one that
+// admission control has to refuse, and a normal CPU hog per CPU that the RT
+// tasks must run ahead of. Watch their misses with ps or rt.
+#define RTDEMO_SECONDS 10
+
+struct RtDemoTask {
+    const char* name;
+    uint32_t    period_us;
+    uint32_t    budget_us;
+    uint32_t    burn;            // Per cent of the budget each job wants
+};
+
+static const RtDemoTask rtdemo_tasks[] = {
+    { "rt-sample", 20000,  4000,  50 },   // Sample and log every 20ms
+    { "rt-ctl",    10000,  2000,  50 },
+    { "rt-log",    50000, 10000,  50 },
+    { "rt-overrun", 50000, 5000, 300 },   // Throttled, the others unaffected
+    { "rt-greedy", 10000,  5000,  50 },   // Pushes the total past RT_UTIL_LIMIT
+};
+
+static volatile uint32_t rtdemo_live;    // Demo RT tasks still running
+static Spinlock rtdemo_lock = SPINLOCK_INIT;
+
+static void rtdemo_adjust(int delta) {
+    spin_lock(&rtdemo_lock);
+    rtdemo_live += delta;
+    spin_unlock(&rtdemo_lock);
+}
+
+static void rtdemo_run(uint32_t burn) {
+    Task* self = task_get_current();
+    uint64_t work = div64_32(self->rt_budget * burn, 100, 0);
+    uint64_t end  = timer_get_ns() + (uint64_t)RTDEMO_SECONDS * 1000000000;
+    while (timer_get_ns() < end) {
+        uint64_t until = timer_get_ns() + work;
+        while (timer_get_ns() < until) {}
+        task_wait_period();
+    }
+    rtdemo_adjust(-1);
+}
+
+static void rtdemo_task() {
+    rtdemo_run(50);
+}
+
+static void rtdemo_overrun() {
+    rtdemo_run(300);
+}
+
+static void rtdemo_hog() {
+    while (rtdemo_live) {}
+}
+
+static void rt_demo() {
+    if (rtdemo_live) {
+        vga_print("The demo is still running\n");
+        return;
+    }
+    for (uint32_t i = 0; i < sizeof(rtdemo_tasks) / sizeof(rtdemo_tasks[0]); i++) {
+        const RtDemoTask* d = &rtdemo_tasks[i];
+        rtdemo_adjust(1);
+        int id = task_create_rt(d->burn > 100 ? rtdemo_overrun : rtdemo_task,
+                                d->name, d->period_us, d->budget_us);
+        vga_print(d->name);
+        print_to_col(12);
+        vga_print_int(d->period_us / 1000);
+        vga_print(" ms / ");
+        vga_print_int(d->budget_us / 1000);
+        vga_print(" ms: ");
+        if (id >= 0) {
+            vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
+            vga_print("admitted");
+        } else {
+            rtdemo_adjust(-1);
+            vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+            vga_print(id == TASK_RT_REJECTED ? "rejected (overload)" : "failed");
+        }
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        vga_put_char('\n');
+    }
+    for (uint32_t i = 0; i < smp_get_cpu_count(); i++) {
+        task_create(rtdemo_hog, "rt-hog");
+    }
+    vga_print("Running for ");
+    vga_print_int(RTDEMO_SECONDS);
+    vga_print(" s against ");
+    vga_print_int(smp_get_cpu_count());
+    vga_print(" CPU hog(s)\n\n");
+}
+
+static void cmd_rt(const char* args) {
+    args = skip_spaces(args);
+    if (str_eq(args, "demo")) {
+        rt_demo();
+    } else if (*args) {
+        vga_print("Usage: rt [demo]\n");
+        return;
+    }
+
+    vga_print("Admitted utilization: ");
+    print_per_mille(task_rt_get_util());
+    vga_print("% of ");
+    print_per_mille(RT_UTIL_LIMIT);
+    vga_print("%\n");
+
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("ID  NAME        PERIOD    UTIL    JOBS    MISSES  THROTTLED\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    for (Task* t = task_get_list(); t; t = t->all_next) {
+        if (!t->rt_period) continue;
+        vga_print_int(t->id);
+        print_to_col(4);  vga_print(t->name ? t->name : "?");
+        print_to_col(16); vga_print_int((uint32_t)div64_32(t->rt_period, 1000000, 0));
+        vga_print(" ms");
+        print_to_col(26); print_per_mille(t->rt_util); vga_put_char('%');
+        print_to_col(34); vga_print_int(t->rt_jobs);
+        print_to_col(42);
+        if (t->rt_misses) vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        vga_print_int(t->rt_misses);
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        print_to_col(50); vga_print_int(t->rt_throttles);
+        vga_put_char('\n');
+    }
+}
+
+// fibers: n fibers multiplexed over the shell task, each sleeping a few
+// times on hrtimers, then the same ping-pong between two fibers (through
+// FiberEvents) and between two tasks (through semaphores)
+#define FIBERTEST_DEFAULT 1000
+#define FIBERTEST_MAX     4000
+#define FIBERTEST_SLEEPS  3
+#define PINGPONG_ROUNDS   20000
+
+static uint32_t fibertest_done;
+
+static void fibertest_sleeper(void* arg) {
+    uint32_t i = (uint32_t)arg;
+    for (uint32_t r = 0; r < FIBERTEST_SLEEPS; r++) {
+        fiber_sleep_ns((uint64_t)(1 + (i * 7 + r * 13) % 20) * 1000000);
+    }
+    fibertest_done++;   // Only ever touched from the host task
+}
+
+static FiberEvent fiber_ping;
+static FiberEvent fiber_pong;
+
+static void fiber_pinger(void* arg) {
+    (void)arg;
+    for (int i = 0; i < PINGPONG_ROUNDS; i++) {
+        fiber_event_signal(&fiber_pong);
+        fiber_event_wait(&fiber_ping);
+    }
+}
+
+static void fiber_ponger(void* arg) {
+    (void)arg;
+    for (int i = 0; i < PINGPONG_ROUNDS; i++) {
+        fiber_event_wait(&fiber_pong);
+        fiber_event_signal(&fiber_ping);
+    }
+}
+
+static Semaphore task_ping = SEMAPHORE_INIT(0);
+static Semaphore task_pong = SEMAPHORE_INIT(0);
+static Semaphore pingpong_done = SEMAPHORE_INIT(0);
+static Spinlock pingpong_lock = SPINLOCK_INIT;
+static uint32_t pingpong_switches;
+
+static void pingpong_finish() {
+    Task* self = task_get_current();
+    spin_lock(&pingpong_lock);
+    pingpong_switches += self->nvcsw + self->nivcsw;
+    spin_unlock(&pingpong_lock);
+    sem_post(&pingpong_done);
+}
+
+static void task_pinger() {
+    for (int i = 0; i < PINGPONG_ROUNDS; i++) {
+        sem_post(&task_pong);
+        sem_wait(&task_ping);
+    }
+    pingpong_finish();
+}
+
+static void task_ponger() {
+    for (int i = 0; i < PINGPONG_ROUNDS; i++) {
+        sem_wait(&task_pong);
+        sem_post(&task_ping);
+    }
+    pingpong_finish();
+}
+
+static void print_switch_rate(const char* label, uint32_t switches, uint64_t elapsed_ns) {
+    uint32_t us = (uint32_t)div64_32(elapsed_ns, 1000, 0);
+    if (us == 0) us = 1;
+    if (switches == 0) switches = 1;
+    vga_print(label);
+    print_to_col(12); vga_print_int(switches);
+    print_to_col(24); vga_print_int((uint32_t)div64_32(elapsed_ns, switches, 0));
+    print_to_col(36); vga_print_int((uint32_t)div64_32((uint64_t)switches * 1000000, us, 0));
+    vga_put_char('\n');
+}
+
+static void cmd_fibers(const char* args) {
+    args = skip_spaces(args);
+    int n = *args ? parse_int(args) : FIBERTEST_DEFAULT;
+    if (n < 1 || n > FIBERTEST_MAX) {
+        vga_print("Usage: fibers [1-4000]\n");
+        return;
+    }
+
+    // Lots of concurrent sleepers on one task
+    FiberHost host;
+    fiber_host_init(&host);
+    fibertest_done = 0;
+    uint32_t heap_before = kheap_get_used_bytes();
+    int created = 0;
+    for (int i = 0; i < n; i++) {
+        if (fiber_create(&host, fibertest_sleeper, (void*)i, 0)) created++;
+    }
+    uint32_t heap_used = kheap_get_used_bytes() - heap_before;
+
+    vga_print("Created ");
+    vga_print_int(created);
+    vga_print(" fibers: ");
+    vga_print_int(heap_used / 1024);
+    vga_print(" KB heap, ");
+    vga_print_int(created ? heap_used / created : 0);
+    vga_print(" + ");
+    vga_print_int(FIBER_STACK_SIZE);
+    vga_print(" stack bytes each (a task takes ");
+    vga_print_int(sizeof(Task));
+    vga_print(" + ");
+    vga_print_int(TASK_STACK_SIZE);
+    vga_print(")\n");
+
+    uint64_t start = timer_get_ns();
+    fiber_host_run(&host);
+    uint64_t elapsed = timer_get_ns() - start;
+
+    vga_print("  ");
+    vga_print_int(fibertest_done);
+    vga_print(" finished ");
+    vga_print_int(FIBERTEST_SLEEPS);
+    vga_print(" sleeps each in ");
+    vga_print_int((uint32_t)div64_32(elapsed, 1000000, 0));
+    vga_print(" ms, ");
+    vga_print_int(host.switches);
+    vga_print(" fiber switches\n\n");
+
+    // Ping-pong
+    vga_print("Ping-pong, ");
+    vga_print_int(PINGPONG_ROUNDS);
+    vga_print(" round trips:\n");
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("KIND");
+    print_to_col(12); vga_print("SWITCHES");
+    print_to_col(24); vga_print("NS/SWITCH");
+    print_to_col(36); vga_print("PER SECOND\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+
+    fiber_host_init(&host);
+    fiber_event_init(&fiber_ping);
+    fiber_event_init(&fiber_pong);
+    fiber_create(&host, fiber_pinger, 0, 0);
+    fiber_create(&host, fiber_ponger, 0, 0);
+    start = timer_get_ns();
+    fiber_host_run(&host);
+    print_switch_rate("fibers", host.switches, timer_get_ns() - start);
+
+    pingpong_switches = 0;
+    start = timer_get_ns();
+    int spawned = 0;
+    if (task_create(task_pinger, "ping") >= 0) spawned++;
+    if (task_create(task_ponger, "pong") >= 0) spawned++;
+    if (spawned < 2) {
+        vga_print("tasks      could not create both tasks\n");
+        // A lone pinger or ponger would wait forever; nothing to clean up
+        return;
+    }
+    for (int i = 0; i < spawned; i++) sem_wait(&pingpong_done);
+    print_switch_rate("tasks", pingpong_switches, timer_get_ns() - start);
+}
+
+// bench sched: RDTSC micro-benchmarks of the scheduler and interrupt paths,
+// as min/median/p99 over BENCH_SAMPLES samples so changes to task_switch.asm
+// and isr.asm can be compared run to run.
+//   yield    - two tasks pinned to one CPU yield to each other; one sample
+//              is one task's task_yield call to the other's return from it
+//   irq      - a pinned task spins on RDTSC with the per-CPU entry probe
+//              armed (percpu.h); a fast periodic hrtimer supplies timer
+//              interrupts, and a sample is the last TSC read before the
+//              interrupt to the timer handler's first line
+//   sleep(0) - task_sleep(0) called in a loop from the shell task
+#define BENCH_SAMPLES         1000
+#define BENCH_CPU             0          // Timer interrupts land on the bootstrap CPU
+#define BENCH_IRQ_PERIOD_NS   100000
+#define BENCH_IRQ_TIMEOUT_NS  2000000000ULL
+
+static uint32_t bench_cycles[BENCH_SAMPLES];
+static volatile uint32_t bench_count;
+static Spinlock bench_lock = SPINLOCK_INIT;
+static Semaphore bench_done = SEMAPHORE_INIT(0);
+
+static volatile uint64_t bench_pp_stamp;
+static volatile uint32_t bench_pp_turn;
+static HrTimer bench_timer = HRTIMER_INIT;
+
+static void bench_record(uint64_t cycles) {
+    spin_lock(&bench_lock);
+    if (bench_count < BENCH_SAMPLES) {
+        bench_cycles[bench_count++] = (cycles >> 32) ? 0xFFFFFFFF : (uint32_t)cycles;
+    }
+    spin_unlock(&bench_lock);
+}
+
+static void bench_yield_task() {
+    uint32_t me = (uint32_t)task_get_current_id();
+    while (bench_count < BENCH_SAMPLES) {
+        bench_pp_turn  = me;
+        bench_pp_stamp = rdtsc();
+        task_yield();
+        uint64_t now = rdtsc();
+        if (bench_pp_turn != me) bench_record(now - bench_pp_stamp);
+    }
+    sem_post(&bench_done);
+}
+
+static void bench_timer_fired(HrTimer* timer) {
+    (void)timer;   // Only here to cause interrupts
+}
+
+static void bench_irq_task() {
+    PerCpu* cpu = this_cpu();   // Pinned, so it stays ours
+    uint64_t give_up = timer_get_ns() + BENCH_IRQ_TIMEOUT_NS;
+    while (bench_count < BENCH_SAMPLES && timer_get_ns() < give_up) {
+        uint64_t before = rdtsc();
+        cpu->irq_probe_armed = 1;
+        while (cpu->irq_probe_armed) before = rdtsc();
+
+        uint32_t v = cpu->irq_probe_vector;
+        if (v == 32 || v == LAPIC_TIMER_VECTOR || v == LAPIC_ONESHOT_VECTOR) {
+            bench_record(cpu->irq_probe_tsc - before);
+        }
+    }
+    sem_post(&bench_done);
+}
+
+// Prints one row; returns the median (0 without samples)
+static uint32_t bench_report(const char* label) {
+    uint32_t n = bench_count;
+    // Insertion sort - a thousand samples, once
+    for (uint32_t i = 1; i < n; i++) {
+        uint32_t v = bench_cycles[i];
+        uint32_t j = i;
+        while (j > 0 && bench_cycles[j - 1] > v) {
+            bench_cycles[j] = bench_cycles[j - 1];
+            j--;
+        }
+        bench_cycles[j] = v;
+    }
+
+    vga_print(label);
+    print_to_col(16); vga_print_int(n);
+    if (n == 0) {
+        print_to_col(25);
+        vga_print("-\n");
+        return 0;
+    }
+    print_to_col(25); print_cycles(bench_cycles[0]);
+    print_to_col(35); print_cycles(bench_cycles[n / 2]);
+    print_to_col(45); print_cycles(bench_cycles[n * 99 / 100]);
+    vga_put_char('\n');
+    return bench_cycles[n / 2];
+}
+
+static void bench_header() {
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("TEST");
+    print_to_col(16); vga_print("SAMPLES");
+    print_to_col(25); vga_print("MIN");
+    print_to_col(35); vga_print("MEDIAN");
+    print_to_col(45); vga_print("P99 (cycles)\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+}
+
+static void bench_sched() {
+    bench_header();
+
+    bench_count = 0;
+    int spawned = 0;
+    if (task_create_pinned(bench_yield_task, "bench-yield", BENCH_CPU) >= 0) spawned++;
+    if (task_create_pinned(bench_yield_task, "bench-yield", BENCH_CPU) >= 0) spawned++;
+    for (int i = 0; i < spawned; i++) sem_wait(&bench_done);
+    bench_report("yield");
+
+    bench_count = 0;
+    hrtimer_start_periodic(&bench_timer, BENCH_IRQ_PERIOD_NS, bench_timer_fired);
+    if (task_create_pinned(bench_irq_task, "bench-irq", BENCH_CPU) >= 0) {
+        sem_wait(&bench_done);
+    }
+    hrtimer_cancel(&bench_timer);
+    bench_report("timer irq");
+
+    bench_count = 0;
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        uint64_t start = rdtsc();
+        task_sleep(0);
+        bench_record(rdtsc() - start);
+    }
+    bench_report("sleep(0)");
+}
+
+// bench irq: 'int' round trips through the common stub (isr_common and
+// isr_handler's dispatch and EOI choice) and through the fast one, on the
+// software-only ISR_BENCH_VECTOR with a no-op handler - no device owns it,
+// so switching its gate can never swallow a real interrupt on another CPU.
+// The bottom half is held off (marked active) so neither path runs deferred
+// work or switches tasks: what is left is entry, dispatch, EOI and exit.
+// The local APIC EOIs find nothing in service and are ignored.
+static void bench_irq_noop(registers_t* regs) {
+    (void)regs;
+}
+
+static void bench_irq_round(bool fast) {
+    uint32_t flags = irq_save();
+    PerCpu* cpu = this_cpu();
+    isr_set_fast_path(ISR_BENCH_VECTOR, fast);
+    cpu->bottom_half_active = 1;
+
+    bench_count = 0;
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        uint64_t start = rdtsc();
+        __asm__ volatile("int %0" : : "i"(ISR_BENCH_VECTOR));
+        bench_record(rdtsc() - start);
+    }
+
+    cpu->bottom_half_active = 0;
+    irq_restore(flags);
+}
+
+static void bench_irq() {
+    if (!lapic_present()) {
+        vga_print("bench irq needs a local APIC (the EOI goes there)\n");
+        return;
+    }
+    register_interrupt_handler(ISR_BENCH_VECTOR, bench_irq_noop);
+
+    bench_header();
+    bench_irq_round(false);
+    uint32_t common = bench_report("isr_common");
+    bench_irq_round(true);
+    uint32_t fast = bench_report("fast stub");
+
+    if (common > fast) {
+        vga_print("Fast path saves ");
+        vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
+        vga_print_int(common - fast);
+        vga_print(" cycles");
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        vga_print(" per interrupt at the median (");
+        print_per_mille((common - fast) * 1000 / common);
+        vga_print("%)\n");
+    }
+}
+
+static void cmd_bench(const char* args) {
+    args = skip_spaces(args);
+    if (str_eq(args, "sched")) {
+        bench_sched();
+    } else if (str_eq(args, "irq")) {
+        bench_irq();
+    } else {
+        vga_print("Usage: bench sched|irq\n");
+    }
+}
+
+// irqstat: every vector seen since boot (or the last reset), with its rate
+// over a one second window and how long its handler takes
+#define IRQSTAT_WINDOW_MS 1000
+
+static const char* exception_names[32] = {
+    "divide", "debug", "nmi", "breakpoint", "overflow", "bound", "invalid op",
+    "no fpu", "double fault", "fpu segment", "bad tss", "not present",
+    "stack fault", "gpf", "page fault", "reserved", "x87 fpu", "alignment",
+    "machine check", "simd fpu", "virt", "control prot", "reserved",
+    "reserved", "reserved", "reserved", "reserved", "reserved", "reserved",
+    "reserved", "security", "reserved"
+};
+
+static const char* vector_name(int v) {
+    if (v < 32) return exception_names[v];
+    switch (v) {
+        case 32:                    return "timer";
+        case 33:                    return "keyboard";
+        case 39:                    return "irq7";
+        case 46:                    return "ata";
+        case ISR_BENCH_VECTOR:      return "bench";
+        case 47:                    return "irq15";
+        case SYSCALL_VECTOR:        return "syscall";
+        case LAPIC_ONESHOT_VECTOR:  return "oneshot";
+        case LAPIC_TIMER_VECTOR:    return "lapic timer";
+        case IPI_RESCHED_VECTOR:    return "resched ipi";
+        case LAPIC_SPURIOUS_VECTOR: return "spurious";
+        default:                    return v < 48 ? "irq" : "-";
+    }
+}
+
+static uint32_t irqstat_before[256];
+
+// irqstat nest: a slow handler on a spare ISA line, raised with int from a
+// task on the CPU that takes the PIT, once with interrupts off throughout
+// and once nested. Ticks that land inside it show whether the timer got
+// through; the missed-tick count shows what it cost when it could not.
+#define IRQNEST_IRQ     5
+#define IRQNEST_CPU     0          // Timer interrupts land on the bootstrap CPU
+#define IRQNEST_BUSY_MS 50
+
+static volatile uint32_t irqnest_ticks;
+static uint32_t irqnest_missed;
+static Semaphore irqnest_done = SEMAPHORE_INIT(0);
+
+static void irqnest_handler(registers_t* regs) {
+    (void)regs;
+    uint32_t start = timer_get_ticks();
+    uint64_t end = rdtsc() + (uint64_t)timer_get_tsc_khz() * IRQNEST_BUSY_MS;
+    while (rdtsc() < end) {}
+    irqnest_ticks = timer_get_ticks() - start;
+}
+
+static void irqnest_task() {
+    uint32_t missed = timer_get_missed_ticks();
+    __asm__ volatile("int %0" : : "i"(32 + IRQNEST_IRQ));
+    irqnest_missed = timer_get_missed_ticks() - missed;
+    sem_post(&irqnest_done);
+}
+
+static void irqnest_demo() {
+    if (!timer_get_tsc_khz()) {
+        vga_print("Needs the TSC clock source to spot missed ticks\n");
         return;
     }
-    
-    // Parse filename (first word)
-    char filename[64];
-    int fi = 0;
-    while (*args && *args != ' ' && fi < 63) {
-        filename[fi++] = *args++;
+
+    isr_handler_t old_handler = isr_get_handler(32 + IRQNEST_IRQ);
+    bool old_nested = irq_get_nested(IRQNEST_IRQ);
+    register_interrupt_handler(32 + IRQNEST_IRQ, irqnest_handler);
+
+    vga_print("Handler on IRQ");
+    vga_print_int(IRQNEST_IRQ);
+    vga_print(" (priority ");
+    vga_print_int(irq_get_priority(IRQNEST_IRQ));
+    vga_print(") busy for ");
+    vga_print_int(IRQNEST_BUSY_MS);
+    vga_print("ms, timer at priority ");
+    vga_print_int(irq_get_priority(0));
+    vga_print(":\n");
+
+    for (int nested = 0; nested < 2; nested++) {
+        irq_set_nested(IRQNEST_IRQ, nested);
+        if (task_create_pinned(irqnest_task, "irqnest", IRQNEST_CPU) < 0) break;
+        sem_wait(&irqnest_done);
+
+        vga_print(nested ? "  nested          " : "  interrupts off  ");
+        vga_print_int(irqnest_ticks);
+        vga_print(" ticks inside, ");
+        if (irqnest_missed) vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        else                vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
+        vga_print_int(irqnest_missed);
+        vga_print(" missed\n");
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
     }
-    filename[fi] = '\0';
-    
-    // Rest is the content
+
+    irq_set_nested(IRQNEST_IRQ, old_nested);
+    register_interrupt_handler(32 + IRQNEST_IRQ, old_handler);
+    vga_put_char('\n');
+}
+
+static void cmd_irqstat(const char* args) {
     args = skip_spaces(args);
-    if (*args == '\0') {
-        vga_print("Usage: write <filename> <text>\n");
+    if (str_eq(args, "reset")) {
+        irqstat_reset();
+        vga_print("Interrupt stats cleared\n");
+        return;
+    } else if (str_eq(args, "nest")) {
+        irqnest_demo();
+    } else if (*args) {
+        vga_print("Usage: irqstat [reset|nest]\n");
         return;
     }
-    
-    int len = str_len(args);
-    
-    int result = fat16_create_file(filename, args, (uint32_t)len);
-    if (result == 0) {
-        vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
-        vga_print("Wrote ");
-        vga_print_int(len);
-        vga_print(" bytes to ");
-        vga_print(filename);
+
+    IrqStats st;
+    for (int v = 0; v < 256; v++) {
+        irqstat_get(v, &st);
+        irqstat_before[v] = st.count;
+    }
+    uint64_t start = timer_get_ns();
+    sleep_ms(IRQSTAT_WINDOW_MS);
+    uint32_t window_ns = (uint32_t)(timer_get_ns() - start);
+
+    vga_set_color(VGA_YELLOW, VGA_BLACK);
+    vga_print("VEC");
+    print_to_col(5);  vga_print("NAME");
+    print_to_col(19); vga_print("COUNT");
+    print_to_col(30); vga_print("PER SEC");
+    print_to_col(39); vga_print("AVG CYC");
+    print_to_col(49); vga_print("MAX CYC");
+    print_to_col(59); vga_print("NESTED");
+    print_to_col(67); vga_print("SPURIOUS\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+
+    for (int v = 0; v < 256; v++) {
+        irqstat_get(v, &st);
+        if (!st.count) continue;
+
+        vga_print_int(v);
+        print_to_col(5);  vga_print(vector_name(v));
+        print_to_col(19); vga_print_int(st.count);
+        print_to_col(30);
+        uint64_t in_window = st.count - irqstat_before[v];
+        vga_print_int((int)div64_32(in_window * 1000000000ULL, window_ns, 0));
+
+        // Exceptions and system calls are counted, not timed
+        uint32_t timed = st.count - st.spurious;
+        print_to_col(39);
+        if (st.total_cycles && timed) {
+            print_cycles(div64_32(st.total_cycles, timed, 0));
+            print_to_col(49);
+            print_cycles(st.max_cycles);
+        } else {
+            vga_print("-");
+            print_to_col(49);
+            vga_print("-");
+        }
+        print_to_col(59); vga_print_int(st.nested);
+        print_to_col(67); vga_print_int(st.spurious);
         vga_put_char('\n');
-    } else {
-        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
-        vga_print("Failed to write file\n");
     }
-    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
-}
 
-static void cmd_touch(const char* args) {
-    args = skip_spaces(args);
-    if (*args == '\0') {
-        vga_print("Usage: touch <filename>\n");
-        return;
+    vga_print("\nMissed timer ticks: ");
+    vga_print_int(timer_get_missed_ticks());
+    if (!timer_get_tsc_khz()) vga_print(" (needs the TSC clock)");
+    vga_print("  Deepest nesting: ");
+    vga_print_int(irqstat_get_max_depth());
+
+    uint32_t hist[IRQSTAT_DEPTHS];
+    irqstat_get_depth_hist(hist);
+    vga_print("\nHandler runs by depth:");
+    for (int d = 0; d < IRQSTAT_DEPTHS; d++) {
+        vga_print("  ");
+        vga_print_int(d);
+        if (d == IRQSTAT_DEPTHS - 1) vga_put_char('+');
+        vga_print(": ");
+        vga_print_int(hist[d]);
     }
-    
-    // Check if file already exists
-    int size = fat16_file_size(args);
-    if (size >= 0) {
-        vga_print("File already exists (");
-        vga_print_int(size);
-        vga_print(" bytes)\n");
+
+    uint32_t held = 0;
+    for (int v = 32; v < 48; v++) {
+        irqstat_get(v, &st);
+        held += st.deferred;
+    }
+    vga_print("\nHeld off by priority: ");
+    vga_print_int(held);
+    vga_put_char('\n');
+}
+
+// diskbench: read the start of the disk in big requests, once with PIO and
+// once with DMA. The buffer is physically contiguous and identity mapped,
+// so DMA goes straight into it - no bounce copy.
+#define DISKBENCH_BYTES   (4 * 1024 * 1024)
+#define DISKBENCH_SECTORS 128              // Per request: 64KB
+
+static void cmd_diskbench() {
+    uint32_t frames = DISKBENCH_SECTORS * ATA_SECTOR_SIZE / PAGE_SIZE;
+    uint8_t* buf = (uint8_t*)pmm_alloc_contiguous(frames, 0x400000);   // Identity mapped
+    if (!buf) {
+        vga_print("No memory for the buffer\n");
         return;
     }
-    
-    int result = fat16_create_file(args, nullptr, 0);
-    if (result == 0) {
+
+    vga_print("Sequential read, ");
+    vga_print_int(DISKBENCH_BYTES / (1024 * 1024));
+    vga_print("MB in ");
+    vga_print_int(DISKBENCH_SECTORS * ATA_SECTOR_SIZE / 1024);
+    vga_print("KB requests:\n");
+
+    bool was_dma = ata_dma_enabled();
+    for (int dma = 0; dma < 2; dma++) {
+        vga_print(dma ? "  DMA  " : "  PIO  ");
+        if (dma && !ata_dma_available()) {
+            vga_print("not available\n");
+            continue;
+        }
+        ata_set_dma(dma);
+
+        int err = 0;
+        uint64_t start = timer_get_ns();
+        for (uint32_t lba = 0; lba < DISKBENCH_BYTES / ATA_SECTOR_SIZE && !err; lba += DISKBENCH_SECTORS) {
+            err = ata_read_sectors(lba, DISKBENCH_SECTORS, buf);
+        }
+        uint32_t us = (uint32_t)div64_32(timer_get_ns() - start, 1000, 0);
+
+        if (err) {
+            vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+            vga_print("read failed (error ");
+            vga_print_int(err);
+            vga_print(")\n");
+            vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+            continue;
+        }
+        if (dma && !ata_dma_enabled()) {
+            vga_print("fell back to PIO - ");
+        }
+
+        // Tenths of a MB/s
+        if (us == 0) us = 1;
+        uint64_t bytes_per_s = div64_32((uint64_t)DISKBENCH_BYTES * 1000000, us, 0);
+        uint32_t tenths = (uint32_t)div64_32(bytes_per_s * 10, 1024 * 1024, 0);
         vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
-        vga_print("Created ");
-        vga_print(args);
-        vga_put_char('\n');
-    } else {
-        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
-        vga_print("Failed to create file\n");
+        vga_print_int(tenths / 10);
+        vga_put_char('.');
+        vga_print_int(tenths % 10);
+        vga_print(" MB/s");
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        vga_print("  (");
+        vga_print_int(us / 1000);
+        vga_print(" ms)\n");
+    }
+    ata_set_dma(was_dma);
+
+    for (uint32_t i = 0; i < frames; i++) {
+        pmm_free_frame(buf + i * PAGE_SIZE);
     }
-    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
 }
 
-static void cmd_rm(const char* args) {
-    args = skip_spaces(args);
-    if (*args == '\0') {
-        vga_print("Usage: rm <filename>\n");
-        return;
+// 'digits' hex digits, no 0x
+static void print_hex_digits(uint32_t value, int digits) {
+    const char* hex_chars = "0123456789abcdef";
+    for (int i = (digits - 1) * 4; i >= 0; i -= 4) {
+        vga_put_char(hex_chars[(value >> i) & 0xF]);
     }
-    
-    int result = fat16_delete(args);
-    if (result == 0) {
-        vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
-        vga_print("Deleted ");
-        vga_print(args);
-        vga_put_char('\n');
+}
+
+static void print_bar(int index, const PciBar* bar) {
+    vga_print("         BAR");
+    vga_print_int(index);
+    vga_print(bar->io ? "  I/O " : "  mem ");
+    if (bar->above_4g) vga_print("above 4GB");
+    else if (!bar->base) vga_print("unassigned");
+    else vga_print_hex(bar->base);
+    vga_print("  ");
+    if (bar->size >= 1024 * 1024) {
+        vga_print_int(bar->size / (1024 * 1024));
+        vga_print("MB");
+    } else if (bar->size >= 1024) {
+        vga_print_int(bar->size / 1024);
+        vga_print("KB");
     } else {
-        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
-        vga_print("File not found: ");
-        vga_print(args);
-        vga_put_char('\n');
+        vga_print_int(bar->size);
+        vga_print(" bytes");
     }
-    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    if (bar->prefetchable) vga_print(", prefetchable");
+    vga_put_char('\n');
 }
 
-// Demo task that counts to 5 with 1-second pauses, then exits
-static void demo_counter_task() {
-    for (int i = 0; i < 5; i++) {
-        vga_set_color(VGA_LIGHT_CYAN, VGA_BLACK);
-        vga_print("[task ");
-        vga_print_int(task_get_current_id());
-        vga_print("] count ");
-        vga_print_int(i);
-        vga_put_char('\n');
-        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
-        task_sleep(100);  // 100 ticks = 1 second at 100Hz
+// lspci: what pci_init found, and which driver took each device
+static void cmd_lspci(const char* args) {
+    args = skip_spaces(args);
+    bool verbose = str_eq(args, "-v");
+    if (*args && !verbose) {
+        vga_print("Usage: lspci [-v]\n");
+        return;
+    }
+
+    int count = pci_get_device_count();
+    if (count == 0) {
+        vga_print("No PCI devices found\n");
+        return;
     }
-    vga_set_color(VGA_LIGHT_CYAN, VGA_BLACK);
-    vga_print("[task ");
-    vga_print_int(task_get_current_id());
-    vga_print("] done!\n");
-    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
-    task_exit();
-}
 
-static void cmd_ps() {
-    Task* list = task_get_list();
     vga_set_color(VGA_YELLOW, VGA_BLACK);
-    vga_print("ID  STATE     NAME\n");
+    vga_print("BUS:DV.F ID         CLASS  IRQ  DRIVER  DESCRIPTION\n");
     vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (list[i].state == TASK_DEAD) continue;
-        vga_print_int(list[i].id);
-        vga_print("   ");
-        switch (list[i].state) {
-            case TASK_RUNNING:  vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK); vga_print("RUNNING   "); break;
-            case TASK_READY:    vga_set_color(VGA_LIGHT_CYAN, VGA_BLACK);  vga_print("READY     "); break;
-            case TASK_SLEEPING: vga_set_color(VGA_YELLOW, VGA_BLACK);      vga_print("SLEEPING  "); break;
-            default: break;
-        }
-        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
-        vga_print(list[i].name ? list[i].name : "?");
+
+    for (int i = 0; i < count; i++) {
+        PciDevice* d = pci_get_device(i);
+        print_hex_digits(d->bus, 2);
+        vga_put_char(':');
+        print_hex_digits(d->dev, 2);
+        vga_put_char('.');
+        print_hex_digits(d->fn, 1);
+        print_to_col(9);
+        print_hex_digits(d->vendor_id, 4);
+        vga_put_char(':');
+        print_hex_digits(d->device_id, 4);
+        print_to_col(20);
+        print_hex_digits(d->class_code, 2);
+        vga_put_char('.');
+        print_hex_digits(d->subclass, 2);
+        print_to_col(27);
+        if (d->irq_line && d->irq_line < 16) vga_print_int(d->irq_line);
+        else vga_put_char('-');
+        print_to_col(32);
+        vga_print(d->driver ? d->driver->name : "-");
+        print_to_col(40);
+        vga_print(pci_class_name(d->class_code, d->subclass));
         vga_put_char('\n');
+
+        if (!verbose) continue;
+        for (int b = 0; b < 6; b++) {
+            if (d->bar[b].size) print_bar(b, &d->bar[b]);
+        }
+    }
+
+    uint32_t dropped = pci_get_dropped_count();
+    if (dropped) {
+        vga_print_int(dropped);
+        vga_print(" more not listed (table full)\n");
     }
 }
 
@@ -730,7 +2486,7 @@ static void cmd_spawn() {
     int id = task_create(demo_counter_task, "counter");
     if (id < 0) {
         vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
-        vga_print("Failed to spawn task (max tasks reached?)\n");
+        vga_print("Failed to spawn task (out of memory?)\n");
         vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
     } else {
         vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
@@ -741,6 +2497,218 @@ static void cmd_spawn() {
     }
 }
 
+// Parks a per-task value in x87 st0 (and xmm0 when SSE is on), sleeps so
+// the other checker tasks run and load their own values, then verifies the
+// registers came back untouched.
+static void fpu_check_task() {
+    int id = task_get_current_id();
+    uint32_t pattern[4] = { (uint32_t)id, (uint32_t)id * 3, (uint32_t)id * 5, (uint32_t)id * 7 };
+    uint32_t check[4];
+    int in = id * 1000 + 7;
+    int out = 0;
+    bool sse = fpu_has_sse();
+    bool ok = true;
+
+    for (int round = 0; round < 5 && ok; round++) {
+        __asm__ volatile("fildl %0" : : "m"(in));
+        if (sse) __asm__ volatile("movdqu (%0), %%xmm0" : : "r"(pattern) : "memory");
+
+        task_sleep(5);
+
+        if (sse) __asm__ volatile("movdqu %%xmm0, (%0)" : : "r"(check) : "memory");
+        __asm__ volatile("fistpl %0" : "=m"(out));
+
+        if (out != in) ok = false;
+        for (int i = 0; sse && i < 4; i++) {
+            if (check[i] != pattern[i]) ok = false;
+        }
+    }
+
+    vga_set_color(ok ? VGA_LIGHT_GREEN : VGA_LIGHT_RED, VGA_BLACK);
+    vga_print("[task ");
+    vga_print_int(id);
+    vga_print(ok ? "] FPU state intact\n" : "] FPU state CORRUPTED\n");
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    task_exit();
+}
+
+static void cmd_fputest() {
+    vga_print("SSE: ");
+    vga_print(fpu_has_sse() ? "yes" : "no (x87 only)");
+    vga_print("\nSpawning 3 FPU checker tasks...\n");
+    for (int i = 0; i < 3; i++) {
+        if (task_create(fpu_check_task, "fputest") < 0) {
+            vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+            vga_print("Failed to spawn task\n");
+            vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+            return;
+        }
+    }
+}
+
+// synctest: worker tasks do a deliberately slow read-modify-write on a shared
+// counter (yielding in the middle), serialized by a mutex. The shell waits on
+// a semaphore that each worker posts when it finishes.
+//
+// Then the shell sleeps on a semaphore posted from the timer interrupt, with
+// interrupts off, and checks it comes back from sem_wait with them on again.
+#define SYNCTEST_WORKERS   4
+#define SYNCTEST_ROUNDS    200
+#define SYNCTEST_IRQ_POSTS 20
+#define SYNCTEST_IRQ_NS    2000000         // Long enough that we sleep first
+
+static Mutex synctest_lock = MUTEX_INIT;
+static Semaphore synctest_done = SEMAPHORE_INIT(0);
+static volatile uint32_t synctest_counter;
+
+static Semaphore synctest_irq_sem = SEMAPHORE_INIT(0);
+static HrTimer synctest_timer = HRTIMER_INIT;
+
+static void synctest_irq_post(HrTimer* timer) {
+    (void)timer;
+    sem_post(&synctest_irq_sem);
+}
+
+static void print_pass_fail(bool pass) {
+    if (pass) {
+        vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
+        vga_print("PASS\n");
+    } else {
+        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        vga_print("FAIL\n");
+    }
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+}
+
+static void synctest_worker() {
+    for (int i = 0; i < SYNCTEST_ROUNDS; i++) {
+        mutex_lock(&synctest_lock);
+        uint32_t value = synctest_counter;
+        task_yield();  // invite a race
+        synctest_counter = value + 1;
+        mutex_unlock(&synctest_lock);
+    }
+    sem_post(&synctest_done);
+}
+
+static void cmd_synctest() {
+    synctest_counter = 0;
+    vga_print("Spawning ");
+    vga_print_int(SYNCTEST_WORKERS);
+    vga_print(" workers x ");
+    vga_print_int(SYNCTEST_ROUNDS);
+    vga_print(" increments...\n");
+
+    int spawned = 0;
+    for (int i = 0; i < SYNCTEST_WORKERS; i++) {
+        if (task_create(synctest_worker, "synctest") >= 0) spawned++;
+    }
+    for (int i = 0; i < spawned; i++) {
+        sem_wait(&synctest_done);
+    }
+
+    uint32_t expected = (uint32_t)spawned * SYNCTEST_ROUNDS;
+    vga_print("  Counter: ");
+    vga_print_int(synctest_counter);
+    vga_print(" (expected ");
+    vga_print_int(expected);
+    vga_print(") ");
+    print_pass_fail(synctest_counter == expected);
+
+    int irq_off = 0;
+    for (int i = 0; i < SYNCTEST_IRQ_POSTS; i++) {
+        hrtimer_start(&synctest_timer, SYNCTEST_IRQ_NS, synctest_irq_post);
+        sem_wait(&synctest_irq_sem);
+        uint32_t flags = irq_save();
+        irq_restore(flags);
+        if (!(flags & EFLAGS_IF)) {
+            irq_off++;
+            __asm__ volatile("sti");
+        }
+    }
+    vga_print("  Posted from IRQ: ");
+    vga_print_int(irq_off);
+    vga_print("/");
+    vga_print_int(SYNCTEST_IRQ_POSTS);
+    vga_print(" wakeups with interrupts off ");
+    print_pass_fail(irq_off == 0);
+}
+
+// tasktest: n tasks that only sleep, then killed one by one. Every task
+// costs its Task on the heap and a one-page stack above a guard page, and
+// the reaper has to hand all of those stacks back to the pool.
+#define TASKTEST_DEFAULT  2000
+#define TASKTEST_MAX      6000
+#define TASKTEST_SLEEP_NS 60000000000ULL
+#define TASKTEST_REAP_MS  2000
+
+static void tasktest_sleeper() {
+    for (;;) task_sleep_ns(TASKTEST_SLEEP_NS);
+}
+
+static void cmd_tasktest(const char* args) {
+    args = skip_spaces(args);
+    int n = *args ? parse_int(args) : TASKTEST_DEFAULT;
+    if (n < 1 || n > TASKTEST_MAX) {
+        vga_print("Usage: tasktest [1-6000]\n");
+        return;
+    }
+    int* ids = (int*)kmalloc(n * sizeof(int));
+    if (!ids) {
+        vga_print("Out of heap\n");
+        return;
+    }
+
+    uint32_t heap_before   = kheap_get_used_bytes();
+    uint32_t stacks_before = kstack_get_in_use();
+    uint64_t start = timer_get_ns();
+    int created = 0;
+    while (created < n) {
+        int id = task_create(tasktest_sleeper, "tasktest");
+        if (id < 0) break;
+        ids[created++] = id;
+    }
+    uint64_t create_ns = timer_get_ns() - start;
+
+    vga_print("Created ");
+    vga_print_int(created);
+    vga_print(" of ");
+    vga_print_int(n);
+    vga_print(" tasks in ");
+    vga_print_int((uint32_t)div64_32(create_ns, 1000000, 0));
+    vga_print(" ms: ");
+    vga_print_int((kheap_get_used_bytes() - heap_before) / 1024);
+    vga_print(" KB heap, ");
+    vga_print_int(kstack_get_in_use() - stacks_before);
+    vga_print(" stacks, ");
+    vga_print_int(task_get_count());
+    vga_print(" tasks live\n");
+
+    start = timer_get_ns();
+    int killed = 0;
+    for (int i = 0; i < created; i++) {
+        if (task_kill((uint32_t)ids[i]) == 0) killed++;
+    }
+    uint64_t kill_ns = timer_get_ns() - start;
+    kfree(ids);
+
+    // The reaper frees the stacks in the background
+    for (int ms = 0; ms < TASKTEST_REAP_MS && kstack_get_in_use() > stacks_before; ms++) {
+        task_sleep_ns(1000000);
+    }
+
+    vga_print("Killed ");
+    vga_print_int(killed);
+    vga_print(" in ");
+    vga_print_int((uint32_t)div64_32(kill_ns, 1000000, 0));
+    vga_print(" ms, stacks in use ");
+    vga_print_int(kstack_get_in_use());
+    vga_print(" (was ");
+    vga_print_int(stacks_before);
+    vga_print(") ");
+    print_pass_fail(created == n && killed == created && kstack_get_in_use() == stacks_before);
+}
+
 static void cmd_kill(const char* args) {
     args = skip_spaces(args);
     if (*args == '\0') {
@@ -754,17 +2722,19 @@ static void cmd_kill(const char* args) {
         vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
         return;
     }
-    Task* list = task_get_list();
-    for (int i = 1; i < MAX_TASKS; i++) {
-        if (list[i].state != TASK_DEAD && (int)list[i].id == id) {
-            list[i].state = TASK_DEAD;
-            vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
-            vga_print("Killed task ");
-            vga_print_int(id);
-            vga_put_char('\n');
-            vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
-            return;
-        }
+    if (id == task_get_current_id()) {
+        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        vga_print("Cannot kill the shell\n");
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        return;
+    }
+    if (task_kill((uint32_t)id) == 0) {
+        vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
+        vga_print("Killed task ");
+        vga_print_int(id);
+        vga_put_char('\n');
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        return;
     }
     vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
     vga_print("No task with id ");
@@ -849,6 +2819,15 @@ static void shell_execute() {
     else if (str_eq(cmd, "memtest")) {
         cmd_memtest();
     }
+    else if (str_eq(cmd, "diskbench")) {
+        cmd_diskbench();
+    }
+    else if (str_eq(cmd, "lspci")) {
+        cmd_lspci("");
+    }
+    else if (str_starts_with(cmd, "lspci ")) {
+        cmd_lspci(cmd + 6);
+    }
     else if (str_eq(cmd, "disktest")) {
         cmd_disktest();
     }
@@ -873,12 +2852,90 @@ static void shell_execute() {
     else if (str_eq(cmd, "ps")) {
         cmd_ps();
     }
+    else if (str_eq(cmd, "top")) {
+        cmd_top();
+    }
+    else if (str_eq(cmd, "schedlat")) {
+        cmd_schedlat("");
+    }
+    else if (str_starts_with(cmd, "schedlat ")) {
+        cmd_schedlat(cmd + 9);
+    }
+    else if (str_eq(cmd, "smp")) {
+        cmd_smp();
+    }
+    else if (str_eq(cmd, "apic")) {
+        cmd_apic();
+    }
+    else if (str_eq(cmd, "clock")) {
+        cmd_clock();
+    }
+    else if (str_eq(cmd, "hrtimer")) {
+        cmd_hrtimer();
+    }
+    else if (str_eq(cmd, "sysbench")) {
+        cmd_sysbench();
+    }
+    else if (str_eq(cmd, "workq")) {
+        cmd_workq("");
+    }
+    else if (str_starts_with(cmd, "workq ")) {
+        cmd_workq(cmd + 6);
+    }
+    else if (str_eq(cmd, "stacks")) {
+        cmd_stacks("");
+    }
+    else if (str_starts_with(cmd, "stacks ")) {
+        cmd_stacks(cmd + 7);
+    }
+    else if (str_eq(cmd, "cputest")) {
+        cmd_cputest("");
+    }
+    else if (str_starts_with(cmd, "cputest ")) {
+        cmd_cputest(cmd + 8);
+    }
+    else if (str_eq(cmd, "bench")) {
+        cmd_bench("");
+    }
+    else if (str_starts_with(cmd, "bench ")) {
+        cmd_bench(cmd + 6);
+    }
+    else if (str_eq(cmd, "irqstat")) {
+        cmd_irqstat("");
+    }
+    else if (str_starts_with(cmd, "irqstat ")) {
+        cmd_irqstat(cmd + 8);
+    }
+    else if (str_eq(cmd, "rt")) {
+        cmd_rt("");
+    }
+    else if (str_starts_with(cmd, "rt ")) {
+        cmd_rt(cmd + 3);
+    }
+    else if (str_eq(cmd, "fibers")) {
+        cmd_fibers("");
+    }
+    else if (str_starts_with(cmd, "fibers ")) {
+        cmd_fibers(cmd + 7);
+    }
     else if (str_eq(cmd, "spawn")) {
         cmd_spawn();
     }
     else if (str_starts_with(cmd, "kill ")) {
         cmd_kill(cmd + 5);
     }
+    else if (str_eq(cmd, "fputest")) {
+        cmd_fputest();
+    }
+    else if (str_eq(cmd, "synctest")) {
+        cmd_synctest();
+    }
+    else if (str_eq(cmd, "tasktest")) {
+        cmd_tasktest("");
+    }
+    else if (str_starts_with(cmd, "tasktest ")) {
+        cmd_tasktest(cmd + 9);
+    }
     else {
         vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
         vga_print("Unknown command: ");
@@ -978,4 +3035,10 @@ void shell_handle_key(uint8_t c) {
             shell_redraw_line();
         }
     }
+}
+
+void shell_task() {
+    while (1) {
+        shell_handle_key(keyboard_getchar());
+    }
 }
\ No newline at end of file
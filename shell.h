@@ -6,4 +6,7 @@
 void shell_init();
 void shell_handle_key(uint8_t c);  // Changed to uint8_t for special keys
 
+// Shell task body: reads keys from the keyboard ring and runs commands
+void shell_task();
+
 #endif
\ No newline at end of file
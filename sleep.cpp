@@ -1,16 +1,60 @@
 #include "sleep.h"
 #include "timer.h"
+#include "cpu.h"
+#include "task.h"
+
+// Within this much of the deadline, spin rather than halt - covers the
+// interrupt entry/exit a wake-up costs
+#define SLEEP_SPIN_NS 20000
+
+// =============================================================================
+// From a task these block in the scheduler (TASK_SLEEPING until an hrtimer
+// at the exact deadline wakes it), so other tasks get the CPU meanwhile.
+// Early boot, idle tasks and interrupts-off callers wait in place instead:
+// halt until close to the deadline (woken by a one-shot timer interrupt, or
+// ticks while more than a tick is left), then spin the rest.
+// =============================================================================
 
 void sleep_ticks(uint32_t ticks) {
-    uint32_t start = timer_get_ticks();
-    while (timer_get_ticks() - start < ticks) {
-        __asm__ volatile("hlt"); 
-    }
+    sleep_ns((uint64_t)ticks * timer_get_tick_ns());
 }
 
 void sleep_ms(uint32_t milliseconds) {
-    // At 100Hz, 1 tick = 10ms, so ms/10 = ticks needed
-    // Add 1 to round up (sleep at LEAST this long)
-    uint32_t ticks = (milliseconds + 9) / 10;
-    sleep_ticks(ticks);
+    sleep_ns((uint64_t)milliseconds * 1000000);
+}
+
+void sleep_us(uint32_t microseconds) {
+    sleep_ns((uint64_t)microseconds * 1000);
+}
+
+// Wait in place - no scheduler involved
+static void sleep_busy(uint64_t nanoseconds) {
+    uint64_t deadline = timer_get_ns() + nanoseconds;
+
+    while (1) {
+        uint64_t now = timer_get_ns();
+        if (now >= deadline) return;
+        uint64_t left = deadline - now;
+
+        // Halt only if something is sure to wake us in time; with interrupts
+        // off nothing would, so just spin
+        uint32_t flags = irq_save();
+        bool halt = (flags & EFLAGS_IF) && left > SLEEP_SPIN_NS &&
+                    (timer_arm_oneshot(deadline - SLEEP_SPIN_NS) || left > timer_get_tick_ns());
+        if (halt) {
+            __asm__ volatile("sti; hlt");   // sti holds off interrupts for one instruction
+        } else {
+            irq_restore(flags);
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+void sleep_ns(uint64_t nanoseconds) {
+    // Very short delays are cheaper to spin than a trip through the scheduler
+    if (nanoseconds > SLEEP_SPIN_NS && task_can_block()) {
+        task_sleep_ns(nanoseconds);
+    } else {
+        sleep_busy(nanoseconds);
+    }
 }
\ No newline at end of file
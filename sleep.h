@@ -6,4 +6,7 @@
 void sleep_ms(uint32_t milliseconds);
 void sleep_ticks(uint32_t ticks);
 
+void sleep_us(uint32_t microseconds);
+void sleep_ns(uint64_t nanoseconds);
+
 #endif
\ No newline at end of file
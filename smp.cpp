@@ -0,0 +1,169 @@
+#include "smp.h"
+#include "percpu.h"
+#include "acpi.h"
+#include "apic.h"
+#include "gdt.h"
+#include "idt.h"
+#include "isr.h"
+#include "fpu.h"
+#include "task.h"
+#include "kheap.h"
+#include "sleep.h"
+#include "cpu.h"
+#include "syscall.h"
+
+// Trampoline (ap_boot.asm) - the parameter slots are patched in the copy
+extern "C" uint8_t ap_trampoline_start[];
+extern "C" uint8_t ap_trampoline_end[];
+extern "C" uint32_t ap_param_cr3;
+extern "C" uint32_t ap_param_stack;
+extern "C" uint32_t ap_param_entry;
+
+#define AP_STACK_SIZE     4096
+#define AP_START_TIMEOUT  100      // Ticks to wait for an AP to check in (1s)
+
+static volatile uint32_t cpu_count = 1;
+static volatile uint32_t ap_booting_cpu = 0;
+static volatile uint32_t ap_started = 0;
+
+static const char* idle_names[SMP_MAX_CPUS] = {
+    "idle", "idle1", "idle2", "idle3", "idle4", "idle5", "idle6", "idle7"
+};
+
+// Address of a symbol inside the copied trampoline
+static inline uint32_t* trampoline_slot(uint32_t* sym) {
+    return (uint32_t*)(AP_TRAMPOLINE_ADDR + ((uint8_t*)sym - ap_trampoline_start));
+}
+
+// =============================================================================
+// Per-CPU interrupt handlers
+// =============================================================================
+
+// Application processors have no PIT; their LAPIC timer drives time slices.
+// The global tick count stays with the PIT on the bootstrap CPU.
+static void lapic_timer_handler(registers_t* regs) {
+    irq_entry_probe(regs->int_no);
+    this_cpu()->local_ticks++;
+    task_account_tick();
+    task_request_resched();
+}
+
+// The sender already set our need_resched; the IRQ exit path does the rest
+static void resched_ipi_handler(registers_t* regs) {
+    (void)regs;
+    this_cpu()->resched_ipis++;
+}
+
+static void spurious_handler(registers_t* regs) {
+    (void)regs;
+}
+
+// =============================================================================
+// Application processor entry (called from the trampoline, paging on)
+// =============================================================================
+
+static void ap_main() {
+    uint32_t id = ap_booting_cpu;
+
+    gdt_load_cpu(id);
+    idt_load_cpu();
+    fpu_init_cpu();
+    syscall_init_cpu(id);
+    lapic_init_cpu();
+    task_init_cpu(idle_names[id]);
+
+    cpus[id].online = true;
+    atomic_xchg(&ap_started, 1);
+
+    lapic_timer_start_periodic(LAPIC_TIMER_VECTOR);
+    __asm__ volatile("sti");
+
+    // This is now the idle task of CPU 'id'
+    while (1) {
+        __asm__ volatile("hlt");
+    }
+}
+
+static bool start_ap(uint32_t id, uint8_t apic_id) {
+    uint8_t* stack = (uint8_t*)kmalloc(AP_STACK_SIZE);
+    if (!stack) return false;
+
+    PerCpu* cpu = &cpus[id];
+    cpu->apic_id = apic_id;
+
+    *trampoline_slot(&ap_param_cr3)   = read_cr3();
+    *trampoline_slot(&ap_param_stack) = (uint32_t)(stack + AP_STACK_SIZE);
+    *trampoline_slot(&ap_param_entry) = (uint32_t)ap_main;
+    ap_booting_cpu = id;
+    ap_started = 0;
+
+    // INIT, wait at least 10ms (2 ticks: the first may be almost over), then
+    // STARTUP - twice if the first one is missed
+    lapic_send_init(apic_id);
+    sleep_ticks(2);
+    lapic_send_startup(apic_id, AP_TRAMPOLINE_ADDR >> 12);
+    sleep_ticks(1);
+    if (!ap_started) {
+        lapic_send_startup(apic_id, AP_TRAMPOLINE_ADDR >> 12);
+    }
+
+    for (int t = 0; t < AP_START_TIMEOUT && !ap_started; t++) {
+        sleep_ticks(1);
+    }
+    if (!ap_started) {
+        kfree(stack);   // Never came up - nobody is using it
+        return false;
+    }
+    return true;
+}
+
+// =============================================================================
+// Public API
+// =============================================================================
+
+void smp_init() {
+    cpus[0].online = true;
+
+    const PlatformInfo* info = acpi_get_platform();
+    bool have_tables = info->source != 0;
+    if (!lapic_present()) return;
+
+    cpus[0].apic_id = lapic_get_id();
+    register_fast_irq_handler(LAPIC_TIMER_VECTOR, lapic_timer_handler);
+    register_interrupt_handler(IPI_RESCHED_VECTOR, resched_ipi_handler);
+    register_interrupt_handler(LAPIC_SPURIOUS_VECTOR, spurious_handler);
+
+    if (!have_tables || info->cpu_count < 2) return;
+
+    // Copy the trampoline below 1MB where a real-mode CPU can reach it
+    uint32_t size = ap_trampoline_end - ap_trampoline_start;
+    uint8_t* dst = (uint8_t*)AP_TRAMPOLINE_ADDR;
+    for (uint32_t i = 0; i < size; i++) {
+        dst[i] = ap_trampoline_start[i];
+    }
+
+    // From here on tasks can migrate between CPUs
+    fpu_enable_smp();
+
+    for (int i = 0; i < info->cpu_count && cpu_count < SMP_MAX_CPUS; i++) {
+        uint8_t apic_id = info->cpu_apic_ids[i];
+        if (apic_id == cpus[0].apic_id) continue;
+        if (start_ap(cpu_count, apic_id)) {
+            cpu_count++;
+        }
+    }
+}
+
+uint32_t smp_get_cpu_count() {
+    return cpu_count;
+}
+
+const char* smp_get_source() {
+    return acpi_get_platform()->source;
+}
+
+void smp_send_resched(uint32_t cpu) {
+    if (cpu < SMP_MAX_CPUS && cpus[cpu].online && lapic_present()) {
+        lapic_send_ipi(cpus[cpu].apic_id, IPI_RESCHED_VECTOR);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+
+// =============================================================================
+// Symmetric multiprocessing
+//
+// The bootstrap CPU finds the other CPUs in the firmware tables and wakes
+// each one with INIT-SIPI-SIPI. Every application processor then loads the
+// kernel GDT/IDT, enables its local APIC and LAPIC timer, becomes the idle
+// task of its own run queue and starts taking work from the scheduler.
+// =============================================================================
+
+// Physical page the AP trampoline is copied to (STARTUP IPI vector 0x07)
+#define AP_TRAMPOLINE_ADDR 0x7000
+
+// Bring up the application processors. Needs the heap, the scheduler, the
+// firmware tables and local APIC (acpi_init, lapic_init) and interrupts
+// enabled (the PIT times the INIT/STARTUP delays).
+void     smp_init();
+
+uint32_t smp_get_cpu_count();       // CPUs online, bootstrap CPU included
+const char* smp_get_source();       // "ACPI", "MP" or 0
+
+// Ask another CPU to run its scheduler (no-op on single-CPU systems)
+void     smp_send_resched(uint32_t cpu);
+
+#endif
@@ -0,0 +1,194 @@
+#include "sync.h"
+#include "cpu.h"
+
+// =============================================================================
+// Spinlocks
+//
+// The lock word is taken with an atomic xchg, and interrupts stay disabled
+// for as long as the lock is held so an IRQ handler on this CPU can never
+// spin on a lock its own interrupted code owns.
+// =============================================================================
+
+// Raw acquire/release - caller manages the interrupt flag
+void spin_acquire(Spinlock* lock) {
+    while (atomic_xchg(&lock->locked, 1) != 0) {
+        while (lock->locked) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+void spin_release(Spinlock* lock) {
+    __asm__ volatile("" : : : "memory");
+    lock->locked = 0;
+}
+
+void spin_init(Spinlock* lock) {
+    lock->locked      = 0;
+    lock->saved_flags = 0;
+}
+
+void spin_lock(Spinlock* lock) {
+    uint32_t flags = irq_save();
+    spin_acquire(lock);
+    lock->saved_flags = flags;
+}
+
+void spin_unlock(Spinlock* lock) {
+    uint32_t flags = lock->saved_flags;
+    spin_release(lock);
+    irq_restore(flags);
+}
+
+bool spin_trylock(Spinlock* lock) {
+    uint32_t flags = irq_save();
+    if (atomic_xchg(&lock->locked, 1) != 0) {
+        irq_restore(flags);
+        return false;
+    }
+    lock->saved_flags = flags;
+    return true;
+}
+
+// Block the current task on 'wq'. Called with 'lock' held (interrupts off);
+// the lock is dropped while we are switched out and re-taken before return.
+// Queueing happens before the lock is dropped, so a wake-up issued by
+// another lock holder cannot be lost.
+//
+// Whoever takes the lock while we sleep overwrites saved_flags - the poster
+// may well be an IRQ handler with interrupts off - so our own flags are
+// kept here and put back, and the caller's spin_unlock restores exactly
+// what its spin_lock saved.
+//
+// A caller that cannot block (task_can_block, checked before it locked) is
+// never queued: it lets go of the lock for a moment and returns, and the
+// caller's loop spins on its condition instead.
+static void wait_locked(WaitQueue* wq, Spinlock* lock, bool can_block) {
+    if (!can_block) {
+        spin_unlock(lock);
+        __asm__ volatile("pause");
+        spin_lock(lock);
+        return;
+    }
+
+    uint32_t flags = lock->saved_flags;
+    task_wait_prepare(wq);
+    spin_release(lock);
+    task_wait_commit();
+    spin_acquire(lock);
+    lock->saved_flags = flags;
+}
+
+// =============================================================================
+// Mutexes
+// =============================================================================
+
+void mutex_init(Mutex* m) {
+    spin_init(&m->guard);
+    m->owner = 0;
+    m->waiters.head = 0;
+    m->waiters.tail = 0;
+}
+
+void mutex_lock(Mutex* m) {
+    Task* self = task_get_current();
+    if (!self) return;  // Early boot, before the scheduler: nothing to race with
+
+    bool can_block = task_can_block();
+    spin_lock(&m->guard);
+    while (m->owner) {
+        wait_locked(&m->waiters, &m->guard, can_block);
+    }
+    m->owner = self;
+    spin_unlock(&m->guard);
+}
+
+bool mutex_trylock(Mutex* m) {
+    Task* self = task_get_current();
+    if (!self) return true;
+
+    spin_lock(&m->guard);
+    bool ok = (m->owner == 0);
+    if (ok) m->owner = self;
+    spin_unlock(&m->guard);
+    return ok;
+}
+
+void mutex_unlock(Mutex* m) {
+    if (!task_get_current()) return;
+
+    spin_lock(&m->guard);
+    m->owner = 0;
+    task_wake_one(&m->waiters);
+    spin_unlock(&m->guard);
+}
+
+// =============================================================================
+// Counting semaphores
+// =============================================================================
+
+void sem_init(Semaphore* s, int count) {
+    spin_init(&s->guard);
+    s->count = count;
+    s->waiters.head = 0;
+    s->waiters.tail = 0;
+}
+
+void sem_wait(Semaphore* s) {
+    bool can_block = task_can_block();
+    spin_lock(&s->guard);
+    while (s->count <= 0) {
+        wait_locked(&s->waiters, &s->guard, can_block);
+    }
+    s->count--;
+    spin_unlock(&s->guard);
+}
+
+bool sem_trywait(Semaphore* s) {
+    spin_lock(&s->guard);
+    bool ok = s->count > 0;
+    if (ok) s->count--;
+    spin_unlock(&s->guard);
+    return ok;
+}
+
+void sem_post(Semaphore* s) {
+    spin_lock(&s->guard);
+    s->count++;
+    task_wake_one(&s->waiters);
+    spin_unlock(&s->guard);
+}
+
+// =============================================================================
+// Condition variables
+// =============================================================================
+
+void cond_init(CondVar* cv) {
+    spin_init(&cv->guard);
+    cv->waiters.head = 0;
+    cv->waiters.tail = 0;
+}
+
+void cond_wait(CondVar* cv, Mutex* m) {
+    // Take the condvar guard before releasing the mutex so a signal sent
+    // right after the unlock still finds us on the wait queue. Without
+    // blocking this is just a spurious wake-up.
+    bool can_block = task_can_block();
+    spin_lock(&cv->guard);
+    mutex_unlock(m);
+    wait_locked(&cv->waiters, &cv->guard, can_block);
+    spin_unlock(&cv->guard);
+    mutex_lock(m);
+}
+
+void cond_signal(CondVar* cv) {
+    spin_lock(&cv->guard);
+    task_wake_one(&cv->waiters);
+    spin_unlock(&cv->guard);
+}
+
+void cond_broadcast(CondVar* cv) {
+    spin_lock(&cv->guard);
+    task_wake_all(&cv->waiters);
+    spin_unlock(&cv->guard);
+}
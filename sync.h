@@ -0,0 +1,72 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdint.h>
+#include "task.h"
+
+// =============================================================================
+// Kernel synchronization primitives
+//
+//   Spinlock  - busy-wait lock that also disables interrupts while held, so it
+//               is safe to share with IRQ handlers. Keep critical sections short.
+//   Mutex     - sleeping lock: contended lockers block in the scheduler instead
+//               of spinning. Task context only.
+//   Semaphore - counting semaphore. sem_post is IRQ-safe, sem_wait may block.
+//   CondVar   - condition variable used together with a Mutex.
+// =============================================================================
+
+struct Spinlock {
+    volatile uint32_t locked;
+    uint32_t          saved_flags;   // EFLAGS of the holder before it locked
+};
+
+struct Mutex {
+    Spinlock  guard;
+    Task*     owner;
+    WaitQueue waiters;
+};
+
+struct Semaphore {
+    Spinlock  guard;
+    int       count;
+    WaitQueue waiters;
+};
+
+struct CondVar {
+    Spinlock  guard;
+    WaitQueue waiters;
+};
+
+// Static initializers for globals
+#define SPINLOCK_INIT      { 0, 0 }
+#define MUTEX_INIT         { SPINLOCK_INIT, 0, { 0, 0 } }
+#define SEMAPHORE_INIT(n)  { SPINLOCK_INIT, (n), { 0, 0 } }
+#define CONDVAR_INIT       { SPINLOCK_INIT, { 0, 0 } }
+
+void spin_init(Spinlock* lock);
+void spin_lock(Spinlock* lock);       // Disables interrupts, then acquires
+void spin_unlock(Spinlock* lock);     // Releases, then restores interrupts
+bool spin_trylock(Spinlock* lock);
+
+// Raw versions that leave the interrupt flag alone - the caller must already
+// have interrupts disabled. For locks that are handed across a context
+// switch, like the scheduler lock.
+void spin_acquire(Spinlock* lock);
+void spin_release(Spinlock* lock);
+
+void mutex_init(Mutex* m);
+void mutex_lock(Mutex* m);
+void mutex_unlock(Mutex* m);
+bool mutex_trylock(Mutex* m);
+
+void sem_init(Semaphore* s, int count);
+void sem_wait(Semaphore* s);
+bool sem_trywait(Semaphore* s);
+void sem_post(Semaphore* s);
+
+void cond_init(CondVar* cv);
+void cond_wait(CondVar* cv, Mutex* m);
+void cond_signal(CondVar* cv);
+void cond_broadcast(CondVar* cv);
+
+#endif
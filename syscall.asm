@@ -0,0 +1,97 @@
+[bits 32]
+
+; System call entry and the ring-3 stubs that use it (see syscall.h)
+
+extern syscall_table
+
+SYS_EXIT        equ 1
+SYS_COUNT       equ 5           ; Keep in step with syscall.h
+USER_DATA_SEL   equ 0x23        ; GDT_USER_DATA | 3
+PERCPU_TO_TSS   equ 8 * 8       ; SMP_MAX_CPUS descriptors (GDT_TSS_SEL - GDT_PERCPU_SEL)
+
+section .text
+
+; SYSENTER lands here with interrupts off, CS/SS = kernel, ESP = this CPU's
+; &TSS.esp0 (MSR), ECX = user ESP and EDX = user EIP (set by user_syscall).
+; DS/ES still hold the flat user data segment, which ring 0 can use as is.
+global sysenter_entry
+sysenter_entry:
+    mov esp, [esp]              ; The running task's kernel stack
+    push ecx                    ; User ESP and EIP for SYSEXIT
+    push edx
+
+    ; GS must be this CPU's per-CPU segment. TR is this CPU's TSS, which
+    ; sits a fixed distance after it in the GDT.
+    str dx
+    sub dx, PERCPU_TO_TSS
+    mov gs, dx
+    sti
+
+    cmp eax, SYS_COUNT
+    jae .bad
+    push edi
+    push esi
+    push ebx
+    call [syscall_table + eax * 4]
+    add esp, 12
+
+.out:
+    cli
+    mov dx, USER_DATA_SEL       ; Don't leave the per-CPU segment to ring 3
+    mov gs, dx
+    pop edx
+    pop ecx
+    sti                         ; Takes effect after SYSEXIT
+    sysexit
+
+.bad:
+    mov eax, -1
+    jmp .out
+
+; -----------------------------------------------------------------------------
+; Ring 3 side - mapped user-accessible (user_init)
+; -----------------------------------------------------------------------------
+
+section user_text progbits alloc exec nowrite align=4096
+
+; uint32_t user_syscall(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3)
+global user_syscall
+user_syscall:
+    push ebx
+    push esi
+    push edi
+    mov eax, [esp + 16]
+    mov ebx, [esp + 20]
+    mov esi, [esp + 24]
+    mov edi, [esp + 28]
+    mov ecx, esp                ; SYSEXIT brings us back here, this stack
+    mov edx, .ret
+    sysenter
+.ret:
+    pop edi
+    pop esi
+    pop ebx
+    ret
+
+; Same through the interrupt gate
+global user_syscall_int
+user_syscall_int:
+    push ebx
+    push esi
+    push edi
+    mov eax, [esp + 16]
+    mov ebx, [esp + 20]
+    mov esi, [esp + 24]
+    mov edi, [esp + 28]
+    int 0x80
+    pop edi
+    pop esi
+    pop ebx
+    ret
+
+; Where a user entry function returns to
+global user_exit
+user_exit:
+    mov eax, SYS_EXIT
+    int 0x80
+    jmp user_exit
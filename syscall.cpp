@@ -0,0 +1,103 @@
+#include "syscall.h"
+#include "isr.h"
+#include "idt.h"
+#include "gdt.h"
+#include "task.h"
+#include "paging.h"
+#include "vga.h"
+#include "cpu.h"
+
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+#define IDT_USER_INTERRUPT_GATE 0xEE    // Present, ring 3 may 'int', interrupts off
+
+extern "C" void sysenter_entry();
+extern "C" void isr128();
+
+static bool has_sysenter = false;
+
+// =============================================================================
+// The calls
+// =============================================================================
+
+static uint32_t sys_null(uint32_t, uint32_t, uint32_t) {
+    return 0;
+}
+
+static uint32_t sys_exit(uint32_t, uint32_t, uint32_t) {
+    task_exit();
+    return 0;
+}
+
+static uint32_t sys_write(uint32_t buf, uint32_t len, uint32_t) {
+    if (!paging_user_range(buf, len)) return SYSCALL_ERROR;
+    const char* s = (const char*)buf;
+    for (uint32_t i = 0; i < len; i++) {
+        vga_put_char(s[i]);
+    }
+    return len;
+}
+
+static uint32_t sys_gettid(uint32_t, uint32_t, uint32_t) {
+    return (uint32_t)task_get_current_id();
+}
+
+static uint32_t sys_yield(uint32_t, uint32_t, uint32_t) {
+    task_yield();
+    return 0;
+}
+
+// Indexed straight from the SYSENTER stub, which checks the bound itself
+extern "C" syscall_fn syscall_table[SYS_COUNT];
+syscall_fn syscall_table[SYS_COUNT] = {
+    sys_null,
+    sys_exit,
+    sys_write,
+    sys_gettid,
+    sys_yield,
+};
+
+// =============================================================================
+// int 0x80
+// =============================================================================
+
+static void syscall_int_handler(registers_t* regs) {
+    // The gate turned interrupts off; isr_common has set up GS by now, so
+    // the call itself can run with them on like the SYSENTER path does
+    __asm__ volatile("sti");
+    uint32_t num = regs->eax;
+    regs->eax = num < SYS_COUNT ? syscall_table[num](regs->ebx, regs->esi, regs->edi)
+                                : SYSCALL_ERROR;
+}
+
+// =============================================================================
+// Setup
+// =============================================================================
+
+void syscall_init() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    has_sysenter = (edx & CPUID_EDX_SEP) && (edx & CPUID_EDX_MSR);
+
+    idt_set_gate(SYSCALL_VECTOR, (uint32_t)isr128, GDT_KERNEL_CODE, IDT_USER_INTERRUPT_GATE);
+    register_interrupt_handler(SYSCALL_VECTOR, syscall_int_handler);
+    syscall_init_cpu(0);
+}
+
+void syscall_init_cpu(uint32_t cpu) {
+    if (!has_sysenter) return;
+
+    // SYSENTER takes SS = CS + 8; SYSEXIT returns to CS + 16 and SS + 24,
+    // i.e. GDT_USER_CODE and GDT_USER_DATA. ESP points at this CPU's
+    // TSS.esp0, which the scheduler keeps at the running task's kernel
+    // stack top - the stub's first instruction loads it.
+    wrmsr(MSR_SYSENTER_CS,  GDT_KERNEL_CODE);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)&cpu_tss[cpu].esp0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+}
+
+bool syscall_has_sysenter() {
+    return has_sysenter;
+}
@@ -0,0 +1,45 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include <stdint.h>
+
+// =============================================================================
+// System calls
+//
+// Two ways in from ring 3, one table behind both:
+//   - SYSENTER (user_syscall): the CPU loads the kernel CS/SS/ESP/EIP from
+//     MSRs, no descriptor lookups or stack frame; the entry stub switches to
+//     the task's kernel stack, fixes GS and calls the table entry directly.
+//     SYSEXIT returns to wherever the user stub asked.
+//   - int 0x80 (user_syscall_int): an ordinary DPL-3 interrupt gate through
+//     isr_common - full register frame, segment reloads and the generic
+//     handler dispatch. Works on every CPU; here mostly as the baseline.
+//
+// Number in eax, up to three arguments in ebx, esi and edi, result in eax.
+// The numbers are also hard-coded in syscall.asm.
+// =============================================================================
+
+#define SYSCALL_VECTOR 0x80
+
+#define SYS_NULL    0   // Does nothing - for timing the entry/exit path
+#define SYS_EXIT    1
+#define SYS_WRITE   2   // (const char* buf, uint32_t len) -> len
+#define SYS_GETTID  3
+#define SYS_YIELD   4
+#define SYS_COUNT   5
+
+#define SYSCALL_ERROR 0xFFFFFFFF
+
+typedef uint32_t (*syscall_fn)(uint32_t a1, uint32_t a2, uint32_t a3);
+
+// Install the int 0x80 gate and set up SYSENTER on the bootstrap CPU
+// (needs the GDT's TSSes)
+void syscall_init();
+
+// SYSENTER MSRs for the calling CPU (application processors)
+void syscall_init_cpu(uint32_t cpu);
+
+// The CPU has SYSENTER/SYSEXIT
+bool syscall_has_sysenter();
+
+#endif
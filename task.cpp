@@ -1,145 +1,1221 @@
 #include "task.h"
 #include "kheap.h"
 #include "timer.h"
+#include "fpu.h"
+#include "cpu.h"
+#include "schedlat.h"
+#include "percpu.h"
+#include "sync.h"
+#include "smp.h"
+#include "hrtimer.h"
+#include "kstack.h"
+#include "paging.h"
+#include "gdt.h"
+#include "user.h"
+#include "workqueue.h"
+#include "fiber.h"
 
-static Task tasks[MAX_TASKS];
-static int current_task = 0;
-static int next_id = 0;
+// ============================================================================
+// Task bookkeeping
+//
+// Tasks are kmalloc'd on demand and their stacks come from the guard-paged
+// stack region (kstack.h), so the limits are heap and region space. Every
+// live task is reachable three ways:
+//   - hash index by id (bucket = id & (TASK_HASH_BUCKETS - 1)), O(1) lookup
+//   - exactly one state list: its CPU's ready queue (FIFO), the sleep heap
+//     (ordered by wake-up time), the dead list (waiting for the reaper work
+//     item to free its stacks), or the WaitQueue of whatever it is blocked on
+//   - the all-tasks list, only walked by ps and friends
+//
+// Each CPU runs its own current task, idle task and ready queue (PerCpu).
+// Real-time tasks instead share one global queue sorted by deadline, which
+// every CPU checks first. One scheduler lock covers all of it - every state
+// list, including wait queues, and every task's state. It is held across
+// switch_context and released by whichever task runs next, so no other CPU
+// can pick up a task whose stack is still being switched away from.
+// ============================================================================
+
+static Task* sleep_root = 0;   // Sleep heap: earliest wake-up at the root
+static TaskQueue rt_queue;      // READY real-time tasks, earliest deadline first
+static uint32_t rt_util_total = 0;
+static HrTimer rt_budget_timer[SMP_MAX_CPUS];   // Fires when the running RT task runs dry
+static HrTimer sleep_timer;     // Armed for sleep_root
+static TaskQueue dead_list;
+static volatile bool reap_needed = false;   // Dead tasks not yet handed to the reaper
+static Task* hash_index[TASK_HASH_BUCKETS];
+static Task* all_tasks = 0;
+static int task_count = 0;
+static uint32_t next_id = 0;
 static bool scheduler_enabled = false;
+static Spinlock sched_lock = SPINLOCK_INIT;
+
+// Stack worst cases per name + entry (sched_lock)
+static StackRecord stack_records[STACK_RECORD_MAX];
+static int stack_record_count = 0;
+
+// Raw lock - interrupts are always already off where it is taken
+static inline void sched_lock_acquire() {
+    spin_acquire(&sched_lock);
+}
+
+static inline void sched_lock_release() {
+    spin_release(&sched_lock);
+}
+
+// ============================================================================
+// Intrusive list helpers
+// ============================================================================
+
+static void list_push_back(TaskQueue* list, Task* t) {
+    t->state_next = 0;
+    t->state_prev = list->tail;
+    if (list->tail) {
+        list->tail->state_next = t;
+    } else {
+        list->head = t;
+    }
+    list->tail = t;
+}
+
+static void list_insert_before(TaskQueue* list, Task* pos, Task* t) {
+    t->state_next = pos;
+    t->state_prev = pos->state_prev;
+    if (pos->state_prev) {
+        pos->state_prev->state_next = t;
+    } else {
+        list->head = t;
+    }
+    pos->state_prev = t;
+}
+
+static void list_remove(TaskQueue* list, Task* t) {
+    if (t->state_prev) {
+        t->state_prev->state_next = t->state_next;
+    } else {
+        list->head = t->state_next;
+    }
+    if (t->state_next) {
+        t->state_next->state_prev = t->state_prev;
+    } else {
+        list->tail = t->state_prev;
+    }
+    t->state_next = 0;
+    t->state_prev = 0;
+}
+
+static Task* list_pop_front(TaskQueue* list) {
+    Task* t = list->head;
+    if (t) list_remove(list, t);
+    return t;
+}
+
+// ============================================================================
+// Sleep heap
+//
+// A pairing heap on sleep_until, built from the same intrusive links: a
+// sleeper's children hang off sleep_child, state_next is its next sibling
+// and state_prev its previous sibling - or its parent, for a first child.
+// Going to sleep is O(1), waking the earliest and removing any sleeper
+// (kill) O(log n) amortized, and the root is always the next wake-up.
+// ============================================================================
+
+// Join two detached heaps: the later root becomes the other's first child
+static Task* sleep_meld(Task* a, Task* b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (b->sleep_until < a->sleep_until) {
+        Task* t = a;
+        a = b;
+        b = t;
+    }
+    b->state_prev = a;
+    b->state_next = a->sleep_child;
+    if (a->sleep_child) a->sleep_child->state_prev = b;
+    a->sleep_child = b;
+    return a;
+}
+
+// Meld a sibling list back into one heap: pairs left to right, then the
+// pairs right to left (the results are stacked through state_next)
+static Task* sleep_merge_pairs(Task* first) {
+    Task* pairs = 0;
+    while (first) {
+        Task* a = first;
+        Task* b = a->state_next;
+        first = b ? b->state_next : 0;
+        a->state_next = a->state_prev = 0;
+        if (b) b->state_next = b->state_prev = 0;
+        Task* m = sleep_meld(a, b);
+        m->state_next = pairs;
+        pairs = m;
+    }
+
+    Task* root = 0;
+    while (pairs) {
+        Task* next = pairs->state_next;
+        pairs->state_next = 0;
+        root = sleep_meld(pairs, root);
+        pairs = next;
+    }
+    return root;
+}
+
+static void sleep_insert(Task* t) {
+    t->state_next  = 0;
+    t->state_prev  = 0;
+    t->sleep_child = 0;
+    sleep_root = sleep_meld(sleep_root, t);
+}
+
+static Task* sleep_pop() {
+    Task* t = sleep_root;
+    if (!t) return 0;
+    sleep_root = sleep_merge_pairs(t->sleep_child);
+    t->sleep_child = 0;
+    return t;
+}
+
+static void sleep_remove(Task* t) {
+    if (t == sleep_root) {
+        sleep_pop();
+        return;
+    }
+
+    // Cut t's subtree out of its parent's child list, then meld it back
+    if (t->state_prev->sleep_child == t) {
+        t->state_prev->sleep_child = t->state_next;
+    } else {
+        t->state_prev->state_next = t->state_next;
+    }
+    if (t->state_next) t->state_next->state_prev = t->state_prev;
+    t->state_next = 0;
+    t->state_prev = 0;
+
+    Task* children = sleep_merge_pairs(t->sleep_child);
+    t->sleep_child = 0;
+    sleep_root = sleep_meld(sleep_root, children);
+}
+
+// ============================================================================
+// CPU accounting
+// ============================================================================
+
+// Credit the time since the last state change to the state being left
+static void account_state(Task* t, uint64_t now) {
+    uint64_t delta = now - t->state_since;
+    switch (t->state) {
+        case TASK_RUNNING:  t->cpu_cycles   += delta; break;
+        case TASK_READY:    t->ready_cycles += delta; break;
+        case TASK_SLEEPING:
+        case TASK_BLOCKED:  t->sleep_cycles += delta; break;
+        default: break;
+    }
+    t->state_since = now;
+}
+
+// Every state change goes through here so no interval goes uncounted
+static void task_set_state(Task* t, TaskState state) {
+    account_state(t, rdtsc());
+    t->state = state;
+}
+
+static void task_init_stats(Task* t) {
+    t->cpu_cycles   = 0;
+    t->ready_cycles = 0;
+    t->sleep_cycles = 0;
+    t->state_since  = rdtsc();
+    t->run_ticks    = 0;
+    t->nvcsw        = 0;
+    t->nivcsw       = 0;
+    t->woken_at     = 0;
+    t->woken_over   = 0;
+    t->woken_over_name = 0;
+    schedlat_hist_clear(&t->wake_lat);
+}
+
+// ============================================================================
+// Per-CPU run queues
+// ============================================================================
+
+static void rq_push(PerCpu* cpu, Task* t) {
+    list_push_back(&cpu->ready_queue, t);
+    cpu->nr_ready++;
+    t->cpu = cpu->id;
+}
+
+static Task* rq_pop(PerCpu* cpu) {
+    Task* t = list_pop_front(&cpu->ready_queue);
+    if (t) cpu->nr_ready--;
+    return t;
+}
+
+static void rq_remove(Task* t) {
+    PerCpu* cpu = &cpus[t->cpu];
+    list_remove(&cpu->ready_queue, t);
+    cpu->nr_ready--;
+}
+
+static inline bool is_idle_task(Task* t) {
+    return t == cpus[t->cpu].idle;
+}
+
+static inline bool is_rt(Task* t) {
+    return t->rt_period != 0;
+}
+
+// Queued tasks plus the one running (the idle task does not count)
+static inline uint32_t cpu_load(PerCpu* cpu) {
+    return cpu->nr_ready + (cpu->current != cpu->idle ? 1 : 0);
+}
+
+// Make another CPU (or this one) run its scheduler at its next IRQ exit
+static void kick_cpu(PerCpu* cpu) {
+    cpu->need_resched = true;
+    if (cpu != this_cpu()) smp_send_resched(cpu->id);
+}
+
+// Pick a queue for a task that just became runnable: the CPU it last ran
+// on keeps its cache warm, unless some other CPU is less loaded
+static PerCpu* select_cpu(Task* t) {
+    if (t->pinned_cpu >= 0) return &cpus[t->pinned_cpu];
+
+    PerCpu* best = &cpus[t->cpu];
+    if (!best->online) best = this_cpu();
+    if (cpu_load(best) == 0) return best;
+
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        PerCpu* cpu = &cpus[i];
+        if (cpu->online && cpu_load(cpu) < cpu_load(best)) best = cpu;
+    }
+    return best;
+}
+
+// ============================================================================
+// Real-time queue (global EDF)
+// ============================================================================
+
+static void rt_queue_insert(Task* t) {
+    Task* pos = rt_queue.head;
+    while (pos && pos->rt_deadline <= t->rt_deadline) {
+        pos = pos->state_next;
+    }
+    if (pos) {
+        list_insert_before(&rt_queue, pos, t);
+    } else {
+        list_push_back(&rt_queue, t);
+    }
+}
+
+// Queue a READY RT task and preempt the CPU whose current task matters
+// least: an idle one, else one running a normal task, else the RT task
+// with the latest deadline - if that is later than ours
+static PerCpu* enqueue_rt(Task* t) {
+    rt_queue_insert(t);
+
+    PerCpu* victim = 0;
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        PerCpu* cpu = &cpus[i];
+        if (!cpu->online) continue;
+        Task* cur = cpu->current;
+        if (cur == cpu->idle) {
+            victim = cpu;
+            break;
+        }
+        if (!is_rt(cur)) {
+            if (!victim || is_rt(victim->current)) victim = cpu;
+        } else if (cur->rt_deadline > t->rt_deadline) {
+            if (!victim || (is_rt(victim->current) &&
+                            cur->rt_deadline > victim->current->rt_deadline)) {
+                victim = cpu;
+            }
+        }
+    }
+    if (!victim) return &cpus[t->cpu];
+    t->cpu = victim->id;
+    kick_cpu(victim);
+    return victim;
+}
+
+// Head of the RT queue, if it should run instead of 'old'. A running RT
+// task keeps the CPU unless the head is due strictly earlier.
+static Task* rt_pick(Task* old) {
+    Task* t = rt_queue.head;
+    if (!t) return 0;
+    if (old->state == TASK_RUNNING && is_rt(old) && old->rt_deadline <= t->rt_deadline) {
+        return 0;
+    }
+    list_remove(&rt_queue, t);
+    return t;
+}
+
+// ============================================================================
+// Real-time budgets
+//
+// Run time is charged in timer_get_ns time on every scheduler pass while an
+// RT task holds a CPU, and a per-CPU hrtimer forces such a pass the moment
+// the rest of the budget would be used up. A task that has none left is
+// throttled: it sleeps until its period ends and comes back with a fresh
+// budget and the next period's deadline, so an overrun only delays itself.
+// ============================================================================
+
+static void arm_sleep_timer();
+
+static void rt_budget_expired(HrTimer* timer) {
+    PerCpu* cpu = (PerCpu*)timer->arg;
+    sched_lock_acquire();
+    if (is_rt(cpu->current)) kick_cpu(cpu);   // Its scheduler pass charges it
+    sched_lock_release();
+}
+
+// Fire when 't', just (re)confirmed on 'cpu', has used up its budget
+static void rt_arm_budget(PerCpu* cpu, Task* t) {
+    HrTimer* timer = &rt_budget_timer[cpu->id];
+    timer->arg = cpu;
+    hrtimer_start(timer, t->rt_runtime, rt_budget_expired);
+}
+
+// Charge what 't' ran since it was dispatched (or last charged)
+static void rt_charge(Task* t, uint64_t now) {
+    if (!t->rt_dispatched) return;
+    uint64_t ran = now - t->rt_dispatched;
+    t->rt_runtime    = ran < t->rt_runtime ? t->rt_runtime - ran : 0;
+    t->rt_dispatched = now;
+}
+
+static void rt_throttle(Task* t) {
+    t->rt_throttles++;
+    t->rt_dispatched = 0;
+    t->rt_runtime    = t->rt_budget;
+    t->sleep_until   = t->rt_deadline;
+    t->rt_deadline  += t->rt_period;
+    task_set_state(t, TASK_SLEEPING);
+    sleep_insert(t);
+    if (sleep_root == t) arm_sleep_timer();
+}
+
+// Queue a READY task and wake its CPU if that one is idling
+static PerCpu* enqueue_ready(Task* t) {
+    if (is_rt(t)) return enqueue_rt(t);
+
+    PerCpu* cpu = select_cpu(t);
+    rq_push(cpu, t);
+    if (cpu->current == cpu->idle) kick_cpu(cpu);
+    return cpu;
+}
+
+// ============================================================================
+// Sleeping
+//
+// Every schedule pass wakes the sleepers that are due, and sleep_timer fires
+// at the earliest deadline so a sleeper wakes on time even if nothing else
+// enters the scheduler before then.
+// ============================================================================
+
+static void sleep_timer_fired(HrTimer* timer);
+
+// Scheduler lock held
+static void wake_sleepers(uint64_t now) {
+    while (sleep_root && sleep_root->sleep_until <= now) {
+        Task* t = sleep_pop();
+        task_set_state(t, TASK_READY);
+        PerCpu* target = enqueue_ready(t);
+        schedlat_wake(t, target->current);
+    }
+}
+
+// Scheduler lock held. Once pointed at a deadline, the timer fires no later
+// than the (possibly new) head; it re-arms itself from there.
+static void arm_sleep_timer() {
+    Task* head = sleep_root;
+    if (!head) return;
+    uint64_t now = timer_get_ns();
+    uint64_t ns = head->sleep_until > now ? head->sleep_until - now : 0;
+    hrtimer_start(&sleep_timer, ns, sleep_timer_fired);
+}
+
+// Timer interrupt (interrupts off). enqueue_ready kicks the CPUs that get
+// the woken tasks, so they switch on their way out of the interrupt.
+static void sleep_timer_fired(HrTimer* timer) {
+    (void)timer;
+    sched_lock_acquire();
+    wake_sleepers(timer_get_ns());
+    arm_sleep_timer();
+    sched_lock_release();
+}
+
+// Work stealing: an idle CPU takes the task queued last on the busiest
+// other CPU (it would have waited longest there, and is the least likely
+// to still have warm cache lines). Pinned tasks stay where they are.
+static Task* steal_task(PerCpu* thief) {
+    PerCpu* victim = 0;
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        PerCpu* cpu = &cpus[i];
+        if (cpu == thief || !cpu->online || cpu->nr_ready == 0) continue;
+        if (!victim || cpu->nr_ready > victim->nr_ready) victim = cpu;
+    }
+    if (!victim) return 0;
+
+    Task* t = victim->ready_queue.tail;
+    while (t && t->pinned_cpu >= 0) t = t->state_prev;
+    if (!t) return 0;
+    rq_remove(t);
+    thief->steals++;
+    return t;
+}
+
+// Take a task off whichever state list it is on
+static void task_unlink_state(Task* t) {
+    switch (t->state) {
+        case TASK_READY:
+            if (is_rt(t)) list_remove(&rt_queue, t);
+            else          rq_remove(t);
+            break;
+        case TASK_SLEEPING: sleep_remove(t);              break;
+        case TASK_DEAD:     list_remove(&dead_list, t);   break;
+        case TASK_BLOCKED:
+            list_remove(t->waiting_on, t);
+            t->waiting_on = 0;
+            break;
+        default: break;  // running task is on no list
+    }
+}
+
+// ============================================================================
+// Hash index and all-tasks list
+// ============================================================================
+
+static inline uint32_t hash_bucket(uint32_t id) {
+    return id & (TASK_HASH_BUCKETS - 1);
+}
+
+static void task_register(Task* t) {
+    uint32_t b = hash_bucket(t->id);
+    t->hash_next = hash_index[b];
+    hash_index[b] = t;
+
+    t->all_prev = 0;
+    t->all_next = all_tasks;
+    if (all_tasks) all_tasks->all_prev = t;
+    all_tasks = t;
+
+    task_count++;
+}
+
+// Drop a task from the id index and the all-tasks list (it stays on dead_list)
+static void task_unregister(Task* t) {
+    Task** link = &hash_index[hash_bucket(t->id)];
+    while (*link && *link != t) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) *link = t->hash_next;
+    t->hash_next = 0;
+
+    if (t->all_prev) {
+        t->all_prev->all_next = t->all_next;
+    } else {
+        all_tasks = t->all_next;
+    }
+    if (t->all_next) t->all_next->all_prev = t->all_prev;
+    t->all_next = 0;
+    t->all_prev = 0;
+
+    task_count--;
+}
+
+// ============================================================================
+// Stack high-water records (scheduler lock held)
+// ============================================================================
+
+static bool name_eq(const char* a, const char* b) {
+    if (a == b) return true;
+    if (!a || !b) return false;
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+// Record for t's name and entry, created on first use. Returns 0 once the
+// table is full - those tasks are simply not tracked.
+static StackRecord* stack_record_find(Task* t) {
+    for (int i = 0; i < stack_record_count; i++) {
+        StackRecord* r = &stack_records[i];
+        if (r->entry == t->entry && name_eq(r->name, t->name)) return r;
+    }
+    if (stack_record_count == STACK_RECORD_MAX) return 0;
+
+    StackRecord* r = &stack_records[stack_record_count++];
+    r->name       = t->name;
+    r->entry      = t->entry;
+    r->tasks      = 0;
+    r->peak       = 0;
+    r->stack_size = 0;
+    return r;
+}
+
+static uint32_t stack_scan_locked(Task* t) {
+    if (!t->stack_base) return 0;
+    uint32_t peak = kstack_peak(t->stack_base, t->stack_size);
+    StackRecord* r = stack_record_find(t);
+    if (r && peak > r->peak) {
+        r->peak       = peak;
+        r->stack_size = t->stack_size;
+    }
+    return peak;
+}
+
+// Mark a task dead and queue it for reaping (caller has unlinked its state)
+static void task_make_dead(Task* t) {
+    task_unregister(t);
+    task_set_state(t, TASK_DEAD);
+    list_push_back(&dead_list, t);
+    reap_needed = true;
+    rt_util_total -= t->rt_util;   // Its share is free for new RT tasks
+    t->rt_util = 0;
+}
+
+// ============================================================================
+// Reaping (a work item, off the scheduler path)
+// ============================================================================
+
+static void task_reap(void* arg) {
+    (void)arg;
+
+    // Unlink under the lock, free with it dropped. A dying task is on its
+    // stack until the switch away completes, and its CPU holds the lock
+    // until then - so once we have the lock it is only still current in
+    // the window before that, which the check covers.
+    uint32_t flags = irq_save();
+    sched_lock_acquire();
+    Task* reaped = 0;
+    Task* d = dead_list.head;
+    while (d) {
+        Task* next = d->state_next;
+        if (d != cpus[d->cpu].current) {
+            list_remove(&dead_list, d);
+            stack_scan_locked(d);   // Last look before the stack is reused
+            fpu_release(d);
+            d->state_next = reaped;
+            reaped = d;
+        }
+        d = next;
+    }
+    sched_lock_release();
+    irq_restore(flags);
+
+    while (reaped) {
+        Task* next = reaped->state_next;
+        kstack_free(reaped->stack_base, reaped->stack_size);
+        kstack_free_user(reaped->user_stack, USER_STACK_SIZE);
+        kfree(reaped);
+        reaped = next;
+    }
+}
+
+static WorkItem reap_work = WORK_ITEM_INIT(task_reap, 0);
+
+// Queue the reaper if anything died. Only right after letting go of the
+// lock, never under it: queueing posts a semaphore, which takes the lock.
+static inline void reap_kick() {
+    if (reap_needed) {
+        reap_needed = false;
+        work_queue(&reap_work, WORK_LOW);
+    }
+}
+
+// First code every new task runs. The CPU that switched to us still holds
+// the scheduler lock and had interrupts off (from the timer IRQ or a
+// blocking call), so release one and turn the other back on before handing
+// control to the task body.
+static void task_start(void (*entry)()) {
+    sched_lock_release();
+    reap_kick();
+    __asm__ volatile("sti");
+    entry();
+    task_exit();
+}
+
+// ============================================================================
+// Scheduler core
+// ============================================================================
+
+// Called with interrupts off and the scheduler lock held; returns with the
+// lock released, possibly much later and on another CPU. 'preempted' is
+// true when called from the IRQ exit path, so a task that was still
+// RUNNING is losing the CPU involuntarily.
+static void schedule_locked(bool preempted) {
+    PerCpu* cpu = this_cpu();
+    cpu->need_resched = false;
+    uint64_t now = timer_get_ns();
+
+    // An RT task pays for the time it just ran, and stops if that was all
+    Task* cur = cpu->current;
+    if (is_rt(cur)) {
+        rt_charge(cur, now);
+        if (cur->state == TASK_RUNNING && cur->rt_runtime == 0) rt_throttle(cur);
+    }
+
+    // Wake sleeping tasks: pop the heap root until it is still asleep
+    wake_sleepers(now);
+
+    // Real-time tasks first, earliest deadline first, and a running one is
+    // not time-sliced. Then round-robin: next READY task is at the front of
+    // our queue. With nothing queued, keep running the current task if it
+    // still can, otherwise try to steal from a busier CPU, and finally fall
+    // back to the idle task.
+    Task* old = cpu->current;
+    Task* next = rt_pick(old);
+    if (!next && old->state == TASK_RUNNING && is_rt(old)) {
+        rt_arm_budget(cpu, old);
+        sched_lock_release();
+        return;
+    }
+    if (!next) next = rq_pop(cpu);
+    if (!next) {
+        bool can_continue = old->state == TASK_RUNNING;
+        if (can_continue && old != cpu->idle) {
+            sched_lock_release();
+            return;
+        }
+        next = steal_task(cpu);
+        if (!next) {
+            if (can_continue) {
+                sched_lock_release();
+                return;
+            }
+            next = cpu->idle;
+        }
+    }
+
+    // Transition states
+    if (next == old) {
+        // Just taken off a ready queue: woken while idling in
+        // task_wait_commit, so keep running. Anything else is an idle task
+        // that went to sleep with nothing else to run - it is still linked
+        // on the sleep heap, so it must not turn RUNNING; it halts in
+        // task_wait_commit until the wake-up.
+        if (old->state == TASK_READY) {
+            task_set_state(old, TASK_RUNNING);
+            schedlat_dispatch(old, old->state_since);
+        }
+        sched_lock_release();
+        return;
+    }
+    if (old->state == TASK_RUNNING) {
+        if (preempted) old->nivcsw++; else old->nvcsw++;
+        task_set_state(old, TASK_READY);
+        if (is_rt(old))             enqueue_rt(old);
+        else if (old != cpu->idle) rq_push(cpu, old);
+    } else {
+        old->nvcsw++;  // Slept, blocked, exited or throttled
+    }
+    old->rt_dispatched = 0;
+    cpu->current = next;
+    next->cpu = cpu->id;
+
+    // Where the CPU switches stacks to when 'next' enters the kernel from
+    // ring 3 (interrupts via the TSS, SYSENTER via the MSR pointing here)
+    cpu_tss[cpu->id].esp0 = next->stack_base + next->stack_size;
+    task_set_state(next, TASK_RUNNING);
+    schedlat_dispatch(next, next->state_since);
+    if (is_rt(next)) {
+        next->rt_dispatched = now;
+        rt_arm_budget(cpu, next);
+    }
+
+    // Lazy FPU: arm CR0.TS unless the incoming task already owns the FPU
+    fpu_switch_to(old, next);
+
+    switch_context(&old->esp, next->esp);
+
+    // Back in 'old' - maybe on a different CPU. Whoever switched to us
+    // still holds the lock on our behalf.
+    sched_lock_release();
+    reap_kick();
+}
+
+static void schedule(bool preempted) {
+    if (!scheduler_enabled) return;
+    sched_lock_acquire();
+    schedule_locked(preempted);
+}
+
+// Bootstrap a CPU's currently running code as its idle task
+static Task* task_make_idle(const char* name, uint32_t id) {
+    Task* t = (Task*)kmalloc(sizeof(Task));
+    if (!t) return 0;
+
+    PerCpu* cpu = this_cpu();
+    t->id           = id;
+    t->state        = TASK_RUNNING;
+    t->cpu          = cpu->id;
+    t->pinned_cpu   = cpu->id;
+    t->name         = name;
+    t->esp          = 0;   // filled on first switch away
+    t->stack_base   = 0;   // boot stack, not owned by the scheduler
+    t->stack_size   = 0;
+    t->entry        = 0;
+    t->user_stack   = 0;
+    t->fiber_host   = 0;
+    t->sleep_until  = 0;
+    t->fpu_alloc    = 0;
+    t->fpu_state    = 0;
+    t->fpu_cpu      = -1;
+    t->waiting_on   = 0;
+    t->exit_pending = false;
+    t->rt_period    = 0;
+    t->rt_deadline  = 0;
+    t->rt_budget    = 0;
+    t->rt_runtime   = 0;
+    t->rt_dispatched = 0;
+    t->rt_util      = 0;
+    t->rt_jobs      = 0;
+    t->rt_misses    = 0;
+    t->rt_throttles = 0;
+    t->state_next   = 0;
+    t->state_prev   = 0;
+    t->sleep_child  = 0;
+    task_init_stats(t);
+
+    cpu->current = t;
+    cpu->idle    = t;
+    cpu->ready_queue.head = cpu->ready_queue.tail = 0;
+    cpu->nr_ready = 0;
+    return t;
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
 
 void task_init() {
-    // Mark all slots dead (TASK_DEAD=3, not 0, so must set explicitly)
-    for (int i = 0; i < MAX_TASKS; i++) {
-        tasks[i].state      = TASK_DEAD;
-        tasks[i].stack_base = 0;
-        tasks[i].name       = 0;
-        tasks[i].esp        = 0;
-        tasks[i].sleep_until = 0;
-    }
-
-    // Bootstrap the currently-running kernel as task 0 (the shell)
-    tasks[0].id         = 0;
-    tasks[0].state      = TASK_RUNNING;
-    tasks[0].name       = "shell";
-    tasks[0].esp        = 0;   // filled on first switch away
-    tasks[0].stack_base = 0;   // uses boot stack at 0x90000, not kmalloc'd
-
-    current_task      = 0;
+    sleep_root       = 0;
+    rt_queue.head    = rt_queue.tail    = 0;
+    dead_list.head   = dead_list.tail   = 0;
+    for (int i = 0; i < TASK_HASH_BUCKETS; i++) {
+        hash_index[i] = 0;
+    }
+    all_tasks  = 0;
+    task_count = 0;
+
+    // Bootstrap the currently-running kernel as task 0. Once kernel main
+    // drops into its hlt loop this becomes the bootstrap CPU's idle task:
+    // it is never put on a ready queue and only runs when nothing else can.
+    Task* boot = task_make_idle("idle", 0);
+    if (!boot) return;  // no heap, no scheduler
+    task_register(boot);
+
     next_id           = 1;
     scheduler_enabled = true;
 }
 
-int task_create(void (*entry)(), const char* name) {
-    // Find a free slot
-    int slot = -1;
-    for (int i = 1; i < MAX_TASKS; i++) {
-        if (tasks[i].state == TASK_DEAD) {
-            slot = i;
-            break;
+void task_init_cpu(const char* idle_name) {
+    uint32_t flags = irq_save();
+    sched_lock_acquire();
+    Task* idle = task_make_idle(idle_name, next_id);
+    if (idle) {
+        next_id++;
+        task_register(idle);
+    }
+    sched_lock_release();
+    irq_restore(flags);
+}
+
+// First thing a user task runs, still in ring 0 on its kernel stack
+static void user_task_start() {
+    Task* t = this_cpu()->current;
+    user_enter(t->entry, t->user_stack + USER_STACK_SIZE);
+}
+
+// 'user_entry' set: a ring-3 task, started through user_task_start.
+// 'period_us' set: a real-time task, subject to admission control.
+// 'pinned_cpu' >= 0: the task never leaves that CPU.
+static int create(void (*entry)(), const char* name, uint32_t stack_size,
+                  void (*user_entry)(), uint32_t period_us, uint32_t budget_us,
+                  int pinned_cpu) {
+    stack_size = PAGE_ALIGN_UP(stack_size);
+
+    Task* t = (Task*)kmalloc(sizeof(Task));
+    if (!t) return -1;
+
+    // Allocate a kernel stack, and a user one for ring 3
+    uint8_t* stack = (uint8_t*)kstack_alloc(stack_size);
+    if (!stack) {
+        kfree(t);
+        return -1;
+    }
+    uint32_t user_stack = 0;
+    if (user_entry) {
+        user_stack = kstack_alloc_user(USER_STACK_SIZE);
+        if (!user_stack) {
+            kstack_free((uint32_t)stack, stack_size);
+            kfree(t);
+            return -1;
         }
+        entry = user_task_start;
     }
-    if (slot == -1) return -1;
 
-    // Allocate a kernel stack
-    uint8_t* stack = (uint8_t*)kmalloc(TASK_STACK_SIZE);
-    if (!stack) return -1;
+    // Paint the whole stack so its high-water mark can be measured
+    kstack_paint((uint32_t)stack, stack_size);
 
     // Build the initial switch_context frame on the new stack.
-    // Stack grows downward from stack + TASK_STACK_SIZE.
+    // Stack grows downward from stack + stack_size.
     // Layout when switch_context does its pops then ret:
     //   pop edi, pop esi, pop ebx, pop ebp  <- four zeros
-    //   ret -> pops entry as the return address
-    //   (if entry returns, it lands on task_exit)
-    uint32_t* sp = (uint32_t*)(stack + TASK_STACK_SIZE);
-    *(--sp) = (uint32_t)task_exit;  // safety net if entry() returns
-    *(--sp) = (uint32_t)entry;      // switch_context's ret pops this
+    //   ret -> pops task_start as the return address
+    //   task_start then sees its own (unused) return slot and 'entry' as
+    //   its argument, exactly like a normal cdecl call
+    uint32_t* sp = (uint32_t*)(stack + stack_size);
+    *(--sp) = (uint32_t)entry;      // task_start's argument
+    *(--sp) = (uint32_t)task_exit;  // task_start's return slot (never used)
+    *(--sp) = (uint32_t)task_start; // switch_context's ret pops this
     *(--sp) = 0;                    // ebp
     *(--sp) = 0;                    // ebx
     *(--sp) = 0;                    // esi
     *(--sp) = 0;                    // edi  <- ESP points here
 
-    tasks[slot].id          = next_id++;
-    tasks[slot].esp         = (uint32_t)sp;
-    tasks[slot].stack_base  = (uint32_t)stack;
-    tasks[slot].state       = TASK_READY;
-    tasks[slot].sleep_until = 0;
-    tasks[slot].name        = name;
+    t->esp          = (uint32_t)sp;
+    t->stack_base   = (uint32_t)stack;
+    t->stack_size   = stack_size;
+    t->entry        = user_entry ? user_entry : entry;
+    t->user_stack   = user_stack;
+    t->fiber_host   = 0;
+    t->sleep_until  = 0;
+    t->name         = name;
+    t->fpu_alloc    = 0;
+    t->fpu_state    = 0;
+    t->fpu_cpu      = -1;
+    t->waiting_on   = 0;
+    t->exit_pending = false;
+    t->pinned_cpu   = pinned_cpu;
+    t->rt_period    = (uint64_t)period_us * 1000;
+    t->rt_budget    = (uint64_t)budget_us * 1000;
+    t->rt_runtime   = t->rt_budget;
+    t->rt_dispatched = 0;
+    t->rt_util      = period_us ? (uint32_t)div64_32((uint64_t)budget_us * 1000 + period_us - 1,
+                                                     period_us, 0) : 0;
+    t->rt_jobs      = 0;
+    t->rt_misses    = 0;
+    t->rt_throttles = 0;
+    task_init_stats(t);
 
-    return tasks[slot].id;
+    // Publish under the lock so no CPU ever sees a half-linked task
+    uint32_t flags = irq_save();
+    sched_lock_acquire();
+    if (t->rt_util && rt_util_total + t->rt_util > RT_UTIL_LIMIT) {
+        sched_lock_release();
+        irq_restore(flags);
+        kstack_free(t->stack_base, stack_size);
+        kstack_free_user(user_stack, USER_STACK_SIZE);
+        kfree(t);
+        return TASK_RT_REJECTED;
+    }
+    rt_util_total  += t->rt_util;
+    t->rt_deadline  = timer_get_ns() + t->rt_period;   // First job released now
+    t->id    = next_id++;
+    t->state = TASK_READY;
+    t->cpu   = this_cpu()->id;
+    StackRecord* rec = stack_record_find(t);
+    if (rec) rec->tasks++;
+    task_register(t);
+    enqueue_ready(t);
+    int id = (int)t->id;
+    sched_lock_release();
+    irq_restore(flags);
+
+    return id;
+}
+
+int task_create(void (*entry)(), const char* name) {
+    return create(entry, name, TASK_STACK_SIZE, 0, 0, 0, -1);
+}
+
+int task_create_with_stack(void (*entry)(), const char* name, uint32_t stack_size) {
+    return create(entry, name, stack_size, 0, 0, 0, -1);
+}
+
+int task_create_pinned(void (*entry)(), const char* name, uint32_t cpu) {
+    if (cpu >= SMP_MAX_CPUS || !cpus[cpu].online) return -1;
+    return create(entry, name, TASK_STACK_SIZE, 0, 0, 0, (int)cpu);
+}
+
+int task_create_user(void (*entry)(), const char* name) {
+    return create(0, name, TASK_STACK_SIZE, entry, 0, 0, -1);
+}
+
+int task_create_rt(void (*entry)(), const char* name, uint32_t period_us, uint32_t budget_us) {
+    if (period_us == 0 || budget_us == 0 || budget_us > period_us) return -1;
+    return create(entry, name, TASK_STACK_SIZE, 0, period_us, budget_us, -1);
 }
 
 void task_schedule(registers_t* regs) {
     (void)regs;
-    if (!scheduler_enabled) return;
+    schedule(false);
+}
 
-    // Wake sleeping tasks
-    uint32_t now = timer_get_ticks();
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (tasks[i].state == TASK_SLEEPING && tasks[i].sleep_until <= now) {
-            tasks[i].state = TASK_READY;
-        }
-    }
+void task_request_resched() {
+    this_cpu()->need_resched = true;
+}
 
-    // Reap dead tasks (free stacks while we are NOT on them)
-    for (int i = 1; i < MAX_TASKS; i++) {
-        if (tasks[i].state == TASK_DEAD && tasks[i].stack_base != 0) {
-            kfree((void*)tasks[i].stack_base);
-            tasks[i].stack_base = 0;
-        }
+void task_preempt_check() {
+    PerCpu* cpu = this_cpu();
+    if (cpu->current && cpu->current->exit_pending) {
+        task_exit();  // Killed from another CPU while we were running
     }
-
-    // Round-robin: find next READY task
-    int next = -1;
-    for (int i = 1; i <= MAX_TASKS; i++) {
-        int idx = (current_task + i) % MAX_TASKS;
-        if (tasks[idx].state == TASK_READY) {
-            next = idx;
-            break;
-        }
+    if (cpu->need_resched) {
+        schedule(true);
     }
-    if (next == -1) return;  // nothing else to run
-
-    // Transition states
-    int old = current_task;
-    if (tasks[old].state == TASK_RUNNING) tasks[old].state = TASK_READY;
-    current_task = next;
-    tasks[current_task].state = TASK_RUNNING;
-
-    switch_context(&tasks[old].esp, tasks[current_task].esp);
 }
 
 void task_exit() {
-    if (current_task == 0) return;  // never kill the shell
-    tasks[current_task].state = TASK_DEAD;
-    task_yield();
+    PerCpu* cpu = this_cpu();
+    if (cpu->current == cpu->idle) return;  // idle tasks never exit
+    __asm__ volatile("cli");
+    sched_lock_acquire();
+    task_make_dead(cpu->current);
+    schedule_locked(false);
     // Safety net — should never reach here
     while (1) { __asm__ volatile("hlt"); }
 }
 
+int task_kill(uint32_t id) {
+    uint32_t flags = irq_save();
+    sched_lock_acquire();
+
+    int result = -1;
+    Task* t = task_find(id);
+    if (t && !is_idle_task(t)) {  // never kill an idle task
+        if (t == this_cpu()->current) {
+            sched_lock_release();
+            irq_restore(flags);
+            task_exit();  // does not return
+        }
+        if (t->state == TASK_RUNNING) {
+            // Its stack is in use on another CPU - let it exit itself
+            t->exit_pending = true;
+            kick_cpu(&cpus[t->cpu]);
+        } else {
+            task_unlink_state(t);
+            task_make_dead(t);
+        }
+        result = 0;
+    }
+
+    sched_lock_release();
+    reap_kick();
+    irq_restore(flags);
+    return result;
+}
+
 void task_yield() {
     __asm__ volatile("cli");
-    task_schedule(0);
+    schedule(false);
     __asm__ volatile("sti");
 }
 
 void task_sleep(uint32_t ticks) {
-    tasks[current_task].sleep_until = timer_get_ticks() + ticks;
-    tasks[current_task].state       = TASK_SLEEPING;
-    task_yield();
+    task_sleep_ns((uint64_t)ticks * timer_get_tick_ns());
+}
+
+void task_sleep_ns(uint64_t ns) {
+    __asm__ volatile("cli");
+    sched_lock_acquire();
+    Task* self = this_cpu()->current;
+    self->sleep_until = timer_get_ns() + ns;
+    task_set_state(self, TASK_SLEEPING);
+    sleep_insert(self);
+    if (sleep_root == self) arm_sleep_timer();
+    task_wait_commit();
+    __asm__ volatile("sti");
+}
+
+void task_wait_period() {
+    __asm__ volatile("cli");
+    sched_lock_acquire();
+    Task* self = this_cpu()->current;
+    if (!is_rt(self)) {
+        sched_lock_release();
+        __asm__ volatile("sti");
+        task_yield();
+        return;
+    }
+
+    uint64_t now = timer_get_ns();
+    self->rt_jobs++;
+    if (now > self->rt_deadline) {
+        self->rt_misses++;
+        // Skip the periods overrun entirely instead of bursting through them
+        if (!(self->rt_period >> 32)) {
+            uint32_t behind = (uint32_t)div64_32(now - self->rt_deadline,
+                                                 (uint32_t)self->rt_period, 0);
+            self->rt_deadline += (uint64_t)behind * self->rt_period;
+        }
+    }
+
+    // The next job is released when this period ends, due one period later,
+    // with the whole budget. What this one ran no longer counts.
+    self->sleep_until   = self->rt_deadline;
+    self->rt_deadline  += self->rt_period;
+    self->rt_runtime    = self->rt_budget;
+    self->rt_dispatched = 0;
+    task_set_state(self, TASK_SLEEPING);
+    sleep_insert(self);
+    if (sleep_root == self) arm_sleep_timer();
+    task_wait_commit();
+    __asm__ volatile("sti");
+}
+
+uint32_t task_rt_get_util() {
+    return rt_util_total;
+}
+
+bool task_can_block() {
+    if (!scheduler_enabled) return false;
+    uint32_t flags = irq_save();
+    PerCpu* cpu = this_cpu();
+    bool ok = (flags & EFLAGS_IF) && cpu->current && cpu->current != cpu->idle;
+    irq_restore(flags);
+    return ok;
+}
+
+void task_wait_prepare(WaitQueue* wq) {
+    sched_lock_acquire();
+    Task* self = this_cpu()->current;
+    task_set_state(self, TASK_BLOCKED);
+    self->waiting_on = wq;
+    list_push_back(wq, self);
+}
+
+void task_wait_commit() {
+    schedule_locked(false);
+
+    // An idle task that slept with nothing else to run comes back still
+    // asleep: halt here until an interrupt makes it runnable again
+    while (this_cpu()->current->state != TASK_RUNNING) {
+        __asm__ volatile("sti; hlt; cli");
+        if (this_cpu()->current->state == TASK_READY) schedule(false);
+    }
+}
+
+Task* task_wake_one(WaitQueue* wq) {
+    uint32_t flags = irq_save();
+    sched_lock_acquire();
+    Task* t = list_pop_front(wq);
+    if (t) {
+        t->waiting_on = 0;
+        task_set_state(t, TASK_READY);
+
+        // Don't make the woken task wait out an idle task's time slice
+        PerCpu* target = enqueue_ready(t);
+        schedlat_wake(t, target->current);
+    }
+    sched_lock_release();
+    irq_restore(flags);
+    return t;
+}
+
+int task_wake_all(WaitQueue* wq) {
+    int n = 0;
+    while (task_wake_one(wq)) n++;
+    return n;
+}
+
+Task* task_find(uint32_t id) {
+    Task* t = hash_index[hash_bucket(id)];
+    while (t && t->id != id) {
+        t = t->hash_next;
+    }
+    return t;
+}
+
+Task* task_find_stack_guard(uint32_t addr) {
+    for (Task* t = all_tasks; t; t = t->all_next) {
+        if (kstack_in_guard(t->stack_base, addr)) return t;
+        Fiber* f = t->fiber_host ? t->fiber_host->current : 0;
+        if (f && kstack_in_guard((uint32_t)f->stack, addr)) return t;
+    }
+    return 0;
+}
+
+Task* task_get_current() {
+    return this_cpu()->current;
 }
 
 int task_get_current_id() {
-    return tasks[current_task].id;
+    Task* t = this_cpu()->current;
+    return t ? (int)t->id : 0;
 }
 
 int task_get_count() {
-    int count = 0;
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (tasks[i].state != TASK_DEAD) count++;
-    }
-    return count;
+    return task_count;
 }
 
 Task* task_get_list() {
-    return tasks;
+    return all_tasks;
+}
+
+uint32_t task_list_lock() {
+    uint32_t flags = irq_save();
+    sched_lock_acquire();
+    return flags;
+}
+
+void task_list_unlock(uint32_t flags) {
+    sched_lock_release();
+    irq_restore(flags);
+}
+
+uint32_t task_stack_peak(Task* t) {
+    uint32_t flags = task_list_lock();
+    uint32_t peak = stack_scan_locked(t);
+    task_list_unlock(flags);
+    return peak;
+}
+
+int task_get_stack_records(StackRecord* out, int max) {
+    uint32_t flags = task_list_lock();
+    int n = 0;
+    for (; n < stack_record_count && n < max; n++) {
+        out[n] = stack_records[n];
+    }
+    task_list_unlock(flags);
+    return n;
+}
+
+void task_account_tick() {
+    Task* t = this_cpu()->current;
+    if (t) t->run_ticks++;
+}
+
+int task_collect_stats(TaskStats* out, int max, uint64_t* now) {
+    uint32_t flags = task_list_lock();
+    uint64_t tsc = rdtsc();
+    int n = 0;
+    for (Task* t = all_tasks; t && n < max; t = t->all_next) {
+        TaskStats* s = &out[n++];
+        s->id           = t->id;
+        s->name         = t->name;
+        s->state        = t->state;
+        s->run_ticks    = t->run_ticks;
+        s->nvcsw        = t->nvcsw;
+        s->nivcsw       = t->nivcsw;
+        s->cpu_cycles   = t->cpu_cycles;
+        s->ready_cycles = t->ready_cycles;
+        s->sleep_cycles = t->sleep_cycles;
+
+        // Fold in the interval the task is in right now
+        uint64_t open = tsc - t->state_since;
+        switch (t->state) {
+            case TASK_RUNNING:  s->cpu_cycles   += open; break;
+            case TASK_READY:    s->ready_cycles += open; break;
+            case TASK_SLEEPING:
+            case TASK_BLOCKED:  s->sleep_cycles += open; break;
+            default: break;
+        }
+    }
+
+    task_list_unlock(flags);
+    if (now) *now = tsc;
+    return n;
 }
@@ -3,35 +3,205 @@
 
 #include <stdint.h>
 #include "isr.h"
+#include "schedlat.h"
 
-#define TASK_STACK_SIZE 4096
-#define MAX_TASKS 16
+#define TASK_STACK_SIZE 4096    // Default; task_create_with_stack picks another
+#define USER_STACK_SIZE 4096    // Ring-3 stack of a user task
+
+// id -> Task* hash index (must be a power of two)
+#define TASK_HASH_BUCKETS 1024
+
+// Real-time admission limit: the budget/period sum over all RT tasks, per
+// mille of one CPU. Anything above it is refused (TASK_RT_REJECTED).
+#define RT_UTIL_LIMIT     900
+#define TASK_RT_REJECTED  (-2)
 
 enum TaskState {
     TASK_READY    = 0,
     TASK_RUNNING  = 1,
     TASK_SLEEPING = 2,
-    TASK_DEAD     = 3
+    TASK_DEAD     = 3,
+    TASK_BLOCKED  = 4     // Waiting on a WaitQueue (mutex, semaphore, ...)
+};
+
+struct Task;
+struct FiberHost;
+
+// FIFO of tasks linked through Task::state_next/state_prev
+struct TaskQueue {
+    Task* head;
+    Task* tail;
 };
 
+typedef TaskQueue WaitQueue;
+
 struct Task {
     uint32_t    id;
     uint32_t    esp;          // Saved stack pointer
-    uint32_t    stack_base;   // kmalloc'd base for freeing; 0 for task 0 (boot stack)
+    uint32_t    stack_base;   // Lowest stack address (kstack.h); 0 for idle tasks (boot stacks)
+    uint32_t    stack_size;
+    void      (*entry)();     // Function the task was started with (0 for idle tasks)
+    uint32_t    user_stack;   // Ring-3 stack base (kstack_alloc_user), 0 for kernel tasks
+    FiberHost*  fiber_host;   // Fibers this task is running (fiber.h), if any
     TaskState   state;
-    uint32_t    sleep_until;  // Tick count to wake at
+    uint32_t    cpu;          // CPU it is running / queued on, or last ran on
+    int         pinned_cpu;   // The only CPU it may run on, -1 for any
+    uint64_t    sleep_until;  // timer_get_ns time to wake at
     const char* name;
+    void*       fpu_alloc;    // kmalloc'd FPU save area (0 until first FPU use)
+    uint8_t*    fpu_state;    // 16-byte aligned FXSAVE image inside fpu_alloc
+    int         fpu_cpu;      // CPU whose registers last held our FPU state, -1 if none
+    WaitQueue*  waiting_on;   // Queue we are blocked on (TASK_BLOCKED only)
+    volatile bool exit_pending; // Killed while running on another CPU
+
+    // CPU accounting. Cycle counts are raw TSC deltas; the time spent in the
+    // current state is only folded in on the next state change.
+    uint64_t    cpu_cycles;   // Time spent RUNNING
+    uint64_t    ready_cycles; // Time spent READY, waiting for the CPU
+    uint64_t    sleep_cycles; // Time spent SLEEPING or BLOCKED
+    uint64_t    state_since;  // TSC of the last state change
+    uint32_t    run_ticks;    // Timer ticks that landed while we were running
+    uint32_t    nvcsw;        // Voluntary switches (yield, sleep, block, exit)
+    uint32_t    nivcsw;       // Involuntary switches (preempted)
+
+    // Real-time class (EDF). rt_period is 0 for normal tasks.
+    uint64_t    rt_period;    // ns
+    uint64_t    rt_deadline;  // timer_get_ns end of the current period
+    uint64_t    rt_budget;    // ns of CPU per period
+    uint64_t    rt_runtime;   // ... still left in this one
+    uint64_t    rt_dispatched; // timer_get_ns when last put on a CPU, 0 while off
+    uint32_t    rt_util;      // budget/period, per mille (admission control)
+    uint32_t    rt_jobs;      // Periods completed
+    uint32_t    rt_misses;    // ... that finished after their deadline
+    uint32_t    rt_throttles; // Times it ran out of budget and had to wait
+
+    // Wakeup latency (see schedlat.h)
+    uint64_t    woken_at;        // TSC of the pending wake-up, 0 if none
+    uint32_t    woken_over;      // Task running when we were woken
+    const char* woken_over_name;
+    LatencyHist wake_lat;
+
+    // Intrusive links - a task is never copied, it lives in exactly one
+    // state list (a CPU's ready queue or the RT queue, the sleep heap, dead
+    // list or a wait queue; none while running), one hash bucket chain, and
+    // the list of all live tasks.
+    Task*       state_next;
+    Task*       state_prev;
+    Task*       sleep_child;  // Sleep heap only: first child
+    Task*       hash_next;
+    Task*       all_next;
+    Task*       all_prev;
 };
 
 void   task_init();
+void   task_init_cpu(const char* idle_name);   // Per application processor
 int    task_create(void (*entry)(), const char* name);
+int    task_create_with_stack(void (*entry)(), const char* name, uint32_t stack_size);
+
+// A task that runs 'entry' in ring 3 (see user.h for what that code may
+// touch). It still gets a kernel stack for its system calls and interrupts.
+int    task_create_user(void (*entry)(), const char* name);
+
+// A task that only ever runs on CPU 'cpu' (never balanced or stolen)
+int    task_create_pinned(void (*entry)(), const char* name, uint32_t cpu);
+
+// A periodic real-time task: every 'period_us' it needs up to 'budget_us'
+// of CPU, and each job has to finish before the period ends. Ready RT tasks
+// run ahead of every normal task, earliest deadline first, and are never
+// time-sliced. Returns TASK_RT_REJECTED if the new total utilization would
+// exceed RT_UTIL_LIMIT. The budget is enforced too: a task that uses it up
+// within a period is throttled - off the CPU until the period ends, then
+// back with a fresh budget and the next deadline - so an overrunning job
+// only ever delays itself.
+int    task_create_rt(void (*entry)(), const char* name, uint32_t period_us, uint32_t budget_us);
+
+// End of this period's job (RT tasks): sleep until the next period starts.
+// A job that finished late counts as a miss; periods overrun entirely are
+// skipped. Normal tasks just yield.
+void   task_wait_period();
+uint32_t task_rt_get_util();   // Admitted utilization, per mille
 void   task_exit();
+int    task_kill(uint32_t id);
 void   task_yield();
 void   task_sleep(uint32_t ticks);
+void   task_sleep_ns(uint64_t ns);
+
+// The caller may block: the scheduler is up, it is not an idle task and
+// interrupts are enabled. Otherwise waits have to spin.
+bool   task_can_block();
 void   task_schedule(registers_t* regs);
+
+// Ask for a reschedule at the next IRQ exit (safe from IRQ handlers), and the
+// IRQ exit hook that performs it - interrupts must be disabled
+void   task_request_resched();
+void   task_preempt_check();
+
+// Blocking on a wait queue - both halves must run with interrupts disabled.
+// task_wait_prepare queues the current task as TASK_BLOCKED; the caller may
+// then drop its own lock and call task_wait_commit to switch away until a
+// task_wake_* call makes it runnable again. Only for callers that
+// task_can_block - an idle task has nothing to switch to.
+void   task_wait_prepare(WaitQueue* wq);
+void   task_wait_commit();
+Task*  task_wake_one(WaitQueue* wq);   // Returns the woken task, or 0
+int    task_wake_all(WaitQueue* wq);   // Returns how many were woken
+
+Task*  task_find(uint32_t id);
+
+// Task whose stack guard page contains 'addr' - its own, or that of the
+// fiber it is running - or 0. Takes no locks - it is meant for fault
+// handlers.
+Task*  task_find_stack_guard(uint32_t addr);
+Task*  task_get_current();
 int    task_get_current_id();
 int    task_get_count();
+
+// Head of the list of all live tasks - walk it with task->all_next. Code
+// that must not race with other CPUs holds the scheduler lock meanwhile.
 Task*  task_get_list();
+uint32_t task_list_lock();
+void   task_list_unlock(uint32_t flags);
+
+// Point-in-time copy of one task's accounting, with the time spent in its
+// current state already folded in
+struct TaskStats {
+    uint32_t    id;
+    const char* name;
+    TaskState   state;
+    uint32_t    run_ticks;
+    uint32_t    nvcsw;
+    uint32_t    nivcsw;
+    uint64_t    cpu_cycles;
+    uint64_t    ready_cycles;
+    uint64_t    sleep_cycles;
+};
+
+// Stack high-water marks. New stacks are painted with a canary; scanning
+// one finds the deepest point the task has reached so far. Every scan, and
+// a final one when the task is reaped, feeds a running worst case kept per
+// task name and entry function - that survives the tasks themselves.
+#define STACK_RECORD_MAX 32
+
+struct StackRecord {
+    const char* name;
+    void      (*entry)();
+    uint32_t    tasks;        // Tasks created with this name and entry
+    uint32_t    peak;         // Deepest stack use seen, bytes
+    uint32_t    stack_size;   // Stack size of the task that hit the peak
+};
+
+// Scan a task's stack and return its peak use in bytes (0 for idle tasks)
+uint32_t task_stack_peak(Task* t);
+
+// Copy up to 'max' worst-case records into 'out'. Returns how many.
+int    task_get_stack_records(StackRecord* out, int max);
+
+// Charge the current timer tick to the running task (timer IRQ)
+void   task_account_tick();
+
+// Snapshot up to 'max' tasks into 'out' atomically. Returns how many were
+// written; *now receives the TSC the snapshot was taken at.
+int    task_collect_stats(TaskStats* out, int max, uint64_t* now);
 
 extern "C" void switch_context(uint32_t* old_esp, uint32_t new_esp);
 
@@ -6,6 +6,8 @@ global switch_context
 ; Saves callee-saved registers onto the current stack, stores ESP into *old_esp,
 ; loads new_esp, restores the new task's callee-saved registers, and returns
 ; into the new task.
+; x87/SSE state is not touched here - it is switched lazily by the #NM
+; handler in fpu.cpp, armed by CR0.TS which task_schedule sets.
 switch_context:
     mov eax, [esp + 4]      ; eax = old_esp pointer
     mov ecx, [esp + 8]      ; ecx = new_esp value
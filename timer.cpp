@@ -2,6 +2,10 @@
 #include "isr.h"
 #include "ports.h"
 #include "task.h"
+#include "defer.h"
+#include "percpu.h"
+#include "apic.h"
+#include "cpu.h"
 
 static volatile uint32_t ticks = 0;
 
@@ -12,25 +16,98 @@ static volatile uint32_t ticks = 0;
 // PIT base frequency (1.193182 MHz)
 #define PIT_BASE_FREQ 1193180
 
-static void timer_callback(registers_t* regs) {
-    ticks++;
+// One PIT count is 838.095ns
+#define PIT_COUNT_NS       838
+#define PIT_COUNT_NS_FRAC  95      // Thousandths
+
+// TSC calibration window, in ticks
+#define CALIBRATE_TICKS    10
+
+// Longest single one-shot; later deadlines are re-armed on the way
+#define ONESHOT_MAX_NS     1000000000
+
+// ns = cycles * tsc_mult >> TSC_SHIFT
+#define TSC_SHIFT          24
+
+enum EventBackend {
+    EVENT_PIT,              // Tick only
+    EVENT_LAPIC_ONESHOT,
+    EVENT_TSC_DEADLINE
+};
+
+static uint32_t pit_divisor = 0;
+static uint32_t tick_ns = 0;
 
-    // Show tick count at top-right corner
+static bool     use_tsc = false;
+static uint32_t tsc_khz = 0;
+static uint32_t tsc_mult = 0;
+static uint64_t tsc_base = 0;           // TSC at calibration...
+static uint64_t tsc_base_ns = 0;        // ...and the time it stood for
+
+static EventBackend event_backend = EVENT_PIT;
+static volatile uint64_t oneshot_deadline = 0;   // 0 = nothing armed
+static void (*event_handler)() = 0;
+
+static uint64_t last_tick_ns = 0;
+static uint32_t missed_ticks = 0;
+
+// Show tick count at top-right corner (deferred - not worth IRQ time)
+static void timer_tick_display(void* arg) {
+    (void)arg;
     uint16_t* vga = (uint16_t*)0xb8000;
     vga[79] = (0x0E << 8) | ('0' + (ticks % 10));
+}
 
-    task_schedule(regs);
+static DeferredWork tick_display_work = DEFERRED_WORK_INIT(timer_tick_display, 0);
+
+static void timer_callback(registers_t* regs) {
+    irq_entry_probe(regs->int_no);
+    ticks++;
+    this_cpu()->local_ticks++;
+    task_account_tick();
+
+    // The PIT only latches one pending tick, so interrupts held off for
+    // longer lose the rest. Only the TSC clock can see that - the PIT one
+    // is built from the tick count.
+    if (use_tsc) {
+        uint64_t now = timer_get_ns();
+        uint64_t gap = now - last_tick_ns;
+        if (last_tick_ns && gap > tick_ns + tick_ns / 2) {
+            missed_ticks += (uint32_t)div64_32(gap + tick_ns / 2, tick_ns, 0) - 1;
+        }
+        last_tick_ns = now;
+    }
+
+    defer_schedule(&tick_display_work, DEFER_LOW);
+
+    if (event_handler) event_handler();
+
+    // Time slice over - reschedule on the way out of the interrupt
+    task_request_resched();
+}
+
+// Also raised by other CPUs as an IPI when they need it re-armed
+static void oneshot_callback(registers_t* regs) {
+    irq_entry_probe(regs->int_no);
+    oneshot_deadline = 0;
+    if (event_handler) event_handler();
 }
 
 void timer_init(uint32_t frequency) {
-    // Register our callback for IRQ0 (interrupt 32)
-    register_interrupt_handler(32, timer_callback);
+    // Register our callback for IRQ0 (interrupt 32). Both timer vectors
+    // take the fast entry path - they fire more than anything else.
+    register_fast_irq_handler(32, timer_callback);
+    register_fast_irq_handler(LAPIC_ONESHOT_VECTOR, oneshot_callback);
     
     // Calculate divisor
     uint32_t divisor = PIT_BASE_FREQ / frequency;
+    pit_divisor = divisor;
+    tick_ns = 1000000000 / frequency;
     
-    // Send command byte: channel 0, lobyte/hibyte, square wave mode
-    outb(PIT_COMMAND, 0x36);
+    // Send command byte: channel 0, lobyte/hibyte, rate generator. Unlike
+    // square wave mode the count runs down by one per clock, so reading it
+    // tells how far into the tick we are.
+    outb(PIT_COMMAND, 0x34);
     
     // Send divisor (low byte first, then high byte)
     outb(PIT_CHANNEL0, (uint8_t)(divisor & 0xFF));
@@ -39,4 +116,141 @@ void timer_init(uint32_t frequency) {
 
 uint32_t timer_get_ticks() {
     return ticks;
+}
+
+uint32_t timer_get_tick_ns() {
+    return tick_ns;
+}
+
+uint32_t timer_get_missed_ticks() {
+    return missed_ticks;
+}
+
+// =============================================================================
+// Clock source
+// =============================================================================
+
+// Tick count plus the PIT's progress through the current tick. A tick that
+// is due but not yet handled (interrupts off) would make time step back, so
+// the result never goes below the last one returned.
+static uint64_t pit_get_ns() {
+    static uint64_t last_ns = 0;
+
+    uint32_t flags = irq_save();
+    uint32_t t = ticks;
+    outb(PIT_COMMAND, 0x00);            // Latch channel 0
+    uint32_t count = inb(PIT_CHANNEL0);
+    count |= (uint32_t)inb(PIT_CHANNEL0) << 8;
+
+    uint32_t into = (count <= pit_divisor) ? pit_divisor - count : 0;
+    uint64_t ns = (uint64_t)t * tick_ns + into * PIT_COUNT_NS + into * PIT_COUNT_NS_FRAC / 1000;
+    if (ns < last_ns) ns = last_ns;
+    last_ns = ns;
+    irq_restore(flags);
+    return ns;
+}
+
+uint64_t timer_get_ns() {
+    if (use_tsc) {
+        return tsc_base_ns + mul_u64_u32_shr(rdtsc() - tsc_base, tsc_mult, TSC_SHIFT);
+    }
+    return pit_get_ns();
+}
+
+void timer_calibrate() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    bool have_tsc = (edx & CPUID_EDX_TSC) != 0;
+
+    // Start on a tick edge, then count TSC cycles and LAPIC timer ticks
+    // over a whole number of PIT ticks
+    uint32_t start = timer_get_ticks();
+    while (timer_get_ticks() == start) __asm__ volatile("hlt");
+
+    uint64_t tsc_start = have_tsc ? rdtsc() : 0;
+    lapic_timer_calibrate_begin();
+    start = timer_get_ticks();
+    while (timer_get_ticks() - start < CALIBRATE_TICKS) __asm__ volatile("hlt");
+    uint64_t tsc_end = have_tsc ? rdtsc() : 0;
+    lapic_timer_calibrate_end(CALIBRATE_TICKS);
+
+    uint32_t window_ms = CALIBRATE_TICKS * (tick_ns / 1000000);
+    if (have_tsc && window_ms) {
+        tsc_khz = (uint32_t)div64_32(tsc_end - tsc_start, window_ms, 0);
+    }
+    if (tsc_khz) {
+        // ns per cycle = 10^6 / kHz, as a 24-bit fixed point fraction
+        tsc_mult = (uint32_t)div64_32((uint64_t)1000000 << TSC_SHIFT, tsc_khz, 0);
+
+        uint32_t flags = irq_save();
+        tsc_base_ns = pit_get_ns();
+        tsc_base    = rdtsc();
+        use_tsc     = true;
+        irq_restore(flags);
+    }
+
+    if (lapic_timer_get_ticks_per_pit()) {
+        event_backend = (use_tsc && lapic_tsc_deadline_supported()) ? EVENT_TSC_DEADLINE
+                                                                    : EVENT_LAPIC_ONESHOT;
+    }
+}
+
+uint32_t timer_get_tsc_khz() {
+    return use_tsc ? tsc_khz : 0;
+}
+
+const char* timer_get_clocksource() {
+    return use_tsc ? "tsc" : "pit";
+}
+
+const char* timer_get_event_backend() {
+    switch (event_backend) {
+        case EVENT_TSC_DEADLINE:  return "lapic tsc-deadline";
+        case EVENT_LAPIC_ONESHOT: return "lapic one-shot";
+        default:                  return "pit tick";
+    }
+}
+
+// =============================================================================
+// One-shot events. Bootstrap CPU only: it ticks from the PIT, so its LAPIC
+// timer is free, while the application processors run theirs periodically.
+// =============================================================================
+
+void timer_set_event_handler(void (*handler)()) {
+    event_handler = handler;
+}
+
+bool timer_arm_oneshot(uint64_t deadline_ns) {
+    if (event_backend == EVENT_PIT) return false;
+
+    uint32_t flags = irq_save();
+    if (this_cpu()->id != 0) {
+        irq_restore(flags);
+        return false;
+    }
+
+    uint64_t now = timer_get_ns();
+    uint64_t pending = oneshot_deadline;
+    if (pending && pending > now && pending <= deadline_ns) {
+        irq_restore(flags);
+        return true;        // Something earlier will fire first anyway
+    }
+
+    uint32_t delta = ONESHOT_MAX_NS;
+    if (deadline_ns <= now) {
+        delta = 1;
+    } else if (deadline_ns - now < ONESHOT_MAX_NS) {
+        delta = (uint32_t)(deadline_ns - now);
+    }
+    oneshot_deadline = now + delta;
+
+    if (event_backend == EVENT_TSC_DEADLINE) {
+        uint64_t cycles = div64_32((uint64_t)delta * tsc_khz, 1000000, 0);
+        lapic_timer_deadline(LAPIC_ONESHOT_VECTOR, rdtsc() + cycles);
+    } else {
+        lapic_timer_oneshot(LAPIC_ONESHOT_VECTOR, delta);
+    }
+
+    irq_restore(flags);
+    return true;
 }
\ No newline at end of file
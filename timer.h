@@ -5,5 +5,34 @@
 
 void timer_init(uint32_t frequency);
 uint32_t timer_get_ticks();
+uint32_t timer_get_tick_ns();       // Length of one tick
+uint32_t timer_get_missed_ticks();  // PIT ticks lost to long interrupts-off stretches (TSC clock only)
+
+// =============================================================================
+// High-resolution time
+//
+// The clock source is the TSC, calibrated against the PIT, when the CPU has
+// one; without it the tick count is refined with the PIT's current count.
+// One-shot timer interrupts come from the bootstrap CPU's local APIC timer
+// (TSC-deadline mode if available). With no local APIC the next PIT tick is
+// the earliest wake-up there is.
+// =============================================================================
+
+// Measure the TSC and LAPIC timer against the PIT (interrupts must be on)
+void        timer_calibrate();
+
+uint64_t    timer_get_ns();         // Since boot
+uint32_t    timer_get_tsc_khz();    // 0 unless the TSC is the clock source
+const char* timer_get_clocksource();
+const char* timer_get_event_backend();
+
+// Request a timer interrupt at 'deadline_ns' (timer_get_ns time). An earlier
+// request that is still pending is kept. Returns false if there is no
+// one-shot backend, or when called off the bootstrap CPU.
+bool        timer_arm_oneshot(uint64_t deadline_ns);
+
+// Called on every PIT tick and one-shot interrupt on the bootstrap CPU
+// (interrupts disabled) - hrtimer_init installs its expiry check here
+void        timer_set_event_handler(void (*handler)());
 
 #endif
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include "user.h"
+#include "paging.h"
+#include "task.h"
+#include "vga.h"
+#include "cpu.h"
+
+// Section bounds, provided by the linker. Weak so an empty section links.
+extern "C" uint8_t __start_user_text[]   __attribute__((weak));
+extern "C" uint8_t __stop_user_text[]    __attribute__((weak));
+extern "C" uint8_t __start_user_rodata[] __attribute__((weak));
+extern "C" uint8_t __stop_user_rodata[]  __attribute__((weak));
+
+// Read-only for ring 3 (the kernel can still write there, CR0.WP is clear).
+// The pages at either end can be shared with whatever the linker put next to
+// the section; that becomes readable from ring 3 too.
+static void map_user_section(uint8_t* start, uint8_t* stop) {
+    for (uint32_t page = PAGE_ALIGN_DOWN((uint32_t)start); page < (uint32_t)stop; page += PAGE_SIZE) {
+        map_page(page, page, PTE_PRESENT | PTE_USER);
+    }
+}
+
+void user_init() {
+    map_user_section(__start_user_text, __stop_user_text);
+    map_user_section(__start_user_rodata, __stop_user_rodata);
+}
+
+void user_enter(void (*entry)(), uint32_t stack_top) {
+    uint32_t* sp = (uint32_t*)stack_top;
+    *(--sp) = (uint32_t)user_exit;  // entry's return address
+
+    // Build the frame an interrupt from ring 3 would have left and iret
+    // through it. Data segments first - the CPU would null ours anyway.
+    __asm__ volatile(
+        "cli\n"
+        "mov %0, %%ds\n"
+        "mov %0, %%es\n"
+        "mov %0, %%fs\n"
+        "mov %0, %%gs\n"
+        "push %1\n"         // ss
+        "push %2\n"         // esp
+        "push %3\n"         // eflags
+        "push %4\n"         // cs
+        "push %5\n"         // eip
+        "iret\n"
+        :
+        : "r"((uint32_t)USER_DS), "i"(USER_DS), "r"(sp), "i"(EFLAGS_IF | 0x2),
+          "i"(USER_CS), "r"(entry)
+        : "memory");
+    __builtin_unreachable();
+}
+
+void user_fault(registers_t* regs, uint32_t fault_addr) {
+    vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+    vga_print("[task ");
+    vga_print_int(task_get_current_id());
+    vga_print("] killed: exception ");
+    vga_print_int(regs->int_no);
+    vga_print(" at ");
+    vga_print_hex(regs->eip);
+    if (regs->int_no == 14) {
+        vga_print(", address ");
+        vga_print_hex(fault_addr);
+    }
+    vga_put_char('\n');
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    task_exit();
+}
@@ -0,0 +1,45 @@
+#ifndef USER_H
+#define USER_H
+
+#include <stdint.h>
+#include "isr.h"
+#include "gdt.h"
+
+// =============================================================================
+// User mode (ring 3)
+//
+// There is still only one address space. A user program is an ordinary
+// function in the kernel image placed in the user_text section (with its
+// constant data in user_rodata); user_init maps just those pages PTE_USER,
+// so ring-3 code can run them but cannot touch the rest of the kernel.
+// Ring-3 code must not call anything outside the user sections - at -O0
+// even a static inline helper from a header is a call into kernel text.
+// System calls go through the stubs at the bottom (numbers in syscall.h).
+// =============================================================================
+
+#define USER_TEXT   __attribute__((section("user_text"), noinline))
+#define USER_RODATA __attribute__((section("user_rodata")))
+
+#define USER_CS (GDT_USER_CODE | 3)
+#define USER_DS (GDT_USER_DATA | 3)
+
+// Open the user sections to ring 3 (needs paging)
+void user_init();
+
+// Drop the calling task into ring 3 at 'entry' on the user stack ending at
+// 'stack_top'. Returning from 'entry' exits the task. Never returns.
+void user_enter(void (*entry)(), uint32_t stack_top);
+
+// Kill the current task for an exception it took in ring 3. 'fault_addr'
+// is CR2 for page faults and ignored otherwise.
+void user_fault(registers_t* regs, uint32_t fault_addr);
+
+// Ring-3 side (syscall.asm, in user_text). Arguments travel in ebx, esi
+// and edi, the number in eax; the result comes back in eax.
+extern "C" {
+    uint32_t user_syscall(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3);      // SYSENTER
+    uint32_t user_syscall_int(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3);  // int 0x80
+    void     user_exit();
+}
+
+#endif
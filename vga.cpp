@@ -1,4 +1,5 @@
 #include "vga.h"
+#include "sync.h"
 
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
@@ -9,6 +10,10 @@ static int cursor_x;
 static int cursor_y;
 static uint8_t current_color;
 
+// The shell and background tasks print concurrently; keep the cursor and
+// scrolling consistent (and whole strings together) under this lock
+static Spinlock vga_lock = SPINLOCK_INIT;
+
 void vga_init() {
     vga_buffer = (uint16_t*)VGA_MEMORY;
     cursor_x = 0;
@@ -30,7 +35,7 @@ static void vga_scroll() {
     cursor_y = VGA_HEIGHT - 1;
 }
 
-void vga_put_char(char c) {
+static void vga_put_char_locked(char c) {
     if (c == '\n') {
         cursor_x = 0;
         cursor_y++;
@@ -58,18 +63,28 @@ void vga_put_char(char c) {
     }
 }
 
+void vga_put_char(char c) {
+    spin_lock(&vga_lock);
+    vga_put_char_locked(c);
+    spin_unlock(&vga_lock);
+}
+
 void vga_print(const char* str) {
+    spin_lock(&vga_lock);
     while (*str) {
-        vga_put_char(*str++);
+        vga_put_char_locked(*str++);
     }
+    spin_unlock(&vga_lock);
 }
 
 void vga_clear() {
+    spin_lock(&vga_lock);
     for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
         vga_buffer[i] = (current_color << 8) | ' ';
     }
     cursor_x = 0;
     cursor_y = 0;
+    spin_unlock(&vga_lock);
 }
 
 void vga_print_hex(uint32_t value) {
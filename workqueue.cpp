@@ -0,0 +1,155 @@
+#include "workqueue.h"
+#include "cpu.h"
+#include "sync.h"
+#include "task.h"
+#include "timer.h"
+
+// =============================================================================
+// Shared queue
+//
+// One FIFO per priority under a single spinlock - workers take whole items,
+// so contention is one short critical section per item. work_ready counts
+// queued items; every worker sleeps on it.
+//
+// Flushing uses two colors: each item is tagged with the color current when
+// it was queued and in_flight counts queued-or-running items per color. A
+// flush flips the color and waits for the old one to drain, so work queued
+// after the flush started never holds it up. Flushes are serialized, which
+// guarantees the color a flush flips to is already empty.
+// =============================================================================
+
+struct WorkList {
+    WorkItem* head;
+    WorkItem* tail;
+};
+
+static WorkList queue[WORK_PRIORITIES];
+static Spinlock work_lock = SPINLOCK_INIT;
+static Semaphore work_ready = SEMAPHORE_INIT(0);
+
+static uint32_t color = 0;
+static uint32_t in_flight[2];
+static bool flush_waiting = false;
+static Mutex flush_mutex = MUTEX_INIT;
+static Semaphore flush_done = SEMAPHORE_INIT(0);
+
+static WorkQueueStats stats;
+
+static const char* worker_names[WORK_WORKERS] = { "kworker0", "kworker1", "kworker2" };
+
+// Highest-priority waiting item, with *prio set to its priority. Lock held.
+static WorkItem* take_locked(int* prio) {
+    for (int p = 0; p < WORK_PRIORITIES; p++) {
+        WorkItem* w = queue[p].head;
+        if (!w) continue;
+        queue[p].head = w->next;
+        if (!queue[p].head) queue[p].tail = 0;
+        w->next = 0;
+        stats.depth[p]--;
+        *prio = p;
+        return w;
+    }
+    return 0;
+}
+
+// =============================================================================
+// Workers
+// =============================================================================
+
+static void worker_main() {
+    while (1) {
+        sem_wait(&work_ready);
+
+        int prio;
+        spin_lock(&work_lock);
+        WorkItem* w = take_locked(&prio);
+        if (!w) {
+            spin_unlock(&work_lock);
+            continue;
+        }
+        uint64_t start = timer_get_ns();
+        uint64_t wait  = start - w->queued_at;
+        stats.wait_ns[prio] += wait;
+        if (wait > stats.max_wait_ns[prio]) stats.max_wait_ns[prio] = wait;
+        stats.busy++;
+        uint32_t item_color = w->color;
+        void (*fn)(void*) = w->fn;
+        void* arg = w->arg;
+        w->pending = 0;   // Cleared first so fn may re-queue itself
+        spin_unlock(&work_lock);
+
+        fn(arg);
+
+        uint64_t ran = timer_get_ns() - start;
+        spin_lock(&work_lock);
+        stats.busy--;
+        stats.run[prio]++;
+        if (ran > stats.max_run_ns) stats.max_run_ns = ran;
+        in_flight[item_color]--;
+        bool wake = flush_waiting && item_color != color && in_flight[item_color] == 0;
+        if (wake) flush_waiting = false;
+        spin_unlock(&work_lock);
+
+        if (wake) sem_post(&flush_done);
+    }
+}
+
+// =============================================================================
+// Public API
+// =============================================================================
+
+void work_init() {
+    for (int i = 0; i < WORK_WORKERS; i++) {
+        if (task_create(worker_main, worker_names[i]) >= 0) {
+            stats.workers++;
+        }
+    }
+}
+
+bool work_queue(WorkItem* work, WorkPriority prio) {
+    if (atomic_xchg(&work->pending, 1) != 0) {
+        return false;  // Already queued
+    }
+
+    uint64_t now = timer_get_ns();
+    spin_lock(&work_lock);
+    work->color     = color;
+    work->queued_at = now;
+    work->next      = 0;
+    if (queue[prio].tail) queue[prio].tail->next = work;
+    else                  queue[prio].head = work;
+    queue[prio].tail = work;
+    in_flight[color]++;
+
+    stats.queued[prio]++;
+    stats.depth[prio]++;
+    uint32_t depth = 0;
+    for (int p = 0; p < WORK_PRIORITIES; p++) depth += stats.depth[p];
+    if (depth > stats.max_depth) stats.max_depth = depth;
+    spin_unlock(&work_lock);
+
+    sem_post(&work_ready);
+    return true;
+}
+
+void work_queue_flush() {
+    mutex_lock(&flush_mutex);
+
+    spin_lock(&work_lock);
+    uint32_t old = color;
+    color ^= 1;
+    bool wait = in_flight[old] != 0;
+    if (wait) flush_waiting = true;
+    stats.flushes++;
+    spin_unlock(&work_lock);
+
+    if (wait) sem_wait(&flush_done);
+
+    mutex_unlock(&flush_mutex);
+}
+
+void work_get_stats(WorkQueueStats* out) {
+    spin_lock(&work_lock);
+    *out = stats;
+    spin_unlock(&work_lock);
+}
@@ -0,0 +1,65 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdint.h>
+
+// =============================================================================
+// Work queue
+//
+// A small pool of kernel worker tasks ("kworker0".."kworkerN") pulling from
+// one shared queue, for work that is too slow to do inline but, unlike a
+// bottom half (defer.h), is allowed to block: sleeping locks, disk I/O,
+// task_sleep. Queued items run in FIFO order within a priority and higher
+// priorities always go first.
+//
+// An item can be queued at most once at a time; queueing it again while it
+// is still pending is a no-op. Its callback may re-queue it.
+// =============================================================================
+
+#define WORK_WORKERS 3
+
+enum WorkPriority {
+    WORK_HIGH   = 0,
+    WORK_NORMAL = 1,
+    WORK_LOW    = 2,
+    WORK_PRIORITIES
+};
+
+struct WorkItem {
+    void              (*fn)(void* arg);
+    void*             arg;
+    volatile uint32_t pending;
+    uint32_t          color;        // Flush generation it was queued in
+    uint64_t          queued_at;    // timer_get_ns, for the latency stats
+    WorkItem*         next;
+};
+
+#define WORK_ITEM_INIT(fn, arg) { (fn), (arg), 0, 0, 0, 0 }
+
+struct WorkQueueStats {
+    uint32_t depth[WORK_PRIORITIES];   // Waiting right now
+    uint32_t max_depth;                // Most ever waiting at once, all priorities
+    uint32_t queued[WORK_PRIORITIES];
+    uint32_t run[WORK_PRIORITIES];
+    uint64_t wait_ns[WORK_PRIORITIES]; // Total queued -> started
+    uint64_t max_wait_ns[WORK_PRIORITIES];
+    uint64_t max_run_ns;               // Longest single callback
+    uint32_t workers;                  // Started
+    uint32_t busy;                     // Running an item right now
+    uint32_t flushes;
+};
+
+// Start the workers (needs the scheduler). Items queued earlier just wait.
+void work_init();
+
+// Queue an item. Any context, IRQ handlers included. Returns false if it
+// was already pending.
+bool work_queue(WorkItem* work, WorkPriority prio);
+
+// Block until everything queued before the call has finished running.
+// Task context only, and never from a work item (it would wait for itself).
+void work_queue_flush();
+
+void work_get_stats(WorkQueueStats* out);
+
+#endif